@@ -0,0 +1,121 @@
+/** Lighthouse advertisement classifier.
+ *
+ * Decides from the raw advertising payload whether an advert comes from a
+ * base station we want for the current command, walking the AD structures
+ * once without allocating. The scan callback and the host-side trace replay
+ * tool (tools/trace_replay) share this code, so replay measures exactly what
+ * runs on the device.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "batch_plan.h"
+#include "config_store.h"
+
+namespace lighthouse {
+namespace advert {
+
+// AD types (Bluetooth Core Supplement, part A)
+constexpr uint8_t kIncomplete16 = 0x02;
+constexpr uint8_t kComplete16 = 0x03;
+constexpr uint8_t kIncomplete128 = 0x06;
+constexpr uint8_t kComplete128 = 0x07;
+constexpr uint8_t kShortName = 0x08;
+constexpr uint8_t kCompleteName = 0x09;
+
+// V1 (HTC) service 0xCB00, as a 16-bit UUID and on the Bluetooth base UUID
+constexpr uint16_t kServiceV1 = 0xCB00;
+constexpr uint8_t kServiceV1Uuid128[16] = {0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+                                           0x00, 0x10, 0x00, 0x00, 0x00, 0xCB, 0x00, 0x00};
+// V2 service 00001523-1212-efde-1523-785feabcd124, little endian as sent
+constexpr uint8_t kServiceV2Uuid128[16] = {0x24, 0xD1, 0xBC, 0xEA, 0x5F, 0x78, 0x23, 0x15,
+                                           0xDE, 0xEF, 0x12, 0x12, 0x23, 0x15, 0x00, 0x00};
+
+struct AdvertInfo {
+  uint8_t version = 0;          // 1 = V1 (HTC), 2 = V2.0, 0 = not a base station
+  const char* name = nullptr;   // Points into the payload, not NUL-terminated
+  uint8_t nameLen = 0;
+};
+
+inline AdvertInfo parseAdvert(const uint8_t* payload, size_t len) {
+  AdvertInfo info;
+  size_t pos = 0;
+  while (pos < len) {
+    uint8_t fieldLen = payload[pos];
+    if (fieldLen == 0 || pos + 1 + fieldLen > len) break;
+    uint8_t type = payload[pos + 1];
+    const uint8_t* data = payload + pos + 2;
+    size_t dataLen = fieldLen - 1;
+
+    if (type == kIncomplete16 || type == kComplete16) {
+      for (size_t i = 0; i + 2 <= dataLen; i += 2) {
+        if ((data[i] | (data[i + 1] << 8)) == kServiceV1) info.version = 1;
+      }
+    } else if (type == kIncomplete128 || type == kComplete128) {
+      for (size_t i = 0; i + 16 <= dataLen; i += 16) {
+        if (memcmp(data + i, kServiceV1Uuid128, 16) == 0) info.version = 1;
+        if (memcmp(data + i, kServiceV2Uuid128, 16) == 0) info.version = 2;
+      }
+    } else if (type == kCompleteName || (type == kShortName && info.name == nullptr)) {
+      info.name = reinterpret_cast<const char*>(data);
+      info.nameLen = dataLen;
+    }
+    pos += 1 + fieldLen;
+  }
+  return info;
+}
+
+inline bool nameContains(const char* name, size_t nameLen, const char* token) {
+  size_t tokenLen = strlen(token);
+  if (tokenLen == 0 || tokenLen > nameLen) return false;
+  for (size_t i = 0; i + tokenLen <= nameLen; i++) {
+    if (memcmp(name + i, token, tokenLen) == 0) return true;
+  }
+  return false;
+}
+
+// Configured station lookups, -1 if not configured
+inline int findStationByName(const ControllerConfig& config, const char* name, size_t nameLen) {
+  for (int i = 0; i < config.stationCount; i++) {
+    const StationConfig& station = config.stations[i];
+    if (station.version == 1 && nameContains(name, nameLen, station.advertisedId)) return i;
+  }
+  return -1;
+}
+
+inline int findStationByAddress(const ControllerConfig& config, const uint8_t nativeAddress[6]) {
+  for (int i = 0; i < config.stationCount; i++) {
+    if (config.stations[i].version == 2 && macMatchesNative(config.stations[i].mac, nativeAddress)) return i;
+  }
+  return -1;
+}
+
+struct AdvertMatch {
+  uint8_t version = 0;      // 0 if not a base station
+  int8_t mappingIndex = -1; // Configured station, -1 if unknown
+  bool accept = false;      // Part of the command, record it
+};
+
+// V1 stations are identified by name and must be configured. V2 stations are
+// identified by address; unconfigured ones are accepted for the plan's
+// unmapped action unless `v2Filtering` restricts commands to configured ones.
+inline AdvertMatch classifyAdvert(const uint8_t* payload, size_t len, const uint8_t nativeAddress[6],
+                                  const ControllerConfig& config, const BatchPlan& plan, bool v2Filtering) {
+  AdvertMatch match;
+  AdvertInfo info = parseAdvert(payload, len);
+  match.version = info.version;
+  if (info.version == 1) {
+    match.mappingIndex = info.name ? findStationByName(config, info.name, info.nameLen) : -1;
+    match.accept = match.mappingIndex >= 0 && plan.actionFor(match.mappingIndex) != ACTION_NONE;
+  } else if (info.version == 2) {
+    match.mappingIndex = findStationByAddress(config, nativeAddress);
+    match.accept = plan.actionFor(match.mappingIndex) != ACTION_NONE && (match.mappingIndex >= 0 || !v2Filtering);
+  }
+  return match;
+}
+
+}  // namespace advert
+}  // namespace lighthouse
@@ -0,0 +1,126 @@
+/** Compact binary trace of raw BLE advertisements.
+ *
+ * Captured on the device (/api/v1/trace) and replayed on a host by
+ * tools/trace_replay. All fields are little endian.
+ *
+ *   File header (8 bytes): magic "LHAT", uint16 version, uint16 reserved
+ *   Record (13 + n bytes): uint32 timestamp (us since capture start),
+ *                          uint8 address[6] (NimBLE native order),
+ *                          uint8 address type, int8 RSSI,
+ *                          uint8 payload length n, uint8 payload[n]
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ADVERT_TRACE_MAGIC 0x5441484Cu  // "LHAT"
+#define ADVERT_TRACE_VERSION 1
+
+constexpr size_t kAdvertTraceHeaderSize = 8;
+constexpr size_t kAdvertRecordHeaderSize = 13;
+constexpr size_t kAdvertMaxPayload = 62;  // Advert plus scan response
+
+struct AdvertRecord {
+  uint32_t timestampUs;
+  uint8_t address[6];
+  uint8_t addressType;
+  int8_t rssi;
+  uint8_t payloadLen;
+  const uint8_t* payload;  // Points into the trace buffer
+};
+
+// Appends records to a caller-owned buffer; stops (and counts drops) when full
+class AdvertTraceWriter {
+ public:
+  AdvertTraceWriter() = default;
+  AdvertTraceWriter(uint8_t* buffer, size_t capacity) { reset(buffer, capacity); }
+
+  void reset(uint8_t* buffer, size_t capacity) {
+    buffer_ = buffer;
+    capacity_ = capacity;
+    used_ = 0;
+    records_ = 0;
+    dropped_ = 0;
+    if (buffer_ == nullptr || capacity_ < kAdvertTraceHeaderSize) return;
+    put32(ADVERT_TRACE_MAGIC);
+    put16(ADVERT_TRACE_VERSION);
+    put16(0);
+  }
+
+  bool append(uint32_t timestampUs, const uint8_t address[6], uint8_t addressType, int8_t rssi,
+              const uint8_t* payload, size_t payloadLen) {
+    if (payloadLen > kAdvertMaxPayload) payloadLen = kAdvertMaxPayload;
+    if (buffer_ == nullptr || used_ + kAdvertRecordHeaderSize + payloadLen > capacity_) {
+      dropped_++;
+      return false;
+    }
+    put32(timestampUs);
+    memcpy(buffer_ + used_, address, 6);
+    used_ += 6;
+    buffer_[used_++] = addressType;
+    buffer_[used_++] = static_cast<uint8_t>(rssi);
+    buffer_[used_++] = static_cast<uint8_t>(payloadLen);
+    memcpy(buffer_ + used_, payload, payloadLen);
+    used_ += payloadLen;
+    records_++;
+    return true;
+  }
+
+  const uint8_t* data() const { return buffer_; }
+  size_t size() const { return used_; }
+  uint32_t records() const { return records_; }
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  void put16(uint16_t v) {
+    buffer_[used_++] = v & 0xFF;
+    buffer_[used_++] = v >> 8;
+  }
+  void put32(uint32_t v) {
+    put16(v & 0xFFFF);
+    put16(v >> 16);
+  }
+
+  uint8_t* buffer_ = nullptr;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+  uint32_t records_ = 0;
+  uint32_t dropped_ = 0;
+};
+
+class AdvertTraceReader {
+ public:
+  AdvertTraceReader(const uint8_t* data, size_t len) : data_(data), len_(len) {
+    valid_ = len >= kAdvertTraceHeaderSize && get32(0) == ADVERT_TRACE_MAGIC && get16(4) == ADVERT_TRACE_VERSION;
+    pos_ = kAdvertTraceHeaderSize;
+  }
+
+  bool valid() const { return valid_; }
+  void rewind() { pos_ = kAdvertTraceHeaderSize; }
+
+  // False at the end of the trace or on a truncated record
+  bool next(AdvertRecord& record) {
+    if (!valid_ || pos_ + kAdvertRecordHeaderSize > len_) return false;
+    uint8_t payloadLen = data_[pos_ + 12];
+    if (pos_ + kAdvertRecordHeaderSize + payloadLen > len_) return false;
+    record.timestampUs = get32(pos_);
+    memcpy(record.address, data_ + pos_ + 4, 6);
+    record.addressType = data_[pos_ + 10];
+    record.rssi = static_cast<int8_t>(data_[pos_ + 11]);
+    record.payloadLen = payloadLen;
+    record.payload = data_ + pos_ + kAdvertRecordHeaderSize;
+    pos_ += kAdvertRecordHeaderSize + payloadLen;
+    return true;
+  }
+
+ private:
+  uint16_t get16(size_t at) const { return data_[at] | (data_[at + 1] << 8); }
+  uint32_t get32(size_t at) const { return get16(at) | ((uint32_t)get16(at + 2) << 16); }
+
+  const uint8_t* data_;
+  size_t len_;
+  size_t pos_ = 0;
+  bool valid_ = false;
+};
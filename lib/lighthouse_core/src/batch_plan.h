@@ -0,0 +1,176 @@
+/** Batched multi-station commands.
+ *
+ * A BatchPlan carries one action per configured station, so "room 1 on,
+ * room 2 off" runs as a single scan and a single connection wave instead of
+ * one full cycle per station. Plans come from the HTTP and MQTT batch format,
+ * from stored scenes and from the plain on/off commands.
+ *
+ * Batch format: comma-separated "target:action" pairs, where target is a
+ * station index or "all" and action is on, off or standby. Later pairs
+ * override earlier ones, so "all:off,0:on" switches everything off except
+ * station 0.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config_store.h"
+
+enum StationAction : uint8_t {
+  ACTION_NONE = 0,
+  ACTION_ON = 1,
+  ACTION_OFF = 2,
+  ACTION_STANDBY = 3,  // V2 only; V1 stations have no standby and are put to sleep
+};
+
+inline const char* stationActionName(uint8_t action) {
+  switch (action) {
+    case ACTION_ON: return "on";
+    case ACTION_OFF: return "off";
+    case ACTION_STANDBY: return "standby";
+    default: return "none";
+  }
+}
+
+// Returns ACTION_NONE for unknown words. `text` need not be NUL-terminated.
+inline StationAction parseStationAction(const char* text, size_t len) {
+  if (len == 2 && memcmp(text, "on", 2) == 0) return ACTION_ON;
+  if (len == 3 && memcmp(text, "off", 3) == 0) return ACTION_OFF;
+  if (len == 7 && memcmp(text, "standby", 7) == 0) return ACTION_STANDBY;
+  return ACTION_NONE;
+}
+
+struct BatchPlan {
+  uint8_t actions[CONFIG_MAX_STATIONS];  // Indexed like ControllerConfig::stations
+  uint8_t unmappedAction;                // Unconfigured V2 stations found by the scan
+
+  void clear() {
+    memset(actions, ACTION_NONE, sizeof(actions));
+    unmappedAction = ACTION_NONE;
+  }
+
+  uint8_t actionFor(int stationIndex) const {
+    return stationIndex >= 0 && stationIndex < CONFIG_MAX_STATIONS ? actions[stationIndex] : unmappedAction;
+  }
+
+  bool empty() const {
+    if (unmappedAction != ACTION_NONE) return false;
+    for (size_t i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if (actions[i] != ACTION_NONE) return false;
+    }
+    return true;
+  }
+
+  bool includes(uint8_t action) const {
+    if (unmappedAction == action) return true;
+    for (size_t i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if (actions[i] == action) return true;
+    }
+    return false;
+  }
+
+  // Same action for every configured station (and any unconfigured V2 ones)
+  static BatchPlan all(StationAction action, uint8_t stationCount) {
+    BatchPlan plan;
+    plan.clear();
+    for (size_t i = 0; i < stationCount && i < CONFIG_MAX_STATIONS; i++) plan.actions[i] = action;
+    plan.unmappedAction = action;
+    return plan;
+  }
+
+  static BatchPlan single(int stationIndex, StationAction action) {
+    BatchPlan plan;
+    plan.clear();
+    if (stationIndex >= 0 && stationIndex < CONFIG_MAX_STATIONS) plan.actions[stationIndex] = action;
+    return plan;
+  }
+
+  // True if both plans want a different action for the same station
+  bool conflictsWith(const BatchPlan& other) const {
+    for (size_t i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if (actions[i] != ACTION_NONE && other.actions[i] != ACTION_NONE && actions[i] != other.actions[i]) return true;
+    }
+    return unmappedAction != ACTION_NONE && other.unmappedAction != ACTION_NONE &&
+           unmappedAction != other.unmappedAction;
+  }
+
+  // Drop the stations whose bit is set in `mask` (bit i = station i)
+  void clearStations(uint32_t mask) {
+    for (size_t i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if (mask & (1u << i)) actions[i] = ACTION_NONE;
+    }
+  }
+
+  // Fold a later command into this one; its actions win where both are set
+  void merge(const BatchPlan& later) {
+    for (size_t i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if (later.actions[i] != ACTION_NONE) actions[i] = later.actions[i];
+    }
+    if (later.unmappedAction != ACTION_NONE) unmappedAction = later.unmappedAction;
+  }
+};
+
+// Parse the batch format. Returns false, with `plan` unspecified, on any
+// malformed pair, unknown action or out-of-range station index.
+inline bool parseBatchPlan(const char* text, size_t len, uint8_t stationCount, BatchPlan& plan) {
+  plan.clear();
+  size_t pos = 0;
+  while (pos < len) {
+    size_t end = pos;
+    while (end < len && text[end] != ',') end++;
+    const char* colon = static_cast<const char*>(memchr(text + pos, ':', end - pos));
+    if (colon == nullptr) return false;
+    size_t targetLen = colon - (text + pos);
+    StationAction action = parseStationAction(colon + 1, text + end - (colon + 1));
+    if (action == ACTION_NONE || targetLen == 0) return false;
+
+    if (targetLen == 3 && memcmp(text + pos, "all", 3) == 0) {
+      plan.merge(BatchPlan::all(action, stationCount));
+    } else {
+      int index = 0;
+      for (size_t i = 0; i < targetLen; i++) {
+        char c = text[pos + i];
+        if (c < '0' || c > '9' || index > CONFIG_MAX_STATIONS) return false;
+        index = index * 10 + (c - '0');
+      }
+      if (index >= stationCount) return false;
+      plan.actions[index] = action;
+    }
+    pos = end + 1;
+  }
+  return !plan.empty();
+}
+
+inline bool parseBatchPlan(const char* text, uint8_t stationCount, BatchPlan& plan) {
+  return parseBatchPlan(text, strlen(text), stationCount, plan);
+}
+
+inline BatchPlan planFromScene(const SceneConfig& scene) {
+  BatchPlan plan;
+  memcpy(plan.actions, scene.actions, sizeof(plan.actions));
+  plan.unmappedAction = scene.unmappedAction;
+  return plan;
+}
+
+inline void storePlanInScene(const BatchPlan& plan, SceneConfig& scene) {
+  memcpy(scene.actions, plan.actions, sizeof(scene.actions));
+  scene.unmappedAction = plan.unmappedAction;
+}
+
+inline int findScene(const ControllerConfig& config, const char* name) {
+  for (int i = 0; i < config.sceneCount; i++) {
+    if (strcmp(config.scenes[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+// Keep stored scenes aligned with the station list when a station is removed
+inline void removeStationFromScenes(ControllerConfig& config, int stationIndex) {
+  for (int s = 0; s < config.sceneCount; s++) {
+    uint8_t* actions = config.scenes[s].actions;
+    for (int i = stationIndex; i + 1 < CONFIG_MAX_STATIONS; i++) actions[i] = actions[i + 1];
+    actions[CONFIG_MAX_STATIONS - 1] = ACTION_NONE;
+  }
+}
@@ -0,0 +1,148 @@
+/** Buffered writer for streamed HTTP responses.
+ *
+ * Pages and JSON documents are written through a fixed stack buffer and
+ * flushed to the sink in chunks, so a response never needs one big heap
+ * allocation the way String concatenation does. The sink is anything with
+ * sendContent(const char*, size_t), e.g. WebServer after
+ * setContentLength(CONTENT_LENGTH_UNKNOWN), or a TextBufferSink for MQTT
+ * payloads.
+ */
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+template <class Sink, size_t BufferSize = 512>
+class ChunkedWriter {
+ public:
+  explicit ChunkedWriter(Sink& sink) : sink_(sink) {}
+  ~ChunkedWriter() { flush(); }
+
+  ChunkedWriter(const ChunkedWriter&) = delete;
+  ChunkedWriter& operator=(const ChunkedWriter&) = delete;
+
+  void write(const char* data, size_t len) {
+    if (len >= BufferSize) {
+      // Large constant blocks (stylesheets) go straight through
+      flush();
+      sink_.sendContent(data, len);
+      written_ += len;
+      return;
+    }
+    if (used_ + len > BufferSize) flush();
+    memcpy(buffer_ + used_, data, len);
+    used_ += len;
+    written_ += len;
+  }
+
+  void print(const char* text) { write(text, strlen(text)); }
+
+  void print(long value) {
+    char digits[12];
+    int len = snprintf(digits, sizeof(digits), "%ld", value);
+    write(digits, len);
+  }
+
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0) return;
+    write(line, (size_t)len < sizeof(line) ? len : sizeof(line) - 1);
+  }
+
+  // Text from users (names, settings) inside HTML text or attribute values
+  void printHtmlEscaped(const char* text) {
+    for (; *text; text++) {
+      switch (*text) {
+        case '&': print("&amp;"); break;
+        case '<': print("&lt;"); break;
+        case '>': print("&gt;"); break;
+        case '\'': print("&#39;"); break;
+        case '"': print("&quot;"); break;
+        default: write(text, 1); break;
+      }
+    }
+  }
+
+  // Query string values in links
+  void printUrlEncoded(const char* text) {
+    for (; *text; text++) {
+      unsigned char c = *text;
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+          c == '.' || c == '~') {
+        write(text, 1);
+      } else {
+        printf("%%%02X", c);
+      }
+    }
+  }
+
+  // Quoted JSON string
+  void printJsonString(const char* text) {
+    write("\"", 1);
+    for (; *text; text++) {
+      unsigned char c = *text;
+      if (c == '"' || c == '\\') {
+        char escaped[2] = {'\\', (char)c};
+        write(escaped, 2);
+      } else if (c < 0x20) {
+        printf("\\u%04x", c);
+      } else {
+        write(text, 1);
+      }
+    }
+    write("\"", 1);
+  }
+
+  void flush() {
+    if (used_ == 0) return;
+    sink_.sendContent(buffer_, used_);
+    used_ = 0;
+  }
+
+  // Flush and send the terminating zero-length chunk
+  void end() {
+    if (ended_) return;
+    flush();
+    sink_.sendContent(buffer_, 0);
+    ended_ = true;
+  }
+
+  size_t written() const { return written_; }
+
+ private:
+  Sink& sink_;
+  char buffer_[BufferSize];
+  size_t used_ = 0;
+  size_t written_ = 0;
+  bool ended_ = false;
+};
+
+// Sink that collects the output in a fixed buffer, NUL-terminated. Output
+// that does not fit is cut off and marks the sink as overflowed.
+struct TextBufferSink {
+  char* data;
+  size_t capacity;
+  size_t used;
+  bool overflow;
+
+  TextBufferSink(char* buffer, size_t size) : data(buffer), capacity(size), used(0), overflow(false) {
+    if (capacity > 0) data[0] = '\0';
+  }
+
+  void sendContent(const char* text, size_t len) {
+    if (used + len >= capacity) {
+      overflow = overflow || len > 0;
+      len = capacity > used + 1 ? capacity - used - 1 : 0;
+    }
+    memcpy(data + used, text, len);
+    used += len;
+    if (capacity > 0) data[used] = '\0';
+  }
+};
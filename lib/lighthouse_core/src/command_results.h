@@ -0,0 +1,269 @@
+/** Correlated command results.
+ *
+ * A command sent with a correlation ID gets exactly one result message once
+ * every station it targets has an outcome, carrying the ID back together
+ * with per-station outcome, retries and connect/write timings. Commands are
+ * merged into shared engine cycles and may be carried over by preemption, so
+ * each tracked command collects its stations' results across cycles. Only
+ * cycles that start after the command arrived count, so a station switched
+ * just before cannot answer for it.
+ *
+ * Payloads on the command topics are either the plain command ("on",
+ * "0:on,1:off", a scene name) or a flat JSON object that wraps it:
+ *
+ *     {"id":"kitchen-42","command":"on","response_topic":"home/replies"}
+ *
+ * MQTT 3.1.1 has no v5 correlation data or response topic properties, so
+ * they travel in the payload; "id" may also be a number.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "batch_plan.h"
+#include "config_store.h"
+
+#define COMMAND_ID_LEN 40
+#define COMMAND_REPLY_TOPIC_LEN 96
+#define COMMAND_TEXT_LEN 96
+#define COMMAND_TRACKED_MAX 4  // Commands with an ID waiting for their result
+
+enum StationOutcome : uint8_t {
+  OUTCOME_PENDING = 0,  // Not reached in this cycle
+  OUTCOME_OK,
+  OUTCOME_NOT_FOUND,       // Not seen by the scan
+  OUTCOME_CONNECT_FAILED,  // Every connect attempt failed
+  OUTCOME_WRITE_FAILED,    // Connected, but the command was not accepted
+  OUTCOME_TIMED_OUT,       // The command deadline passed before its turn
+};
+
+inline const char* stationOutcomeName(uint8_t outcome) {
+  switch (outcome) {
+    case OUTCOME_OK: return "ok";
+    case OUTCOME_NOT_FOUND: return "not_found";
+    case OUTCOME_CONNECT_FAILED: return "connect_failed";
+    case OUTCOME_WRITE_FAILED: return "write_failed";
+    case OUTCOME_TIMED_OUT: return "timed_out";
+    default: return "pending";
+  }
+}
+
+struct StationResult {
+  uint8_t outcome;
+  uint8_t action;    // What was sent; may differ from the request after merging or parking
+  uint8_t attempts;  // Connect attempts, across cycles for tracked commands
+  uint16_t connectMs;
+  uint16_t writeMs;  // Service discovery and write
+};
+
+// What one engine cycle did, filled in by the engine as it goes
+struct CycleReport {
+  uint32_t cycle;
+  uint32_t scanMs;
+  bool preempted;
+  uint8_t unmappedOk;  // Unconfigured V2 stations
+  uint8_t unmappedFailed;
+  StationResult stations[CONFIG_MAX_STATIONS];
+
+  void start(uint32_t number) {
+    memset(this, 0, sizeof(*this));
+    cycle = number;
+  }
+};
+
+struct TrackedCommand {
+  char id[COMMAND_ID_LEN];
+  char replyTopic[COMMAND_REPLY_TOPIC_LEN];  // Empty for the default result topic
+  uint32_t firstCycle;
+  uint32_t submittedMs;
+  uint32_t scanMs;  // Summed over the cycles it took part in
+  uint8_t cycles;
+  uint8_t targetMask;   // Bit i = configured station i
+  uint8_t pendingMask;  // Targets without a final outcome yet
+  bool unmappedTargeted;
+  bool unmappedPending;
+  uint8_t unmappedOk;
+  uint8_t unmappedFailed;
+  StationResult stations[CONFIG_MAX_STATIONS];
+
+  bool success() const {
+    for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if ((targetMask & (1u << i)) && stations[i].outcome != OUTCOME_OK) return false;
+    }
+    return unmappedFailed == 0;
+  }
+};
+
+// Command payload, either plain or the JSON envelope
+struct CommandEnvelope {
+  char id[COMMAND_ID_LEN];
+  char replyTopic[COMMAND_REPLY_TOPIC_LEN];
+  char command[COMMAND_TEXT_LEN];
+  size_t commandLen;
+};
+
+// Copy the JSON value at `text` (string or bare token) into `out`. Returns
+// the position after it, or nullptr if it is malformed or does not fit.
+inline const char* readJsonValue(const char* text, const char* end, char* out, size_t outSize) {
+  size_t used = 0;
+  if (text < end && *text == '"') {
+    for (text++; text < end && *text != '"'; text++) {
+      char c = *text;
+      if (c == '\\') {
+        if (++text == end) return nullptr;
+        c = *text == 'n' ? '\n' : *text == 't' ? '\t' : *text;
+        if (*text == 'u') return nullptr;  // Not needed for IDs and topics
+      }
+      if (used + 1 >= outSize) return nullptr;
+      out[used++] = c;
+    }
+    if (text == end) return nullptr;
+    text++;
+  } else {
+    // Numbers, true/false/null; nested objects and arrays are not supported
+    while (text < end && *text != ',' && *text != '}' && *text != ' ' && *text != '\t' && *text != '\r' &&
+           *text != '\n') {
+      if (*text == '{' || *text == '[' || used + 1 >= outSize) return nullptr;
+      out[used++] = *text++;
+    }
+    if (used == 0) return nullptr;
+  }
+  out[used] = '\0';
+  return text;
+}
+
+inline const char* skipJsonSpace(const char* text, const char* end) {
+  while (text < end && (*text == ' ' || *text == '\t' || *text == '\r' || *text == '\n')) text++;
+  return text;
+}
+
+// Split a command payload. Plain payloads become `command` unchanged; a JSON
+// object must carry "command" and may carry "id" and "response_topic".
+// Returns false for malformed JSON, or a response topic with wildcards.
+inline bool parseCommandEnvelope(const char* payload, size_t len, CommandEnvelope& envelope) {
+  memset(&envelope, 0, sizeof(envelope));
+  const char* end = payload + len;
+  const char* pos = skipJsonSpace(payload, end);
+  if (pos == end || *pos != '{') {
+    if (len >= sizeof(envelope.command)) return false;
+    memcpy(envelope.command, payload, len);
+    envelope.commandLen = len;
+    return true;
+  }
+
+  bool hasCommand = false;
+  pos = skipJsonSpace(pos + 1, end);
+  if (pos < end && *pos == '}') return false;
+  while (pos < end) {
+    char key[16];
+    char value[COMMAND_REPLY_TOPIC_LEN];
+    if (*pos != '"') return false;
+    pos = readJsonValue(pos, end, key, sizeof(key));
+    if (!pos) return false;
+    pos = skipJsonSpace(pos, end);
+    if (pos == end || *pos != ':') return false;
+    pos = readJsonValue(skipJsonSpace(pos + 1, end), end, value, sizeof(value));
+    if (!pos) return false;
+
+    if (strcmp(key, "id") == 0) {
+      if (strlen(value) >= sizeof(envelope.id)) return false;
+      strcpy(envelope.id, value);
+    } else if (strcmp(key, "command") == 0) {
+      if (strlen(value) >= sizeof(envelope.command)) return false;
+      strcpy(envelope.command, value);
+      envelope.commandLen = strlen(value);
+      hasCommand = true;
+    } else if (strcmp(key, "response_topic") == 0) {
+      if (strpbrk(value, "+#")) return false;
+      strcpy(envelope.replyTopic, value);
+    }  // Unknown keys are ignored
+
+    pos = skipJsonSpace(pos, end);
+    if (pos < end && *pos == ',') {
+      pos = skipJsonSpace(pos + 1, end);
+    } else if (pos < end && *pos == '}') {
+      return hasCommand && skipJsonSpace(pos + 1, end) == end;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+class CommandTracker {
+ public:
+  // Start tracking a command whose plan runs in `firstCycle` or later.
+  // Returns false if COMMAND_TRACKED_MAX commands are already waiting.
+  bool track(const CommandEnvelope& envelope, const BatchPlan& plan, uint32_t firstCycle, uint32_t nowMs) {
+    for (TrackedCommand& tracked : slots_) {
+      if (inUse(tracked)) continue;
+      memset(&tracked, 0, sizeof(tracked));
+      strcpy(tracked.id, envelope.id);
+      strcpy(tracked.replyTopic, envelope.replyTopic);
+      tracked.firstCycle = firstCycle;
+      tracked.submittedMs = nowMs;
+      for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+        if (plan.actions[i] != ACTION_NONE) tracked.targetMask |= 1u << i;
+      }
+      tracked.pendingMask = tracked.targetMask;
+      tracked.unmappedTargeted = tracked.unmappedPending = plan.unmappedAction != ACTION_NONE;
+      return true;
+    }
+    return false;
+  }
+
+  size_t waiting() const {
+    size_t n = 0;
+    for (const TrackedCommand& tracked : slots_) n += inUse(tracked);
+    return n;
+  }
+
+  // Fold a finished cycle into the commands it served and hand every command
+  // that is now complete to `done(const TrackedCommand&)`.
+  template <class Done>
+  void cycleDone(const CycleReport& report, Done done) {
+    for (TrackedCommand& tracked : slots_) {
+      if (!inUse(tracked) || report.cycle < tracked.firstCycle) continue;
+      tracked.cycles++;
+      tracked.scanMs += report.scanMs;
+      for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+        if (!(tracked.pendingMask & (1u << i))) continue;
+        const StationResult& result = report.stations[i];
+        StationResult& total = tracked.stations[i];
+        total.attempts += result.attempts;
+        total.connectMs += result.connectMs;
+        if (result.outcome == OUTCOME_PENDING) continue;  // Carried over to the next cycle
+        total.outcome = result.outcome;
+        total.action = result.action;
+        total.writeMs = result.writeMs;
+        tracked.pendingMask &= ~(1u << i);
+      }
+      // Unconfigured stations are only final once a cycle has run to the end
+      if (tracked.unmappedPending && !report.preempted) {
+        tracked.unmappedOk = report.unmappedOk;
+        tracked.unmappedFailed = report.unmappedFailed;
+        tracked.unmappedPending = false;
+      }
+      if (!inUse(tracked)) done(tracked);
+    }
+  }
+
+  // Stations were renumbered or removed: nothing in flight can be matched up
+  // any more, report what is known
+  template <class Done>
+  void abandonAll(Done done) {
+    for (TrackedCommand& tracked : slots_) {
+      if (!inUse(tracked)) continue;
+      tracked.pendingMask = 0;
+      tracked.unmappedPending = false;
+      done(tracked);
+    }
+  }
+
+ private:
+  static bool inUse(const TrackedCommand& tracked) { return tracked.pendingMask != 0 || tracked.unmappedPending; }
+
+  TrackedCommand slots_[COMMAND_TRACKED_MAX] = {};
+};
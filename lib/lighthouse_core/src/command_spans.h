@@ -0,0 +1,140 @@
+/** Per-phase timing spans for commands, for waterfalls drawn offline.
+ *
+ * Every command gets a trace ID at its entry point (HTTP handler, MQTT
+ * callback, UDP datagram, button). From there each phase records a span with
+ * start, end, station and outcome: the entry handling itself, waiting behind
+ * a running command, the scan, every connect attempt and retry backoff,
+ * service discovery and the write. Engine spans are keyed by the cycle they
+ * ran in, because one cycle serves every command merged into it. A trace
+ * covers the cycles from the one it was submitted for to the first one that
+ * ran to its end.
+ *
+ * Spans and traces live in fixed rings; the oldest are overwritten. Times are
+ * the low 32 bits of the microsecond timer, so only differences within a few
+ * minutes are meaningful.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef SPAN_BUFFER_SPANS
+#define SPAN_BUFFER_SPANS 128
+#endif
+#define SPAN_TRACES 8
+#define SPAN_ENTRY_MAX_US 250000  // An entry not submitted within this is abandoned
+
+enum SpanPhase : uint8_t {
+  SPAN_ENTRY = 1,   // Entry point to submitCommand(), keyed by trace
+  SPAN_QUEUED,      // Waiting for the running cycle, keyed by trace
+  SPAN_SCAN,        // Keyed by cycle from here on
+  SPAN_CONNECT,
+  SPAN_BACKOFF,
+  SPAN_DISCOVERY,   // Service and characteristic lookup, V2 readback
+  SPAN_WRITE,
+  SPAN_CYCLE,
+};
+
+inline const char* spanPhaseName(uint8_t phase) {
+  switch (phase) {
+    case SPAN_ENTRY: return "entry";
+    case SPAN_QUEUED: return "queued";
+    case SPAN_SCAN: return "scan";
+    case SPAN_CONNECT: return "connect";
+    case SPAN_BACKOFF: return "backoff";
+    case SPAN_DISCOVERY: return "discovery";
+    case SPAN_WRITE: return "write";
+    case SPAN_CYCLE: return "cycle";
+    default: return "unknown";
+  }
+}
+
+struct Span {
+  uint32_t key;  // Trace ID for SPAN_ENTRY and SPAN_QUEUED, engine cycle otherwise
+  uint32_t startUs;
+  uint32_t endUs;
+  uint8_t phase;
+  int8_t station;   // Configured station, -1 for unconfigured ones or whole-cycle spans
+  uint8_t outcome;  // StationOutcome; CycleFlags for SPAN_CYCLE
+  uint8_t attempt;  // Connect attempt, from 1
+};
+
+struct CommandTrace {
+  uint32_t id;
+  uint32_t receivedUs;
+  uint32_t submittedUs;
+  uint32_t firstSpan;   // Sequence number of its entry span
+  uint32_t firstCycle;
+  uint32_t lastCycle;   // 0 while it has not run to the end of a cycle yet
+  uint8_t source;       // EventSource
+  uint8_t command;
+  bool queued;          // Waited for a running command
+};
+
+class SpanRecorder {
+ public:
+  // At the entry point, before the request is parsed
+  uint32_t begin(uint32_t nowUs) {
+    openId_ = ++lastId_;
+    openUs_ = nowUs;
+    return openId_;
+  }
+
+  // From submitCommand(): the command will run in engine cycle `cycle`.
+  // Commands without an entry point of their own (parking, retries) start
+  // their trace here.
+  uint32_t submit(uint8_t source, uint8_t command, uint32_t cycle, bool queued, uint32_t nowUs) {
+    if (openId_ == 0 || nowUs - openUs_ > SPAN_ENTRY_MAX_US) begin(nowUs);
+    CommandTrace& trace = traces_[traceSeq_++ % SPAN_TRACES];
+    trace = CommandTrace{openId_, openUs_, nowUs, spanSeq_, cycle, 0, source, command, queued};
+    record(SPAN_ENTRY, openId_, openUs_, nowUs, -1, 0, 0);
+    openId_ = 0;
+    return trace.id;
+  }
+
+  // A cycle started: the commands that were queued for it stop waiting
+  void cycleStarted(uint32_t cycle, uint32_t nowUs) {
+    for (uint32_t i = 0; i < traceCount(); i++) {
+      const CommandTrace& trace = traceAt(i);
+      if (trace.firstCycle == cycle && trace.queued) record(SPAN_QUEUED, trace.id, trace.submittedUs, nowUs, -1, 0, 0);
+    }
+  }
+
+  // A cycle that was not preempted ends every command submitted up to it
+  void cycleFinished(uint32_t cycle, bool preempted) {
+    if (preempted) return;
+    for (CommandTrace& trace : traces_) {
+      if (trace.id != 0 && trace.lastCycle == 0 && trace.firstCycle <= cycle) trace.lastCycle = cycle;
+    }
+  }
+
+  void record(uint8_t phase, uint32_t key, uint32_t startUs, uint32_t endUs, int station, uint8_t outcome,
+              uint8_t attempt) {
+    spans_[spanSeq_++ % SPAN_BUFFER_SPANS] =
+        Span{key, startUs, endUs, phase, (int8_t)station, outcome, attempt};
+  }
+
+  // Traces oldest first
+  uint32_t traceCount() const { return traceSeq_ < SPAN_TRACES ? traceSeq_ : SPAN_TRACES; }
+  const CommandTrace& traceAt(uint32_t i) const { return traces_[(traceSeq_ - traceCount() + i) % SPAN_TRACES]; }
+
+  // Spans still held are [oldestSpan(), spanEnd())
+  uint32_t oldestSpan() const { return spanSeq_ > SPAN_BUFFER_SPANS ? spanSeq_ - SPAN_BUFFER_SPANS : 0; }
+  uint32_t spanEnd() const { return spanSeq_; }
+  const Span& spanAt(uint32_t seq) const { return spans_[seq % SPAN_BUFFER_SPANS]; }
+
+  // The span belongs to `trace`
+  static bool belongsTo(const Span& span, const CommandTrace& trace) {
+    if (span.phase == SPAN_ENTRY || span.phase == SPAN_QUEUED) return span.key == trace.id;
+    return span.key >= trace.firstCycle && (trace.lastCycle == 0 || span.key <= trace.lastCycle);
+  }
+
+ private:
+  Span spans_[SPAN_BUFFER_SPANS] = {};
+  CommandTrace traces_[SPAN_TRACES] = {};
+  uint32_t spanSeq_ = 0;
+  uint32_t traceSeq_ = 0;
+  uint32_t lastId_ = 0;
+  uint32_t openId_ = 0;
+  uint32_t openUs_ = 0;
+};
@@ -0,0 +1,178 @@
+/** Persistent controller configuration.
+ *
+ * The whole configuration (stations, names, MQTT settings, tuning) is one
+ * packed struct that is stored as a single NVS blob. Boot loads it with one
+ * read; changes are written back in one write after a debounce.
+ *
+ * Layout rules: the header never changes, and new fields are only ever
+ * appended at the end of ControllerConfig. An older, shorter blob is loaded by
+ * overlaying its bytes onto the defaults, so appended fields keep their
+ * default values. CONFIG_VERSION is bumped whenever fields are appended.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CONFIG_MAGIC 0x4E43484Cu  // "LHCN"
+#define CONFIG_VERSION 9
+
+#define CONFIG_MAX_STATIONS 8
+#define CONFIG_NAME_LEN 32
+#define CONFIG_ADVERTISED_ID_LEN 8
+#define CONFIG_MAX_SCENES 8
+#define CONFIG_SCENE_NAME_LEN 16
+
+struct __attribute__((packed)) StationConfig {
+  uint8_t version;                              // 1 = V1 (HTC), 2 = V2.0
+  char advertisedId[CONFIG_ADVERTISED_ID_LEN];  // V1: last part of "HTC BS XXXXXX"
+  uint32_t uniqueId;                            // V1: full ID used in command frames
+  uint8_t mac[6];                               // V2: address, most significant byte first
+  char name[CONFIG_NAME_LEN];
+};
+
+struct __attribute__((packed)) MqttConfig {
+  char server[64];
+  uint16_t port;
+  char username[64];
+  char password[64];
+  char topic[48];
+  uint8_t enabled;
+};
+
+struct __attribute__((packed)) TuningConfig {
+  uint8_t scanTimeS;             // BLE scan duration per command
+  uint8_t lowPower;              // Low-power mode enabled
+  uint16_t maxCommandLatencyMs;  // Idle bound in low-power mode
+};
+
+// Pre-wake when the VR PC shows up on the LAN or over MQTT (presence_tracker.h)
+struct __attribute__((packed)) PresenceConfig {
+  uint8_t enabled;
+  char host[16];    // IPv4 address of the VR PC, empty = MQTT reports only
+  uint16_t port;    // TCP port probed on the PC
+  uint16_t graceS;  // Absence before the stations are put back to sleep
+  uint8_t portOnly; // 1: only an open port counts, 0: a refused connect does too
+};
+
+// Binary control datagrams (udp_control.h)
+struct __attribute__((packed)) UdpConfig {
+  uint8_t enabled;
+  uint16_t port;
+  char key[33];  // HMAC key, empty = unauthenticated
+};
+
+// A named batch (see batch_plan.h): one StationAction per configured station
+struct __attribute__((packed)) SceneConfig {
+  char name[CONFIG_SCENE_NAME_LEN];
+  uint8_t actions[CONFIG_MAX_STATIONS];
+  uint8_t unmappedAction;  // Unconfigured V2 stations found by the scan
+};
+
+struct __attribute__((packed)) ControllerConfig {
+  // Header
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;  // Bytes of this struct that were stored
+  uint32_t crc;     // CRC-32 of bytes [kConfigBodyOffset, length)
+
+  uint8_t stationCount;
+  StationConfig stations[CONFIG_MAX_STATIONS];
+  MqttConfig mqtt;
+  TuningConfig tuning;
+  // Version 2
+  uint8_t sceneCount;
+  SceneConfig scenes[CONFIG_MAX_SCENES];
+  // Version 3
+  uint16_t commandDeadlineMs;  // Worst-case duration of one command
+  // Version 4
+  uint16_t parkWindowS;  // V2 OFF parks in standby this long first, 0 = off
+  // Version 5
+  PresenceConfig presence;
+  // Version 6
+  uint8_t adaptiveTxPower;  // Per-station TX power (tx_power.h), 0 = always +9 dBm
+  // Version 7
+  UdpConfig udp;
+  // Version 8
+  uint8_t reconcile;  // Retry failed commands in the background (power_reconciler.h)
+  // Version 9
+  uint8_t mqttTls;  // MQTT over TLS (tls_transport.h)
+  // Append new fields here
+};
+
+constexpr size_t kConfigBodyOffset = offsetof(ControllerConfig, stationCount);
+// Size of the first (version 1) layout, the shortest blob we accept
+constexpr size_t kConfigV1Length = offsetof(ControllerConfig, tuning) + sizeof(TuningConfig);
+
+// CRC-32 (IEEE) in pieces: start with 0xFFFFFFFF, invert the final value
+inline uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return crc;
+}
+
+inline uint32_t configCrc32(const uint8_t* data, size_t len) { return ~crc32Update(0xFFFFFFFFu, data, len); }
+
+// Fill in the header before the blob is written
+inline void sealConfig(ControllerConfig& config) {
+  config.magic = CONFIG_MAGIC;
+  config.version = CONFIG_VERSION;
+  config.length = sizeof(ControllerConfig);
+  config.crc = configCrc32(reinterpret_cast<const uint8_t*>(&config) + kConfigBodyOffset,
+                           sizeof(ControllerConfig) - kConfigBodyOffset);
+}
+
+// Overlay a stored blob onto `config` (which holds the defaults). Returns
+// false, leaving the defaults untouched, if the blob is missing or corrupt.
+inline bool overlayStoredConfig(ControllerConfig& config, const uint8_t* blob, size_t blobLen) {
+  ControllerConfig header;
+  if (blobLen < kConfigBodyOffset) return false;
+  memcpy(&header, blob, kConfigBodyOffset);
+  if (header.magic != CONFIG_MAGIC || header.length != blobLen || header.length < kConfigV1Length) return false;
+  if (configCrc32(blob + kConfigBodyOffset, blobLen - kConfigBodyOffset) != header.crc) return false;
+
+  size_t len = blobLen < sizeof(ControllerConfig) ? blobLen : sizeof(ControllerConfig);
+  memcpy(&config, blob, len);
+  if (config.stationCount > CONFIG_MAX_STATIONS) config.stationCount = CONFIG_MAX_STATIONS;
+  if (config.sceneCount > CONFIG_MAX_SCENES) config.sceneCount = CONFIG_MAX_SCENES;
+  for (int i = 0; i < CONFIG_MAX_SCENES; i++) {
+    config.scenes[i].name[CONFIG_SCENE_NAME_LEN - 1] = '\0';
+  }
+  for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+    config.stations[i].advertisedId[CONFIG_ADVERTISED_ID_LEN - 1] = '\0';
+    config.stations[i].name[CONFIG_NAME_LEN - 1] = '\0';
+  }
+  config.mqtt.server[sizeof(config.mqtt.server) - 1] = '\0';
+  config.mqtt.username[sizeof(config.mqtt.username) - 1] = '\0';
+  config.mqtt.password[sizeof(config.mqtt.password) - 1] = '\0';
+  config.mqtt.topic[sizeof(config.mqtt.topic) - 1] = '\0';
+  config.presence.host[sizeof(config.presence.host) - 1] = '\0';
+  config.udp.key[sizeof(config.udp.key) - 1] = '\0';
+  return true;
+}
+
+// "D3:EA:E4:A4:58:DF" -> {0xD3, ..., 0xDF}
+inline bool parseMacAddress(const char* text, uint8_t mac[6]) {
+  unsigned int bytes[6];
+  char trailing;
+  if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x%c", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5],
+             &trailing) != 6) {
+    return false;
+  }
+  for (int i = 0; i < 6; i++) mac[i] = bytes[i];
+  return true;
+}
+
+// NimBLE keeps addresses least significant byte first
+inline bool macMatchesNative(const uint8_t mac[6], const uint8_t native[6]) {
+  for (int i = 0; i < 6; i++) {
+    if (mac[i] != native[5 - i]) return false;
+  }
+  return true;
+}
@@ -0,0 +1,78 @@
+/** Discovery table for lighthouse base stations.
+ *
+ * Compact, fixed-capacity table of the stations seen during a scan, keyed by
+ * BLE address. Records are plain data (no NimBLE objects), so the scanner can
+ * discard its own results immediately and repeat adverts only refresh the
+ * existing record instead of taking another slot.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct DiscoveredStation {
+  uint8_t address[6];   // NimBLE native byte order (least significant first)
+  uint8_t addressType;  // BLE_ADDR_PUBLIC / BLE_ADDR_RANDOM
+  uint8_t version;      // 1 = V1 (HTC), 2 = V2.0
+  int8_t mappingIndex;  // Index into the configured stations, -1 if unmapped
+  int8_t rssi;          // Last advertised RSSI in dBm
+};
+
+template <size_t Capacity>
+class DiscoveryTable {
+ public:
+  static constexpr size_t kCapacity = Capacity;
+
+  void clear() {
+    count_ = 0;
+    duplicates_ = 0;
+    dropped_ = 0;
+  }
+
+  size_t size() const { return count_; }
+  bool full() const { return count_ >= Capacity; }
+
+  // Adverts that refreshed an existing record / did not fit in the table
+  uint32_t duplicates() const { return duplicates_; }
+  uint32_t dropped() const { return dropped_; }
+
+  const DiscoveredStation& operator[](size_t i) const { return records_[i]; }
+
+  const DiscoveredStation* find(const uint8_t address[6]) const {
+    for (size_t i = 0; i < count_; i++) {
+      if (memcmp(records_[i].address, address, 6) == 0) return &records_[i];
+    }
+    return nullptr;
+  }
+
+  // Insert a new station or refresh the RSSI of a known one. Returns nullptr
+  // when the table is full and the address is not already present.
+  const DiscoveredStation* upsert(const uint8_t address[6], uint8_t addressType, uint8_t version,
+                                  int8_t mappingIndex, int8_t rssi) {
+    for (size_t i = 0; i < count_; i++) {
+      if (memcmp(records_[i].address, address, 6) == 0) {
+        records_[i].rssi = rssi;
+        duplicates_++;
+        return &records_[i];
+      }
+    }
+    if (count_ >= Capacity) {
+      dropped_++;
+      return nullptr;
+    }
+    DiscoveredStation& record = records_[count_++];
+    memcpy(record.address, address, 6);
+    record.addressType = addressType;
+    record.version = version;
+    record.mappingIndex = mappingIndex;
+    record.rssi = rssi;
+    return &record;
+  }
+
+ private:
+  DiscoveredStation records_[Capacity];
+  size_t count_ = 0;
+  uint32_t duplicates_ = 0;
+  uint32_t dropped_ = 0;
+};
@@ -0,0 +1,188 @@
+/** Binary event journal.
+ *
+ * Operational history (commands and where they came from, per-station
+ * outcomes, cycle latency, reconnects, reboots, heap lows) as fixed 16-byte
+ * records numbered by a sequence that never restarts. New records go into
+ * EventTail, a small ring that is plain data so it can live in RTC memory and
+ * survive a crash or soft reset. The firmware copies it to flash in batches.
+ *
+ * In flash the journal is a ring of JOURNAL_SEGMENTS files of
+ * JOURNAL_SEGMENT_RECORDS records each. Record `seq` belongs to segment
+ * (seq / JOURNAL_SEGMENT_RECORDS) % JOURNAL_SEGMENTS. Records are appended
+ * in sequence, and the first record of a new lap truncates its segment, so
+ * starting a segment drops the oldest one and a file only ever holds one lap.
+ * Records dropped before they reached flash leave a gap in the numbering.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "batch_plan.h"
+#include "command_results.h"
+
+#define JOURNAL_SEGMENTS 8
+#define JOURNAL_SEGMENT_RECORDS 256  // 4 KB per segment, one flash sector
+#ifndef EVENT_TAIL_RECORDS
+#define EVENT_TAIL_RECORDS 64
+#endif
+#define EVENT_TAIL_MAGIC 0x4C4E524Au  // "JRNL"
+
+enum EventType : uint8_t {
+  EVENT_BOOT = 1,       // arg: reset reason, value: records recovered from RTC memory
+  EVENT_COMMAND,        // arg: EventSource, value: packCommand()
+  EVENT_STATION,        // arg: station index, value: packStationResult()
+  EVENT_CYCLE,          // arg: CycleFlags, value: packCycle()
+  EVENT_WIFI_RECONNECT, // value: reconnects since boot
+  EVENT_MQTT_CONNECT,   // arg: 1 if the broker kept the session
+  EVENT_HEAP_LOW,       // arg: 1 if load shedding started, value: free bytes
+};
+
+enum EventSource : uint8_t {
+  SOURCE_BUTTON = 1,
+  SOURCE_WEB,
+  SOURCE_MQTT,
+  SOURCE_UDP,
+  SOURCE_PRESENCE,
+  SOURCE_PARKING,    // End of a standby parking window
+  SOURCE_RECONCILE,  // Background retry (power_reconciler.h)
+};
+
+enum CycleFlags : uint8_t {
+  CYCLE_SUCCESS = 0x01,
+  CYCLE_PREEMPTED = 0x02,
+};
+
+inline const char* eventTypeName(uint8_t type) {
+  switch (type) {
+    case EVENT_BOOT: return "boot";
+    case EVENT_COMMAND: return "command";
+    case EVENT_STATION: return "station";
+    case EVENT_CYCLE: return "cycle";
+    case EVENT_WIFI_RECONNECT: return "wifi_reconnect";
+    case EVENT_MQTT_CONNECT: return "mqtt_connect";
+    case EVENT_HEAP_LOW: return "heap_low";
+    default: return "unknown";
+  }
+}
+
+inline const char* eventSourceName(uint8_t source) {
+  switch (source) {
+    case SOURCE_BUTTON: return "button";
+    case SOURCE_WEB: return "web";
+    case SOURCE_MQTT: return "mqtt";
+    case SOURCE_UDP: return "udp";
+    case SOURCE_PRESENCE: return "presence";
+    case SOURCE_PARKING: return "parking";
+    case SOURCE_RECONCILE: return "reconcile";
+    default: return "unknown";
+  }
+}
+
+struct __attribute__((packed)) EventRecord {
+  uint32_t seq;
+  uint32_t uptimeMs;
+  uint16_t boot;  // Boots since the journal was started
+  uint8_t type;
+  uint8_t arg;
+  uint32_t value;
+};
+
+static_assert(sizeof(EventRecord) == 16, "journal records are 16 bytes");
+static_assert(CONFIG_MAX_STATIONS <= 8, "packCommand() has 2 bits per station for 8 stations");
+
+// Plan actions 2 bits per station in bits 0-15, unconfigured V2 stations in
+// bits 16-17, the command (TURN_ON_PERM ...) in bits 24-31
+inline uint32_t packCommand(uint8_t command, const BatchPlan& plan) {
+  uint32_t value = (uint32_t)command << 24 | (uint32_t)(plan.unmappedAction & 3) << 16;
+  for (int i = 0; i < CONFIG_MAX_STATIONS; i++) value |= (uint32_t)(plan.actions[i] & 3) << (2 * i);
+  return value;
+}
+
+inline uint8_t commandStationAction(uint32_t value, int stationIndex) { return (value >> (2 * stationIndex)) & 3; }
+
+// Outcome in bits 0-3, action in 4-7, connect attempts in 8-15, connect plus
+// write time in ms (saturated) in 16-31
+inline uint32_t packStationResult(const StationResult& result) {
+  uint32_t ms = (uint32_t)result.connectMs + result.writeMs;
+  return (result.outcome & 0x0F) | (uint32_t)(result.action & 0x0F) << 4 | (uint32_t)result.attempts << 8 |
+         (ms > 0xFFFF ? 0xFFFFu : ms) << 16;
+}
+
+// Cycle time in ms (saturated) in bits 0-15, unconfigured V2 stations
+// switched and failed in bits 16-23 and 24-31
+inline uint32_t packCycle(uint32_t elapsedMs, uint8_t unmappedOk, uint8_t unmappedFailed) {
+  return (elapsedMs > 0xFFFF ? 0xFFFFu : elapsedMs) | (uint32_t)unmappedOk << 16 | (uint32_t)unmappedFailed << 24;
+}
+
+// The newest EVENT_TAIL_RECORDS records, indexed by seq % EVENT_TAIL_RECORDS.
+// Records from `flushedSeq` on are not in flash yet. Plain data without a
+// constructor, see restore().
+struct EventTail {
+  uint32_t magic;
+  uint16_t boot;
+  uint32_t firstSeq;    // Oldest record held
+  uint32_t nextSeq;
+  uint32_t flushedSeq;  // Records below this are in flash
+  uint32_t dropped;     // Overwritten before they reached flash
+  EventRecord records[EVENT_TAIL_RECORDS];
+
+  void clear() {
+    memset(this, 0, sizeof(*this));
+    magic = EVENT_TAIL_MAGIC;
+  }
+
+  // After a reset: keep the contents if they are intact, otherwise start
+  // empty. Returns the number of records not in flash yet.
+  uint32_t restore() {
+    bool valid = magic == EVENT_TAIL_MAGIC && firstSeq <= flushedSeq && flushedSeq <= nextSeq &&
+                 nextSeq - firstSeq <= EVENT_TAIL_RECORDS;
+    for (uint32_t seq = firstSeq; valid && seq != nextSeq; seq++) valid = at(seq).seq == seq;
+    if (!valid) {
+      clear();
+      return 0;
+    }
+    return unflushed();
+  }
+
+  // Continue after what is already in flash, e.g. after a power cut emptied
+  // RTC memory. Sequence numbers and boots never go backwards.
+  void resume(uint32_t flashNextSeq, uint16_t lastBoot) {
+    if (flashNextSeq > nextSeq) {
+      firstSeq = nextSeq = flushedSeq = flashNextSeq;
+    }
+    if (lastBoot > boot) boot = lastBoot;
+    boot++;
+  }
+
+  const EventRecord& at(uint32_t seq) const { return records[seq % EVENT_TAIL_RECORDS]; }
+
+  uint32_t unflushed() const { return nextSeq - flushedSeq; }
+
+  const EventRecord& append(uint8_t type, uint8_t arg, uint32_t value, uint32_t uptimeMs) {
+    if (nextSeq - firstSeq == EVENT_TAIL_RECORDS) {
+      if (flushedSeq == firstSeq) {
+        flushedSeq++;
+        dropped++;
+      }
+      firstSeq++;
+    }
+    EventRecord& record = records[nextSeq % EVENT_TAIL_RECORDS];
+    record = EventRecord{nextSeq, uptimeMs, boot, type, arg, value};
+    nextSeq++;
+    return record;
+  }
+
+  // Records [flushedSeq, flushedSeq + n) may be written as one block: same
+  // flash segment, no wrap in the tail
+  uint32_t nextFlushRun() const {
+    uint32_t n = unflushed();
+    uint32_t segmentLeft = JOURNAL_SEGMENT_RECORDS - flushedSeq % JOURNAL_SEGMENT_RECORDS;
+    uint32_t ringLeft = EVENT_TAIL_RECORDS - flushedSeq % EVENT_TAIL_RECORDS;
+    if (n > segmentLeft) n = segmentLeft;
+    return n < ringLeft ? n : ringLeft;
+  }
+};
+
+inline int journalSegment(uint32_t seq) { return (seq / JOURNAL_SEGMENT_RECORDS) % JOURNAL_SEGMENTS; }
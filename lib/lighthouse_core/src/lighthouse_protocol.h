@@ -0,0 +1,145 @@
+/** Lighthouse base station BLE protocol codec.
+ *
+ * Header-only encoder for both protocol generations:
+ *  - V1 (HTC): a 20-byte frame written to characteristic 0xCB01
+ *  - V2.0:     a single power byte written to characteristic 0x1525
+ *
+ * Everything here is constexpr, so frames for IDs known at compile time are
+ * baked into flash. Stations configured at runtime get their frames built once
+ * into a StationFrames record and the send path only copies bytes.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+
+namespace lighthouse {
+
+namespace v1 {
+
+constexpr size_t kFrameSize = 20;
+constexpr uint8_t kHeader = 0x12;
+
+using Frame = std::array<uint8_t, kFrameSize>;
+
+// Command IDs understood by the V1 firmware
+enum Command : uint8_t {
+  WAKE = 0x00,          // Wake up and stay on (timeout ignored, send 0)
+  WAKE_TIMEOUT = 0x01,  // Wake up and stay on for `timeout` seconds
+  SLEEP = 0x02,         // Go to sleep after `timeout` seconds
+};
+
+// Timeouts used by the stock power managers
+constexpr uint16_t kWakeTimeout = 0;
+constexpr uint16_t kSleepTimeout = 1;
+
+constexpr bool isValidCommand(uint8_t cmd) {
+  return cmd == WAKE || cmd == WAKE_TIMEOUT || cmd == SLEEP;
+}
+
+constexpr int hexNibble(char c) {
+  return (c >= '0' && c <= '9')   ? c - '0'
+         : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+         : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                                  : -1;
+}
+
+// Parse the 8-character unique ID printed on the back of the station
+// ("3BBF1347", optionally prefixed with 0x). Returns false on malformed input.
+constexpr bool parseUniqueId(const char* hex, uint32_t& out) {
+  if (hex == nullptr) return false;
+  if (hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) hex += 2;
+  uint32_t value = 0;
+  int digits = 0;
+  for (; hex[digits] != '\0'; digits++) {
+    int nibble = hexNibble(hex[digits]);
+    if (nibble < 0 || digits >= 8) return false;
+    value = (value << 4) | (uint32_t)nibble;
+  }
+  if (digits == 0) return false;
+  out = value;
+  return true;
+}
+
+// Convenience for literals; malformed IDs become 0 (never a real station)
+constexpr uint32_t uniqueId(const char* hex) {
+  uint32_t id = 0;
+  return parseUniqueId(hex, id) ? id : 0;
+}
+
+// Header, command, timeout (big endian), unique ID (little endian), 12 zero bytes
+constexpr Frame makeFrame(Command cmd, uint16_t timeout, uint32_t id) {
+  Frame frame{};
+  frame[0] = kHeader;
+  frame[1] = cmd;
+  frame[2] = (timeout >> 8) & 0xFF;
+  frame[3] = timeout & 0xFF;
+  frame[4] = id & 0xFF;
+  frame[5] = (id >> 8) & 0xFF;
+  frame[6] = (id >> 16) & 0xFF;
+  frame[7] = (id >> 24) & 0xFF;
+  return frame;
+}
+
+constexpr Frame wakeFrame(uint32_t id) { return makeFrame(WAKE, kWakeTimeout, id); }
+constexpr Frame sleepFrame(uint32_t id) { return makeFrame(SLEEP, kSleepTimeout, id); }
+
+// Per-station frames, built once when a station is configured
+struct StationFrames {
+  uint32_t uniqueId = 0;
+  Frame wake{};
+  Frame sleep{};
+  bool valid = false;
+};
+
+constexpr StationFrames makeStationFrames(uint32_t id) {
+  StationFrames frames{};
+  frames.uniqueId = id;
+  frames.wake = wakeFrame(id);
+  frames.sleep = sleepFrame(id);
+  frames.valid = true;
+  return frames;
+}
+
+constexpr StationFrames makeStationFrames(const char* hexId) {
+  uint32_t id = 0;
+  return parseUniqueId(hexId, id) ? makeStationFrames(id) : StationFrames{};
+}
+
+}  // namespace v1
+
+namespace v2 {
+
+constexpr size_t kFrameSize = 1;
+
+// Values written to (and read back from) the power characteristic
+enum Power : uint8_t {
+  POWER_OFF = 0x00,      // Sleep, motor stopped
+  POWER_ON = 0x01,       // Spin up and start sweeping
+  POWER_STANDBY = 0x02,  // Motor spinning, lasers off
+};
+
+constexpr bool isValidPower(uint8_t value) {
+  return value == POWER_OFF || value == POWER_ON || value == POWER_STANDBY;
+}
+
+constexpr uint8_t powerFrame(Power power) { return power; }
+
+}  // namespace v2
+
+// The frames themselves are checked against reference frames on the host by
+// tools/protocol_check
+namespace detail {
+
+static_assert(v1::uniqueId("3BBF1347") == 0x3BBF1347, "hex ID parse");
+static_assert(v1::uniqueId("0x6bc162bd") == 0x6BC162BD, "hex ID parse with prefix");
+static_assert(v1::uniqueId("3BBF13470") == 0, "over-long ID rejected");
+static_assert(v1::uniqueId("3BBG1347") == 0, "non-hex ID rejected");
+static_assert(v1::makeStationFrames("3BBF1347").valid && !v1::makeStationFrames("nope").valid,
+              "station frame precompute");
+
+}  // namespace detail
+
+}  // namespace lighthouse
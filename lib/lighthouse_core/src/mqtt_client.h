@@ -0,0 +1,414 @@
+/** Minimal MQTT 3.1.1 client.
+ *
+ * Replaces PubSubClient, which can only publish at QoS 0 and swallows PUBACKs,
+ * so nothing above it can know whether a message reached the broker. This
+ * client publishes at QoS 0 or 1 and reports every PUBACK, which is what the
+ * outbox (mqtt_outbox.h) builds its delivery tracking on.
+ *
+ * Nothing waits for the network. connect() only starts opening the
+ * transport; loop() polls it, sends CONNECT once it is open, and runs the
+ * connected callback once the broker has accepted. Incoming packets are
+ * assembled byte by byte from whatever the transport has available, and
+ * received messages go into a small inbox that loop() delivers one message
+ * per call, so a burst from the broker is spread over several passes of the
+ * caller's loop. While the inbox is full nothing more is read and TCP holds
+ * the broker back. Keepalive runs on its own timer in loop(), and a publish
+ * the transport has no room for fails without blocking, to be retried.
+ *
+ * The transport opens with connectStart() and connectPoll() (see
+ * tls_transport.h), and otherwise has the Arduino Client interface plus
+ * availableForWrite(). Time is passed in by the caller, so the client also
+ * runs on a host.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MQTT_CLIENT_BUFFER_SIZE
+#define MQTT_CLIENT_BUFFER_SIZE 1024  // Largest packet sent or received, fits any outbox record
+#endif
+#define MQTT_CONNACK_TIMEOUT_MS 5000
+#ifndef MQTT_INBOX_SLOTS
+#define MQTT_INBOX_SLOTS 4
+#endif
+#define MQTT_INBOX_SLOT_BYTES 512  // Topic and payload of one received message
+
+enum MqttState : int8_t {
+  MQTT_STATE_CONNECTION_TIMEOUT = -4,  // No CONNACK, or keepalive expired
+  MQTT_STATE_CONNECTION_LOST = -3,
+  MQTT_STATE_CONNECT_FAILED = -2,  // Transport could not connect
+  MQTT_STATE_DISCONNECTED = -1,
+  MQTT_STATE_CONNECTED = 0,
+  // 1-5: CONNACK return codes (bad protocol, client ID, unavailable, credentials, unauthorized)
+  MQTT_STATE_CONNECTING = 16,  // CONNECT sent, waiting for CONNACK
+  MQTT_STATE_OPENING = 17,     // Transport connecting
+};
+
+// Transport::connectPoll()
+enum TransportStatus : int8_t {
+  TRANSPORT_FAILED = -1,
+  TRANSPORT_PENDING = 0,
+  TRANSPORT_OPEN = 1,
+};
+
+struct MqttConnectOptions {
+  const char* clientId;
+  const char* username;  // nullptr or "" for none
+  const char* password;
+  const char* willTopic;  // nullptr for no will
+  const char* willMessage;
+  bool willRetain;
+  bool cleanSession;
+  uint16_t keepAliveS;
+};
+
+template <class Transport>
+class MqttClient {
+ public:
+  typedef void (*MessageCallback)(char* topic, uint8_t* payload, unsigned int length);
+  typedef void (*AckCallback)(uint16_t packetId);
+  typedef void (*SubackCallback)(uint16_t packetId, bool granted);
+  typedef void (*ConnectedCallback)(bool sessionPresent);
+
+  explicit MqttClient(Transport& transport) : transport_(transport) {}
+
+  MqttClient(const MqttClient&) = delete;
+  MqttClient& operator=(const MqttClient&) = delete;
+
+  void setServer(const char* host, uint16_t port) {
+    host_ = host;
+    port_ = port;
+  }
+  void setCallback(MessageCallback callback) { onMessage_ = callback; }
+  void setAckCallback(AckCallback callback) { onAck_ = callback; }
+  void setSubackCallback(SubackCallback callback) { onSuback_ = callback; }
+  void setConnectedCallback(ConnectedCallback callback) { onConnected_ = callback; }
+
+  // Start opening the transport; loop() sends CONNECT once it is open. The
+  // session is usable once connected() turns true, after loop() has seen the
+  // CONNACK. Returns false if the transport cannot even start.
+  bool connect(const MqttConnectOptions& options, uint32_t nowMs) {
+    nowMs_ = nowMs;
+    transport_.stop();
+    rxUsed_ = 0;
+    bool user = options.username && options.username[0];
+    bool pass = user && options.password && options.password[0];
+    uint8_t flags = options.cleanSession ? 0x02 : 0;
+    if (options.willTopic) flags |= 0x04 | (options.willRetain ? 0x20 : 0);
+    if (user) flags |= 0x80;
+    if (pass) flags |= 0x40;
+
+    size_t len = 0;
+    static const uint8_t kHeader[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04};
+    memcpy(body_, kHeader, sizeof(kHeader));
+    len = sizeof(kHeader);
+    body_[len++] = flags;
+    body_[len++] = options.keepAliveS >> 8;
+    body_[len++] = options.keepAliveS & 0xFF;
+    bool fits = putString(len, options.clientId);
+    if (options.willTopic) fits = fits && putString(len, options.willTopic) && putString(len, options.willMessage);
+    if (user) fits = fits && putString(len, options.username);
+    if (pass) fits = fits && putString(len, options.password);
+    // CONNECT waits in body_ until the transport is open; nothing else is
+    // sent before that
+    if (!fits || !transport_.connectStart(host_, port_, nowMs)) {
+      state_ = MQTT_STATE_CONNECT_FAILED;
+      return false;
+    }
+    connectLen_ = len;
+    keepAliveMs_ = (uint32_t)options.keepAliveS * 1000;
+    pingOutstanding_ = false;
+    state_ = MQTT_STATE_OPENING;
+    return true;
+  }
+
+  bool connected() {
+    if (state_ == MQTT_STATE_CONNECTED && !transport_.connected()) lost(MQTT_STATE_CONNECTION_LOST);
+    return state_ == MQTT_STATE_CONNECTED;
+  }
+  bool connecting() const { return state_ == MQTT_STATE_OPENING || state_ == MQTT_STATE_CONNECTING; }
+  int state() const { return state_; }
+
+  void disconnect() {
+    if (state_ == MQTT_STATE_CONNECTED) {
+      static const uint8_t kDisconnect[] = {0xE0, 0x00};
+      transport_.write(kDisconnect, sizeof(kDisconnect));
+    }
+    transport_.stop();
+    state_ = MQTT_STATE_DISCONNECTED;
+  }
+
+  // Received messages not delivered yet, and ones too large for an inbox slot
+  size_t inboxPending() const { return inboxCount_; }
+  uint32_t inboxDropped() const { return inboxDropped_; }
+
+  // QoS 0 publish of a C string, PubSubClient style
+  bool publish(const char* topic, const char* payload, bool retained = false) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload), retained, 0, 0, false, nowMs_);
+  }
+
+  // QoS 1 needs a non-zero packetId, reported back through the ack callback
+  bool publish(const char* topic, const uint8_t* payload, size_t payloadLen, bool retained, uint8_t qos,
+               uint16_t packetId, bool dup, uint32_t nowMs) {
+    if (!connected()) return false;
+    size_t len = 0;
+    if (!putString(len, topic)) return false;
+    if (qos > 0) {
+      body_[len++] = packetId >> 8;
+      body_[len++] = packetId & 0xFF;
+    }
+    if (len + payloadLen > MQTT_CLIENT_BUFFER_SIZE) return false;
+    memcpy(body_ + len, payload, payloadLen);
+    len += payloadLen;
+    uint8_t header = 0x30 | (dup ? 0x08 : 0) | ((qos & 0x03) << 1) | (retained ? 0x01 : 0);
+    return sendPacket(header, len, nowMs);
+  }
+
+  // Packet ID of the SUBSCRIBE, reported back through the suback callback;
+  // 0 if it could not be sent
+  uint16_t subscribe(const char* topic, uint8_t qos = 0) {
+    if (!connected()) return 0;
+    size_t len = 0;
+    uint16_t id = nextPacketId();
+    body_[len++] = id >> 8;
+    body_[len++] = id & 0xFF;
+    if (!putString(len, topic)) return 0;
+    body_[len++] = qos;
+    return sendPacket(0x82, len, nowMs_) ? id : 0;
+  }
+
+  // Packet IDs for QoS 1 publishes and subscriptions, never 0. The outbox
+  // takes its IDs from here as well.
+  uint16_t nextPacketId() {
+    if (++packetId_ == 0) packetId_ = 1;
+    return packetId_;
+  }
+
+  // Continue after `last`, so IDs kept in flight across a reset are not
+  // handed out again
+  void seedPacketId(uint16_t last) { packetId_ = last; }
+
+  // Advance a connect, read whatever has arrived, keep the session alive and
+  // deliver one received message. Returns false while not connected.
+  bool loop(uint32_t nowMs) {
+    nowMs_ = nowMs;
+    bool up = service(nowMs);
+    deliverOne();
+    return up;
+  }
+
+ private:
+  struct InboxMessage {
+    uint16_t topicLen;
+    uint16_t payloadLen;
+    uint8_t data[MQTT_INBOX_SLOT_BYTES];  // Topic, NUL, payload
+  };
+
+  bool service(uint32_t nowMs) {
+    if (state_ == MQTT_STATE_OPENING) {
+      TransportStatus status = transport_.connectPoll(nowMs);
+      if (status == TRANSPORT_PENDING) return false;
+      if (status == TRANSPORT_FAILED || !sendPacket(0x10, connectLen_, nowMs)) {
+        transport_.stop();
+        state_ = MQTT_STATE_CONNECT_FAILED;
+        return false;
+      }
+      connectStartedMs_ = lastRxMs_ = nowMs;
+      state_ = MQTT_STATE_CONNECTING;
+    }
+    if (state_ != MQTT_STATE_CONNECTED && state_ != MQTT_STATE_CONNECTING) return false;
+    if (!transport_.connected()) {
+      lost(MQTT_STATE_CONNECTION_LOST);
+      return false;
+    }
+    // A packet completes with its last byte, which is only read while an
+    // inbox slot is free
+    while (inboxCount_ < MQTT_INBOX_SLOTS && transport_.available() > 0) {
+      int c = transport_.read();
+      if (c < 0) break;
+      lastRxMs_ = nowMs;
+      receiveByte((uint8_t)c, nowMs);
+    }
+
+    if (state_ == MQTT_STATE_CONNECTING) {
+      if (nowMs - connectStartedMs_ >= MQTT_CONNACK_TIMEOUT_MS) lost(MQTT_STATE_CONNECTION_TIMEOUT);
+      return false;
+    }
+    if (state_ != MQTT_STATE_CONNECTED) return false;
+    if (keepAliveMs_ > 0) {
+      if (pingOutstanding_ && nowMs - lastRxMs_ >= keepAliveMs_ + keepAliveMs_ / 2) {
+        lost(MQTT_STATE_CONNECTION_TIMEOUT);
+        return false;
+      }
+      if (!pingOutstanding_ && (nowMs - lastTxMs_ >= keepAliveMs_ || nowMs - lastRxMs_ >= keepAliveMs_)) {
+        static const uint8_t kPingReq[] = {0xC0, 0x00};
+        transport_.write(kPingReq, sizeof(kPingReq));
+        lastTxMs_ = nowMs;
+        pingOutstanding_ = true;
+      }
+    }
+    return true;
+  }
+
+  void deliverOne() {
+    if (inboxCount_ == 0) return;
+    InboxMessage& message = inbox_[inboxHead_];
+    inboxHead_ = (inboxHead_ + 1) % MQTT_INBOX_SLOTS;
+    inboxCount_--;
+    if (onMessage_) onMessage_((char*)message.data, message.data + message.topicLen + 1, message.payloadLen);
+  }
+
+  bool putString(size_t& len, const char* text) {
+    size_t textLen = strlen(text);
+    if (len + 2 + textLen > MQTT_CLIENT_BUFFER_SIZE) return false;
+    body_[len++] = textLen >> 8;
+    body_[len++] = textLen & 0xFF;
+    memcpy(body_ + len, text, textLen);
+    len += textLen;
+    return true;
+  }
+
+  // Fixed header plus the first `len` bytes of body_, in one write. False
+  // without losing the connection if the transport has no room for it now;
+  // some room is always left for acks and pings.
+  bool sendPacket(uint8_t header, size_t len, uint32_t nowMs) {
+    uint8_t fixed[5];
+    size_t fixedLen = 0;
+    fixed[fixedLen++] = header;
+    size_t remaining = len;
+    do {
+      uint8_t digit = remaining % 128;
+      remaining /= 128;
+      fixed[fixedLen++] = digit | (remaining > 0 ? 0x80 : 0);
+    } while (remaining > 0);
+    uint8_t* packet = body_ - fixedLen;
+    memcpy(packet, fixed, fixedLen);
+    size_t total = fixedLen + len;
+    if ((size_t)transport_.availableForWrite() < total + kControlRoom) return false;
+    if (transport_.write(packet, total) != total) {
+      lost(MQTT_STATE_CONNECTION_LOST);
+      return false;
+    }
+    lastTxMs_ = nowMs;
+    return true;
+  }
+
+  // Assemble one packet at a time
+  void receiveByte(uint8_t c, uint32_t nowMs) {
+    if (rxUsed_ < sizeof(rx_)) rx_[rxUsed_] = c;
+    rxUsed_++;
+    if (rxUsed_ < 2) return;
+
+    // Remaining length: up to four 7-bit digits after the first byte
+    size_t remaining = 0, multiplier = 1, pos = 1;
+    for (;; pos++) {
+      if (pos >= rxUsed_ || pos > 4) {
+        if (pos > 4) rxUsed_ = 0;  // Malformed, resynchronise
+        return;
+      }
+      uint8_t digit = rx_[pos];
+      remaining += (digit & 0x7F) * multiplier;
+      multiplier *= 128;
+      if (!(digit & 0x80)) break;
+    }
+    size_t total = pos + 1 + remaining;
+    if (rxUsed_ < total) return;
+
+    rxUsed_ = 0;
+    if (total > sizeof(rx_)) return;  // Too large, dropped
+    handlePacket(rx_[0], rx_ + pos + 1, remaining, nowMs);
+  }
+
+  void handlePacket(uint8_t header, uint8_t* body, size_t len, uint32_t nowMs) {
+    switch (header & 0xF0) {
+      case 0x20:  // CONNACK
+        if (state_ != MQTT_STATE_CONNECTING || len < 2) return;
+        if (body[1] != 0) {
+          transport_.stop();
+          state_ = (MqttState)body[1];
+          return;
+        }
+        state_ = MQTT_STATE_CONNECTED;
+        pingOutstanding_ = false;
+        if (onConnected_) onConnected_(body[0] & 0x01);
+        return;
+      case 0x30: {  // PUBLISH
+        if (len < 2) return;
+        uint8_t qos = (header >> 1) & 0x03;
+        size_t topicLen = ((size_t)body[0] << 8) | body[1];
+        size_t offset = 2 + topicLen + (qos > 0 ? 2 : 0);
+        if (offset > len) return;
+        uint16_t id = qos > 0 ? ((uint16_t)body[2 + topicLen] << 8) | body[3 + topicLen] : 0;
+        size_t payloadLen = len - offset;
+        if (topicLen + 1 + payloadLen <= MQTT_INBOX_SLOT_BYTES) {
+          InboxMessage& message = inbox_[(inboxHead_ + inboxCount_++) % MQTT_INBOX_SLOTS];
+          message.topicLen = topicLen;
+          message.payloadLen = payloadLen;
+          memcpy(message.data, body + 2, topicLen);
+          message.data[topicLen] = '\0';
+          memcpy(message.data + topicLen + 1, body + offset, payloadLen);
+        } else {
+          inboxDropped_++;
+        }
+        if (qos == 1) {
+          uint8_t ack[4] = {0x40, 0x02, (uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+          transport_.write(ack, sizeof(ack));
+          lastTxMs_ = nowMs;
+        }
+        return;
+      }
+      case 0x40:  // PUBACK
+        if (len >= 2 && onAck_) onAck_(((uint16_t)body[0] << 8) | body[1]);
+        return;
+      case 0x90: {  // SUBACK, one return code per topic filter, 0x80 is a refusal
+        if (len < 3 || !onSuback_) return;
+        bool granted = true;
+        for (size_t i = 2; i < len; i++) granted = granted && body[i] != 0x80;
+        onSuback_(((uint16_t)body[0] << 8) | body[1], granted);
+        return;
+      }
+      case 0xD0:  // PINGRESP
+        pingOutstanding_ = false;
+        return;
+      default:  // Anything else needs no action
+        return;
+    }
+  }
+
+  void lost(MqttState reason) {
+    transport_.stop();
+    state_ = reason;
+    rxUsed_ = 0;
+  }
+
+  Transport& transport_;
+  const char* host_ = nullptr;
+  uint16_t port_ = 1883;
+  MessageCallback onMessage_ = nullptr;
+  AckCallback onAck_ = nullptr;
+  SubackCallback onSuback_ = nullptr;
+  ConnectedCallback onConnected_ = nullptr;
+  MqttState state_ = MQTT_STATE_DISCONNECTED;
+  size_t connectLen_ = 0;  // CONNECT body waiting in body_ while opening
+  uint32_t keepAliveMs_ = 0;
+  uint32_t connectStartedMs_ = 0;
+  uint32_t lastTxMs_ = 0;
+  uint32_t lastRxMs_ = 0;
+  uint32_t nowMs_ = 0;  // Time of the last connect() or loop(), for the calls without one
+  bool pingOutstanding_ = false;
+  uint16_t packetId_ = 0;
+  // Outgoing packets are built in body_, the room in front of it takes the
+  // fixed header once the length is known
+  static constexpr size_t kFixedHeaderRoom = 5;
+  static constexpr size_t kControlRoom = 16;  // Kept free for PUBACK and PINGREQ
+  uint8_t tx_[kFixedHeaderRoom + MQTT_CLIENT_BUFFER_SIZE];
+  uint8_t* const body_ = tx_ + kFixedHeaderRoom;
+  uint8_t rx_[MQTT_CLIENT_BUFFER_SIZE];
+  size_t rxUsed_ = 0;
+  InboxMessage inbox_[MQTT_INBOX_SLOTS];
+  uint8_t inboxHead_ = 0;
+  uint8_t inboxCount_ = 0;
+  uint32_t inboxDropped_ = 0;
+};
@@ -0,0 +1,278 @@
+/** Outbox for MQTT messages with QoS 1 delivery tracking.
+ *
+ * Everything the controller publishes (station state, names, events) goes
+ * through this ring first. While the broker is unreachable messages wait
+ * here; once connected they are sent in order at QoS 1 and only leave the
+ * ring when their PUBACK arrives. Messages that were in flight when the
+ * connection dropped are sent again, with DUP set, after the next connect.
+ *
+ * State messages (retained, one current value per topic) replace any older
+ * message for the same topic that is still queued, so a long outage costs
+ * one message per station rather than one per change.
+ *
+ * Records are variable length and never split: one that does not fit before
+ * the end of the arena goes to the start, after a zero-size wrap marker.
+ * When the ring is full the oldest records are dropped.
+ *
+ * The outbox is plain data without a constructor, so it can live in RTC
+ * memory that survives a crash or reset; restore() checks it after boot.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MQTT_OUTBOX_BYTES
+#define MQTT_OUTBOX_BYTES 2048
+#endif
+#define MQTT_OUTBOX_WINDOW 4  // QoS 1 messages in flight at once
+#define MQTT_OUTBOX_MAGIC 0x584F424Du  // "MBOX"
+
+enum OutboxFlags : uint8_t {
+  OUTBOX_RETAIN = 0x01,
+  OUTBOX_STATE = 0x02,  // Newer messages for the topic replace this one
+  OUTBOX_SENT = 0x04,   // Waiting for PUBACK
+  OUTBOX_ACKED = 0x08,
+  OUTBOX_DEAD = 0x10,   // Replaced by a newer state message
+};
+
+struct OutboxStats {
+  uint32_t queued;
+  uint32_t delivered;  // PUBACK received
+  uint32_t replaced;   // State messages superseded before delivery
+  uint32_t dropped;    // Pushed out of a full ring undelivered
+  uint32_t resent;     // Sent again after a reconnect
+};
+
+struct MqttOutbox {
+  struct RecordHeader {
+    uint16_t size;  // Whole record; 0 marks the wrap to the start
+    uint16_t packetId;
+    uint8_t flags;
+    uint8_t topicLen;
+    uint16_t payloadLen;
+  };
+
+  uint32_t magic;
+  uint16_t head;
+  uint16_t tail;
+  uint16_t count;
+  uint16_t lastPacketId;  // Last ID flush() took, to seed the client after a reset
+  OutboxStats stats;
+  uint8_t data[MQTT_OUTBOX_BYTES];
+
+  void clear() {
+    magic = MQTT_OUTBOX_MAGIC;
+    head = tail = count = 0;
+    lastPacketId = 0;
+    stats = OutboxStats{};
+  }
+
+  // After a reset: keep the contents if they are intact, otherwise start
+  // empty. Returns the number of messages kept.
+  size_t restore() {
+    if (magic != MQTT_OUTBOX_MAGIC || !consistent()) {
+      clear();
+      return 0;
+    }
+    if (count > 0) head = normalize(head);  // Older firmware left it on a wrap marker
+    requeueInflight();
+    return count;
+  }
+
+  size_t size() const { return count; }
+
+  size_t inflight() const {
+    size_t n = 0;
+    forEach([&](RecordHeader& record, size_t) {
+      if ((record.flags & (OUTBOX_SENT | OUTBOX_ACKED)) == OUTBOX_SENT) n++;
+    });
+    return n;
+  }
+
+  bool push(const char* topic, const uint8_t* payload, size_t payloadLen, uint8_t flags) {
+    size_t topicLen = strlen(topic);
+    size_t size = sizeof(RecordHeader) + topicLen + payloadLen;
+    if (topicLen > 255 || size > MQTT_OUTBOX_BYTES / 2) return false;
+
+    if (flags & OUTBOX_STATE) {
+      forEach([&](RecordHeader& record, size_t offset) {
+        if ((record.flags & (OUTBOX_STATE | OUTBOX_DEAD)) == OUTBOX_STATE && record.topicLen == topicLen &&
+            memcmp(data + offset + sizeof(RecordHeader), topic, topicLen) == 0) {
+          if (!(record.flags & OUTBOX_SENT)) stats.replaced++;
+          record.flags |= OUTBOX_DEAD;
+          store(record, offset);
+        }
+      });
+      trim();
+    }
+
+    size_t offset;
+    while (!reserve(size, offset)) {
+      RecordHeader oldest = load(normalize(head));
+      if (!(oldest.flags & (OUTBOX_ACKED | OUTBOX_DEAD))) stats.dropped++;
+      popHead();
+    }
+    RecordHeader record = {(uint16_t)size, 0, (uint8_t)(flags & (OUTBOX_RETAIN | OUTBOX_STATE)), (uint8_t)topicLen,
+                           (uint16_t)payloadLen};
+    store(record, offset);
+    memcpy(data + offset + sizeof(RecordHeader), topic, topicLen);
+    memcpy(data + offset + sizeof(RecordHeader) + topicLen, payload, payloadLen);
+    tail = offset + size;
+    count++;
+    stats.queued++;
+    return true;
+  }
+
+  bool push(const char* topic, const char* payload, uint8_t flags) {
+    return push(topic, (const uint8_t*)payload, strlen(payload), flags);
+  }
+
+  // Send queued messages in order while fewer than MQTT_OUTBOX_WINDOW are
+  // unacknowledged. `nextId()` hands out packet IDs; it must be the client's
+  // allocator, which SUBSCRIBE uses too, so no ID is in flight twice.
+  // `send(topic, payload, len, retain, packetId, dup)` returns false if the
+  // message could not be written.
+  template <class NextId, class Send>
+  void flush(NextId nextId, Send send) {
+    size_t open = inflight();
+    char topic[256];
+    bool stop = false;
+    forEach([&](RecordHeader& record, size_t offset) {
+      if (stop || open >= MQTT_OUTBOX_WINDOW) return;
+      if (record.flags & (OUTBOX_SENT | OUTBOX_DEAD)) return;
+      bool dup = record.packetId != 0;
+      if (!dup) record.packetId = lastPacketId = nextId();
+      memcpy(topic, data + offset + sizeof(RecordHeader), record.topicLen);
+      topic[record.topicLen] = '\0';
+      const uint8_t* payload = data + offset + sizeof(RecordHeader) + record.topicLen;
+      if (!send(topic, payload, record.payloadLen, record.flags & OUTBOX_RETAIN, record.packetId, dup)) {
+        stop = true;
+        store(record, offset);  // Keep the packet ID, a retry goes out as DUP
+        return;
+      }
+      if (dup) stats.resent++;
+      record.flags |= OUTBOX_SENT;
+      store(record, offset);
+      open++;
+    });
+    trim();
+  }
+
+  void ack(uint16_t packetId) {
+    forEach([&](RecordHeader& record, size_t offset) {
+      if (record.packetId == packetId && (record.flags & (OUTBOX_SENT | OUTBOX_ACKED)) == OUTBOX_SENT) {
+        record.flags |= OUTBOX_ACKED;
+        store(record, offset);
+        stats.delivered++;
+      }
+    });
+    trim();
+  }
+
+  // The connection dropped: whatever was not acknowledged goes out again
+  void requeueInflight() {
+    forEach([&](RecordHeader& record, size_t offset) {
+      if ((record.flags & (OUTBOX_SENT | OUTBOX_ACKED)) == OUTBOX_SENT) {
+        record.flags &= ~OUTBOX_SENT;
+        store(record, offset);
+      }
+    });
+  }
+
+ private:
+  RecordHeader load(size_t offset) const {
+    RecordHeader record;
+    memcpy(&record, data + offset, sizeof(record));
+    return record;
+  }
+
+  void store(const RecordHeader& record, size_t offset) { memcpy(data + offset, &record, sizeof(record)); }
+
+  // Offset of the record at `offset`, following a wrap marker or the end
+  size_t normalize(size_t offset) const {
+    if (offset + sizeof(RecordHeader) > MQTT_OUTBOX_BYTES || load(offset).size == 0) return 0;
+    return offset;
+  }
+
+  // Visit every record in order with a copy of its header; store() writes
+  // changes back
+  template <class Visit>
+  void forEach(Visit visit) const {
+    size_t offset = head;
+    for (size_t i = 0; i < count; i++) {
+      offset = normalize(offset);
+      RecordHeader record = load(offset);
+      visit(record, offset);
+      offset += record.size;
+    }
+  }
+
+  // Find room for `size` bytes at the tail, writing a wrap marker if needed
+  bool reserve(size_t size, size_t& offset) {
+    if (count == 0) {
+      head = tail = 0;
+      offset = 0;
+      return true;
+    }
+    if (tail > head) {
+      if (tail + size <= MQTT_OUTBOX_BYTES) {
+        offset = tail;
+        return true;
+      }
+      if (size < head) {
+        if (tail + sizeof(RecordHeader) <= MQTT_OUTBOX_BYTES) store(RecordHeader{}, tail);
+        offset = 0;
+        return true;
+      }
+      return false;
+    }
+    // Wrapped: free space is between tail and head
+    if (tail + size < head) {
+      offset = tail;
+      return true;
+    }
+    return false;
+  }
+
+  // Leaves head on the next record, never on a wrap marker or the end:
+  // reserve() takes it as the limit of the free space
+  void popHead() {
+    head = normalize(head);
+    size_t next = head + load(head).size;
+    if (--count == 0) {
+      head = tail = 0;
+    } else {
+      head = normalize(next);
+    }
+  }
+
+  // Drop delivered and replaced messages from the front
+  void trim() {
+    while (count > 0) {
+      RecordHeader oldest = load(normalize(head));
+      if (!(oldest.flags & (OUTBOX_ACKED | OUTBOX_DEAD))) break;
+      // A replaced message that is still in flight waits for its PUBACK
+      if ((oldest.flags & (OUTBOX_SENT | OUTBOX_ACKED)) == OUTBOX_SENT) break;
+      popHead();
+    }
+  }
+
+  // Walk the records and check that they add up, after a reset
+  bool consistent() const {
+    // Older firmware could leave head at the very end, normalize() maps it to 0
+    if (head > MQTT_OUTBOX_BYTES || tail > MQTT_OUTBOX_BYTES) return false;
+    size_t offset = head;
+    for (size_t i = 0; i < count; i++) {
+      offset = normalize(offset);
+      RecordHeader record = load(offset);
+      if (record.size != sizeof(RecordHeader) + record.topicLen + record.payloadLen ||
+          offset + record.size > MQTT_OUTBOX_BYTES) {
+        return false;
+      }
+      offset += record.size;
+    }
+    return count == 0 || offset == tail;
+  }
+};
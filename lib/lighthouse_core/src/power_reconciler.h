@@ -0,0 +1,120 @@
+/** Desired power state per station, reconciled in the background.
+ *
+ * Every command records what its configured stations should be switched to.
+ * What they were last seen in comes from the engine: a write the station
+ * accepted, or (V2) its power characteristic read back before writing. A
+ * station whose command failed (not found, connect or write failed, timed
+ * out) is retried on its own with exponential backoff, from
+ * RECONCILE_RETRY_MIN_S up to RECONCILE_RETRY_MAX_S, until the two agree.
+ * Stations that already agree are never part of a retry, so converged
+ * stations cost no radio time.
+ *
+ * Unconfigured V2 stations have no index and are not reconciled.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch_plan.h"
+#include "config_store.h"
+
+#define RECONCILE_RETRY_MIN_S 5
+#define RECONCILE_RETRY_MAX_S 600
+
+struct StationReconcile {
+  uint8_t desired;   // ACTION_NONE = no command since boot
+  uint8_t observed;  // Last confirmed action, ACTION_NONE = unknown
+  uint8_t failures;  // Consecutive failed attempts at `desired`
+  uint32_t retryAtMs;
+};
+
+class PowerReconciler {
+ public:
+  const StationReconcile& station(int index) const { return stations_[index]; }
+
+  bool converged(int index) const {
+    const StationReconcile& s = stations_[index];
+    return s.desired == ACTION_NONE || s.desired == s.observed;
+  }
+
+  // Configured stations that are not yet where they should be
+  uint8_t divergedMask(int stationCount) const {
+    uint8_t mask = 0;
+    for (int i = 0; i < stationCount && i < CONFIG_MAX_STATIONS; i++) {
+      if (!converged(i)) mask |= 1u << i;
+    }
+    return mask;
+  }
+
+  // Seconds until the next retry of a diverged station
+  uint32_t retryInS(int index, uint32_t nowMs) const {
+    if (converged(index)) return 0;
+    int32_t left = (int32_t)(stations_[index].retryAtMs - nowMs);
+    return left > 0 ? (left + 999) / 1000 : 0;
+  }
+
+  // A command is about to run with `plan` (after parking rewrote it). A new
+  // desired state starts over; repeating the same one keeps the backoff, so
+  // the retries submitted by due() do not reset their own schedule.
+  void setDesired(const BatchPlan& plan, int stationCount) {
+    for (int i = 0; i < stationCount && i < CONFIG_MAX_STATIONS; i++) {
+      if (plan.actions[i] == ACTION_NONE || plan.actions[i] == stations_[i].desired) continue;
+      stations_[i].desired = plan.actions[i];
+      stations_[i].failures = 0;
+    }
+  }
+
+  // The station accepted (or read back as already being in) `action`
+  void observe(int index, uint8_t action) {
+    if (index < 0 || index >= CONFIG_MAX_STATIONS) return;
+    stations_[index].observed = action;
+    if (action == stations_[index].desired) stations_[index].failures = 0;
+  }
+
+  // Sending `action` failed, so the station's state is unknown. Only a
+  // failed attempt at the current desired state backs off its next retry.
+  void failed(int index, uint8_t action, uint32_t nowMs) {
+    if (index < 0 || index >= CONFIG_MAX_STATIONS) return;
+    StationReconcile& s = stations_[index];
+    s.observed = ACTION_NONE;
+    if (action != s.desired) return;
+    if (s.failures < UINT8_MAX) s.failures++;
+    s.retryAtMs = nowMs + backoffS(s.failures) * 1000;
+  }
+
+  // Diverged stations whose retry is due, as a plan. Empty when all agree.
+  BatchPlan due(int stationCount, uint32_t nowMs) const {
+    BatchPlan plan;
+    plan.clear();
+    for (int i = 0; i < stationCount && i < CONFIG_MAX_STATIONS; i++) {
+      const StationReconcile& s = stations_[i];
+      if (converged(i) || s.failures == 0 || (int32_t)(nowMs - s.retryAtMs) < 0) continue;
+      plan.actions[i] = s.desired;
+    }
+    return plan;
+  }
+
+  // Station indices shift when one is removed
+  void removeStation(int index) {
+    for (int i = index; i + 1 < CONFIG_MAX_STATIONS; i++) stations_[i] = stations_[i + 1];
+    stations_[CONFIG_MAX_STATIONS - 1] = StationReconcile{};
+  }
+
+  // A station was edited (different address or hardware), its state is unknown
+  void resetStation(int index) { stations_[index] = StationReconcile{}; }
+
+  static constexpr uint32_t backoffS(uint8_t failures) {
+    uint32_t delay = RECONCILE_RETRY_MIN_S;
+    for (uint8_t i = 1; i < failures && delay < RECONCILE_RETRY_MAX_S; i++) delay *= 2;
+    return delay < RECONCILE_RETRY_MAX_S ? delay : RECONCILE_RETRY_MAX_S;
+  }
+
+ private:
+  StationReconcile stations_[CONFIG_MAX_STATIONS] = {};
+};
+
+static_assert(PowerReconciler::backoffS(1) == RECONCILE_RETRY_MIN_S && PowerReconciler::backoffS(3) == 20,
+              "retry backoff doubles");
+static_assert(PowerReconciler::backoffS(200) == RECONCILE_RETRY_MAX_S, "retry backoff is capped");
+static_assert(CONFIG_MAX_STATIONS <= 8, "diverged stations are reported in a uint8_t mask");
@@ -0,0 +1,129 @@
+/** Presence-triggered pre-wake.
+ *
+ * Base stations take 20-40 s to spin up, so waiting for someone to press a
+ * button wastes the start of every session. The tracker watches presence
+ * reports for the VR PC (a LAN probe and an MQTT topic) and asks for a wake
+ * as soon as the PC appears, then for a sleep once it has been gone for the
+ * grace period. It only decides; the caller sends the commands.
+ *
+ * A pre-wake whose session lasted less than PRESENCE_MIN_SESSION_MS (the PC
+ * booted for an update and shut down again) is counted as a false wake.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PRESENCE_MIN_SESSION_MS 120000u
+#define PRESENCE_MISSED_PROBES 2  // Consecutive failed probes before the PC counts as gone
+
+enum PresenceEvent : uint8_t { PRESENCE_NONE, PRESENCE_WAKE, PRESENCE_SLEEP };
+
+// MQTT presence payloads: on/off, home/not_home (Home Assistant device
+// trackers) or 1/0. `text` need not be NUL-terminated.
+inline bool parsePresencePayload(const char* text, size_t len, bool& present) {
+  static const char* const kPresent[] = {"on", "home", "1"};
+  static const char* const kAbsent[] = {"off", "not_home", "0"};
+  for (const char* word : kPresent) {
+    if (len == strlen(word) && memcmp(text, word, len) == 0) {
+      present = true;
+      return true;
+    }
+  }
+  for (const char* word : kAbsent) {
+    if (len == strlen(word) && memcmp(text, word, len) == 0) {
+      present = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct PresenceStats {
+  uint32_t wakes;
+  uint32_t sleeps;
+  uint32_t falseWakes;
+  uint32_t lastWakeLatencyMs;  // Trigger to wake command done
+  uint32_t maxWakeLatencyMs;
+};
+
+class PresenceTracker {
+ public:
+  void probeResult(bool reachable) {
+    if (reachable) {
+      probeMisses_ = 0;
+      probeUp_ = true;
+    } else if (++probeMisses_ >= PRESENCE_MISSED_PROBES) {
+      probeUp_ = false;
+    }
+  }
+
+  void mqttReport(bool present) { mqttUp_ = present; }
+
+  // Call regularly. Returns the event the caller should act on, at most one
+  // per call.
+  PresenceEvent update(uint32_t nowMs, uint32_t graceMs) {
+    bool seen = probeUp_ || mqttUp_;
+    if (seen && !present_) {
+      present_ = true;
+      if (!awake_) {
+        awake_ = true;
+        wakePending_ = true;
+        triggerMs_ = nowMs;
+        stats_.wakes++;
+        return PRESENCE_WAKE;
+      }
+    } else if (!seen && present_) {
+      present_ = false;
+      absentSinceMs_ = nowMs;
+    }
+    if (awake_ && !present_ && nowMs - absentSinceMs_ >= graceMs) {
+      awake_ = false;
+      wakePending_ = false;
+      stats_.sleeps++;
+      if (absentSinceMs_ - triggerMs_ < PRESENCE_MIN_SESSION_MS) stats_.falseWakes++;
+      return PRESENCE_SLEEP;
+    }
+    return PRESENCE_NONE;
+  }
+
+  // The wake command finished; `success` false leaves the latency unrecorded
+  void wakeCompleted(uint32_t nowMs, bool success) {
+    if (!wakePending_) return;
+    wakePending_ = false;
+    if (!success) return;
+    stats_.lastWakeLatencyMs = nowMs - triggerMs_;
+    if (stats_.lastWakeLatencyMs > stats_.maxWakeLatencyMs) stats_.maxWakeLatencyMs = stats_.lastWakeLatencyMs;
+  }
+
+  // Forget the current session (presence disabled or reconfigured)
+  void reset() {
+    probeUp_ = mqttUp_ = present_ = awake_ = wakePending_ = false;
+    probeMisses_ = 0;
+  }
+
+  bool present() const { return present_; }
+  bool awake() const { return awake_; }
+  bool wakePending() const { return wakePending_; }
+  bool probeUp() const { return probeUp_; }
+  bool mqttUp() const { return mqttUp_; }
+  // Milliseconds until the grace period ends, 0 if no sleep is pending
+  uint32_t sleepInMs(uint32_t nowMs, uint32_t graceMs) const {
+    if (!awake_ || present_) return 0;
+    uint32_t gone = nowMs - absentSinceMs_;
+    return gone < graceMs ? graceMs - gone : 0;
+  }
+  const PresenceStats& stats() const { return stats_; }
+
+ private:
+  PresenceStats stats_ = {};
+  uint32_t triggerMs_ = 0;
+  uint32_t absentSinceMs_ = 0;
+  uint8_t probeMisses_ = 0;
+  bool probeUp_ = false;
+  bool mqttUp_ = false;
+  bool present_ = false;
+  bool awake_ = false;  // A pre-wake was sent and no sleep since
+  bool wakePending_ = false;
+};
@@ -0,0 +1,58 @@
+/** Lock-free single-producer/single-consumer ring.
+ *
+ * Hands small plain-data events from one task to another without a lock:
+ * the producer only ever writes head_, the consumer only ever writes tail_,
+ * and each publishes its index with release ordering after touching the
+ * slot. push() and pop() are constant time and never block, so push() is
+ * safe to call from a callback running on another task. A push into a full
+ * ring is dropped and counted; `reserve` keeps slots free for pushes that
+ * must not be lost, such as an end-of-stream marker.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+template <class T, size_t Capacity>
+class SpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+  static_assert(std::atomic<uint32_t>::is_always_lock_free, "indices must be lock-free atomics");
+
+ public:
+  static constexpr size_t kCapacity = Capacity;
+
+  // Producer side
+  bool push(const T& item, size_t reserve = 0) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= Capacity - reserve) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slots_[head % Capacity] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T& item) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+    item = slots_[tail % Capacity];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: discard everything pushed so far
+  void drain() { tail_.store(head_.load(std::memory_order_acquire), std::memory_order_release); }
+
+  size_t size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  T slots_[Capacity];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::atomic<uint32_t> dropped_{0};
+};
@@ -0,0 +1,76 @@
+/** Standby parking for V2 stations.
+ *
+ * A V2 station in standby keeps its motor spinning with the lasers off, so it
+ * is tracking again within a second instead of spinning up from sleep. With
+ * parking enabled, an OFF for a configured V2 station is sent as STANDBY and
+ * the station is only put to sleep once its window has passed without another
+ * command, so a session restarted soon after ending is usable almost at once.
+ *
+ * V1 stations have no standby and unconfigured V2 stations cannot be tracked
+ * by index; both still get a plain OFF.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch_plan.h"
+#include "config_store.h"
+
+#define PARK_WINDOW_MAX_S 14400  // 4 h
+
+class StandbyParking {
+ public:
+  uint8_t parkedMask() const { return parked_; }
+
+  // Seconds until a parked station is put to sleep
+  uint32_t remainingS(int stationIndex, uint32_t nowMs) const {
+    if (!(parked_ & (1u << stationIndex))) return 0;
+    int32_t left = (int32_t)(sleepAtMs_[stationIndex] - nowMs);
+    return left > 0 ? (left + 999) / 1000 : 0;
+  }
+
+  // Rewrite OFF into STANDBY for configured V2 stations and start their
+  // windows. Any other action for a parked station ends its window; an OFF
+  // for a station that is already parked keeps the original deadline.
+  void apply(BatchPlan& plan, const ControllerConfig& config, uint32_t nowMs) {
+    for (int i = 0; i < config.stationCount && i < CONFIG_MAX_STATIONS; i++) {
+      uint8_t bit = 1u << i;
+      if (plan.actions[i] == ACTION_NONE) continue;
+      if (plan.actions[i] != ACTION_OFF || config.parkWindowS == 0 || config.stations[i].version != 2) {
+        parked_ &= ~bit;
+        continue;
+      }
+      plan.actions[i] = ACTION_STANDBY;
+      if (!(parked_ & bit)) {
+        parked_ |= bit;
+        sleepAtMs_[i] = nowMs + (uint32_t)config.parkWindowS * 1000;
+      }
+    }
+  }
+
+  // Stations whose window has passed; release() them once their OFF is queued
+  uint8_t expired(uint32_t nowMs) const {
+    uint8_t mask = 0;
+    for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if ((parked_ & (1u << i)) && (int32_t)(nowMs - sleepAtMs_[i]) >= 0) mask |= 1u << i;
+    }
+    return mask;
+  }
+
+  void release(uint8_t mask) { parked_ &= ~mask; }
+
+  // Station indices shift when one is removed
+  void removeStation(int stationIndex) {
+    uint8_t below = parked_ & ((1u << stationIndex) - 1);
+    uint8_t above = parked_ >> (stationIndex + 1);
+    for (int i = stationIndex; i + 1 < CONFIG_MAX_STATIONS; i++) sleepAtMs_[i] = sleepAtMs_[i + 1];
+    parked_ = below | (uint8_t)(above << stationIndex);
+  }
+
+ private:
+  uint32_t sleepAtMs_[CONFIG_MAX_STATIONS] = {};
+  uint8_t parked_ = 0;
+};
+
+static_assert(CONFIG_MAX_STATIONS <= 8, "parked stations are tracked in a uint8_t mask");
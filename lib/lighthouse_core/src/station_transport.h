@@ -0,0 +1,169 @@
+/** Compile-time transport traits for base station protocols.
+ *
+ * Each protocol generation is one StationTraits<Version> specialization that
+ * supplies everything the command engine needs to talk to it: GATT UUIDs,
+ * the frame encoder, the power-state decoder and a timing profile. The engine
+ * is a template over the traits and SupportedStations picks the instance for
+ * a discovered station's version with a fold expression, so the send path
+ * has no virtual calls and the service/characteristic/write ladder exists
+ * once.
+ *
+ * Adding a station type (or a simulated one for bench testing) means adding
+ * a specialization and listing it in SupportedStations.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch_plan.h"
+#include "lighthouse_protocol.h"
+
+namespace lighthouse {
+
+// Power state as read back from a station, where the protocol allows it
+enum PowerState : uint8_t {
+  STATE_UNKNOWN = 0,
+  STATE_SLEEPING,
+  STATE_BOOTING,  // Spinning up after a wake
+  STATE_STANDBY,  // Motor running, lasers off
+  STATE_ON,
+};
+
+inline const char* powerStateName(uint8_t state) {
+  switch (state) {
+    case STATE_SLEEPING: return "sleeping";
+    case STATE_BOOTING: return "booting";
+    case STATE_STANDBY: return "standby";
+    case STATE_ON: return "on";
+    default: return "unknown";
+  }
+}
+
+// A station read back in `state` needs no `action` written: one that is
+// still spinning up after a wake counts as on
+constexpr bool stateSatisfies(PowerState state, uint8_t action) {
+  switch (action) {
+    case ACTION_ON: return state == STATE_ON || state == STATE_BOOTING;
+    case ACTION_STANDBY: return state == STATE_STANDBY;
+    case ACTION_OFF: return state == STATE_SLEEPING;
+    default: return false;
+  }
+}
+
+template <uint8_t Version>
+struct StationTraits;
+
+// V1 (HTC): 20-byte frames carrying the station's unique ID, write only
+template <>
+struct StationTraits<1> {
+  static constexpr uint8_t kVersion = 1;
+  static constexpr const char* kName = "V1";
+  static constexpr const char* kServiceUuid = "0000cb00-0000-1000-8000-00805f9b34fb";
+  static constexpr const char* kCharacteristicUuid = "0000cb01-0000-1000-8000-00805f9b34fb";
+  static constexpr size_t kFrameSize = v1::kFrameSize;
+  static constexpr bool kReadable = false;
+  static constexpr bool kSupportsStandby = false;
+  // Timing profile
+  static constexpr uint32_t kWriteReserveMs = 300;  // Service discovery and write after connecting
+  static constexpr uint32_t kSpinUpMs = 30000;      // Sleep to tracking
+
+  using Frame = v1::Frame;
+  using Context = v1::StationFrames;  // Precomputed per configured station
+
+  // No standby on V1, it sleeps instead
+  static constexpr bool encode(uint8_t action, const Context& frames, Frame& out) {
+    if (!frames.valid || action == ACTION_NONE) return false;
+    out = action == ACTION_ON ? frames.wake : frames.sleep;
+    return true;
+  }
+
+  static constexpr PowerState decode(const uint8_t*, size_t) { return STATE_UNKNOWN; }
+};
+
+// V2.0: one power byte, readable
+template <>
+struct StationTraits<2> {
+  static constexpr uint8_t kVersion = 2;
+  static constexpr const char* kName = "V2";
+  static constexpr const char* kServiceUuid = "00001523-1212-efde-1523-785feabcd124";
+  static constexpr const char* kCharacteristicUuid = "00001525-1212-efde-1523-785feabcd124";
+  static constexpr size_t kFrameSize = v2::kFrameSize;
+  static constexpr bool kReadable = true;
+  static constexpr bool kSupportsStandby = true;
+  // Timing profile
+  static constexpr uint32_t kWriteReserveMs = 300;
+  static constexpr uint32_t kSpinUpMs = 20000;
+
+  using Frame = std::array<uint8_t, v2::kFrameSize>;
+  struct Context {};
+
+  static constexpr bool encode(uint8_t action, const Context&, Frame& out) {
+    switch (action) {
+      case ACTION_ON: out[0] = v2::powerFrame(v2::POWER_ON); return true;
+      case ACTION_OFF: out[0] = v2::powerFrame(v2::POWER_OFF); return true;
+      case ACTION_STANDBY: out[0] = v2::powerFrame(v2::POWER_STANDBY); return true;
+      default: return false;
+    }
+  }
+
+  // Values reported by the power characteristic
+  static constexpr PowerState decode(const uint8_t* data, size_t len) {
+    if (len < 1) return STATE_UNKNOWN;
+    switch (data[0]) {
+      case 0x00: return STATE_SLEEPING;
+      case 0x01: case 0x08: case 0x09: return STATE_BOOTING;
+      case 0x02: return STATE_STANDBY;
+      case 0x0B: return STATE_ON;
+      default: return STATE_UNKNOWN;
+    }
+  }
+};
+
+template <class... Traits>
+struct StationTypeList {
+  // Calls f(Traits{}) for the traits whose kVersion matches. Returns false
+  // for unknown versions.
+  template <class F>
+  static bool dispatch(uint8_t version, F&& f) {
+    return ((Traits::kVersion == version ? (f(Traits{}), true) : false) || ...);
+  }
+
+  static constexpr uint32_t maxWriteReserveMs() {
+    uint32_t reserve = 0;
+    ((reserve = Traits::kWriteReserveMs > reserve ? Traits::kWriteReserveMs : reserve), ...);
+    return reserve;
+  }
+};
+
+using SupportedStations = StationTypeList<StationTraits<1>, StationTraits<2>>;
+
+namespace detail {
+
+constexpr bool encodesAs(uint8_t action, uint8_t expected) {
+  StationTraits<2>::Frame frame{};
+  return StationTraits<2>::encode(action, {}, frame) && frame[0] == expected;
+}
+
+static_assert(encodesAs(ACTION_ON, 0x01) && encodesAs(ACTION_OFF, 0x00) && encodesAs(ACTION_STANDBY, 0x02),
+              "V2 power frames");
+constexpr uint8_t kRefStateOn[1] = {0x0B};
+constexpr uint8_t kRefStateStandby[1] = {0x02};
+static_assert(StationTraits<2>::decode(kRefStateOn, 1) == STATE_ON &&
+                  StationTraits<2>::decode(kRefStateStandby, 1) == STATE_STANDBY,
+              "V2 state decode");
+
+constexpr bool v1StandbySleeps() {
+  v1::Frame frame{};
+  if (!StationTraits<1>::encode(ACTION_STANDBY, v1::makeStationFrames(0x3BBF1347), frame)) return false;
+  v1::Frame sleep = v1::sleepFrame(0x3BBF1347);
+  for (size_t i = 0; i < v1::kFrameSize; i++) {
+    if (frame[i] != sleep[i]) return false;
+  }
+  return true;
+}
+static_assert(v1StandbySleeps(), "V1 standby falls back to sleep");
+
+}  // namespace detail
+
+}  // namespace lighthouse
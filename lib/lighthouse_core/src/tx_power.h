@@ -0,0 +1,105 @@
+/** Adaptive per-station BLE transmit power.
+ *
+ * Connecting to a station a metre away at +9 dBm wastes energy and adds
+ * 2.4 GHz noise next to our own WiFi. The level for each configured station
+ * starts from a link budget estimate based on the RSSI of its adverts, then
+ * adapts to how connecting actually goes: every failed connect moves the
+ * station one level up, and a run of TX_POWER_STEP_DOWN_AFTER successes
+ * tries one level lower again. Unconfigured stations always get the maximum.
+ *
+ * Levels are indices into kTxPowerDbm and match esp_power_level_t
+ * (ESP_PWR_LVL_N12 = 0 ... ESP_PWR_LVL_P9 = 7).
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config_store.h"
+
+constexpr int8_t kTxPowerDbm[] = {-12, -9, -6, -3, 0, 3, 6, 9};
+constexpr uint8_t kTxPowerLevels = sizeof(kTxPowerDbm) / sizeof(kTxPowerDbm[0]);
+constexpr uint8_t kTxPowerMax = kTxPowerLevels - 1;
+
+// Link budget: stations advertise at roughly 0 dBm and we want our packets to
+// arrive at them with at least -75 dBm, some 15 dB above receiver sensitivity
+#define TX_POWER_STATION_DBM 0
+#define TX_POWER_TARGET_RX_DBM (-75)
+#define TX_POWER_STEP_DOWN_AFTER 8
+#define TX_POWER_MIN_BIAS (-2)  // Levels below the RSSI estimate we may settle at
+
+// Lowest level whose output covers the path loss implied by `rssi`
+constexpr uint8_t txPowerForRssi(int8_t rssi) {
+  int needed = TX_POWER_TARGET_RX_DBM + (TX_POWER_STATION_DBM - rssi);
+  uint8_t level = 0;
+  while (level < kTxPowerMax && kTxPowerDbm[level] < needed) level++;
+  return level;
+}
+
+static_assert(txPowerForRssi(-40) == 0, "close stations get the minimum");
+static_assert(txPowerForRssi(-80) == 6, "-80 dBm needs +5 dBm, i.e. +6");
+static_assert(txPowerForRssi(-100) == kTxPowerMax, "weak links get the maximum");
+
+struct StationRadio {
+  int8_t rssi;        // Last advert RSSI, 0 until seen
+  int8_t bias;        // Levels above (or below) the RSSI estimate
+  uint8_t level;      // Level used for the last connect attempt
+  uint8_t streak;     // Consecutive successful connects since the last change
+  bool adaptive;      // `level` was chosen by the policy, results may move the bias
+  uint16_t connects;  // Attempts and successes since boot
+  uint16_t successes;
+};
+
+class TxPowerPolicy {
+ public:
+  // Level for the next connect attempt to configured station `index` (-1
+  // for unconfigured ones) whose adverts arrived with `rssi`. With `adaptive`
+  // false the maximum is used, but RSSI and connect results are still kept.
+  uint8_t levelFor(int index, int8_t rssi, bool adaptive) {
+    if (index < 0 || index >= CONFIG_MAX_STATIONS) return kTxPowerMax;
+    StationRadio& radio = radios_[index];
+    radio.rssi = rssi;
+    radio.adaptive = adaptive;
+    int level = adaptive ? txPowerForRssi(rssi) + radio.bias : kTxPowerMax;
+    radio.level = level < 0 ? 0 : level > kTxPowerMax ? kTxPowerMax : level;
+    return radio.level;
+  }
+
+  void recordConnect(int index, bool connected) {
+    if (index < 0 || index >= CONFIG_MAX_STATIONS) return;
+    StationRadio& radio = radios_[index];
+    if (radio.connects == UINT16_MAX) radio.connects = radio.successes = 0;  // Keep the ratio meaningful
+    radio.connects++;
+    if (connected) radio.successes++;
+    if (!radio.adaptive) return;
+    if (connected) {
+      if (++radio.streak >= TX_POWER_STEP_DOWN_AFTER) {
+        radio.streak = 0;
+        if (radio.bias > TX_POWER_MIN_BIAS && radio.level > 0) radio.bias--;
+      }
+    } else {
+      radio.streak = 0;
+      if (radio.level < kTxPowerMax) radio.bias++;
+    }
+  }
+
+  const StationRadio& radio(int index) const { return radios_[index]; }
+
+  // Success rate in percent, 100 before the first attempt
+  uint8_t successPct(int index) const {
+    const StationRadio& radio = radios_[index];
+    return radio.connects == 0 ? 100 : radio.successes * 100u / radio.connects;
+  }
+
+  // Station indices shift when one is removed
+  void removeStation(int index) {
+    for (int i = index; i + 1 < CONFIG_MAX_STATIONS; i++) radios_[i] = radios_[i + 1];
+    radios_[CONFIG_MAX_STATIONS - 1] = StationRadio{};
+  }
+
+  // A station was edited (different address or hardware), forget its history
+  void resetStation(int index) { radios_[index] = StationRadio{}; }
+
+ private:
+  StationRadio radios_[CONFIG_MAX_STATIONS] = {};
+};
@@ -0,0 +1,203 @@
+/** Binary UDP control protocol.
+ *
+ * HTTP and MQTT put a TCP handshake, a request parser or a broker hop in
+ * front of every command. This protocol is one datagram per command, parsed
+ * in place, answered with an immediate ack and followed by status datagrams
+ * until the command has finished, so a helper on the VR PC can switch the
+ * stations with a single round trip of overhead.
+ *
+ * All multi-byte fields are big-endian.
+ *
+ *   Request (10 bytes)         Ack (8 bytes)              Status (14 bytes)
+ *   0  'L' 'H'                 0  'L' 'H'                 0  'L' 'H'
+ *   2  version (1)             2  version                 2  version
+ *   3  type: ping / command    3  type: ack               3  type: status
+ *   4  sequence number         4  sequence of request     4  sequence of request
+ *   6  action: on/off/standby  6  UdpAckCode              6  UdpPhase
+ *   7  target station mask     7  0                       7  target mask
+ *   8  flags (UDP_FLAG_*)                                 8  stations switched
+ *   9  0                                                  9  stations failed
+ *                                                         10 ms since the request
+ *
+ * With a key configured every datagram in both directions carries a 16 byte
+ * tag after these fields: HMAC-SHA256 of the fields, truncated. Keyed
+ * requests must also have increasing sequence numbers, so a captured
+ * datagram cannot be replayed. Repeating the last sequence number is a
+ * retransmission and is acked again without running the command twice.
+ * Malformed datagrams are dropped without an answer when a key is set.
+ *
+ * The last accepted sequence number outlives a reboot (UdpSequenceMark): it
+ * is kept in RTC memory, and after each command also in flash. Only a power
+ * cut within a moment of a command, before that write, loses it; the
+ * commands accepted in that moment could then be replayed once.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "batch_plan.h"
+#include "config_store.h"
+
+#define UDP_CONTROL_DEFAULT_PORT 47800
+#define UDP_PROTOCOL_VERSION 1
+#define UDP_TAG_LEN 16
+#define UDP_REQUEST_LEN 10
+#define UDP_ACK_LEN 8
+#define UDP_STATUS_LEN 14
+#define UDP_FRAME_MAX (UDP_STATUS_LEN + UDP_TAG_LEN)
+
+static_assert(CONFIG_MAX_STATIONS <= 8, "station masks are one byte");
+
+enum UdpType : uint8_t {
+  UDP_PING = 0x01,  // Acked with UDP_ACK_PONG, measures the round trip
+  UDP_COMMAND = 0x02,
+  UDP_ACK = 0x81,
+  UDP_STATUS = 0x82,
+};
+
+enum UdpFlags : uint8_t {
+  UDP_FLAG_UNMAPPED = 0x01,  // Also switch unconfigured V2 stations found by the scan
+  UDP_FLAG_ALL = 0x02,       // Every configured station, whatever the mask says
+};
+
+enum UdpAckCode : uint8_t {
+  UDP_ACK_STARTED = 0x00,
+  UDP_ACK_QUEUED = 0x01,  // Runs after the command in progress
+  UDP_ACK_PONG = 0x02,
+  UDP_ACK_BAD_FRAME = 0x10,
+  UDP_ACK_BAD_TAG = 0x11,
+  UDP_ACK_REPLAY = 0x12,      // Keyed request with an old sequence number
+  UDP_ACK_BAD_TARGET = 0x13,  // Unknown action or station
+};
+
+enum UdpPhase : uint8_t {
+  UDP_PHASE_QUEUED = 0,
+  UDP_PHASE_SCANNING = 1,
+  UDP_PHASE_SWITCHING = 2,
+  UDP_PHASE_DONE = 3,  // Last status for the request
+};
+
+struct UdpRequest {
+  uint8_t type;
+  uint16_t seq;
+  uint8_t action;
+  uint8_t targets;
+  uint8_t flags;
+};
+
+// Check the framing of a request of `len` bytes. With `keyed` the tag must be
+// present; the caller verifies it over the first UDP_REQUEST_LEN bytes.
+inline UdpAckCode decodeUdpRequest(const uint8_t* frame, size_t len, bool keyed, UdpRequest& request) {
+  if (len != UDP_REQUEST_LEN + (keyed ? UDP_TAG_LEN : 0)) return UDP_ACK_BAD_FRAME;
+  if (frame[0] != 'L' || frame[1] != 'H' || frame[2] != UDP_PROTOCOL_VERSION) return UDP_ACK_BAD_FRAME;
+  request.type = frame[3];
+  request.seq = (uint16_t)(frame[4] << 8 | frame[5]);
+  request.action = frame[6];
+  request.targets = frame[7];
+  request.flags = frame[8];
+  if (request.type != UDP_PING && request.type != UDP_COMMAND) return UDP_ACK_BAD_FRAME;
+  return UDP_ACK_STARTED;
+}
+
+// Plan for a command request, false if it names no valid station or action
+inline bool udpRequestPlan(const UdpRequest& request, uint8_t stationCount, BatchPlan& plan) {
+  plan.clear();
+  if (request.action < ACTION_ON || request.action > ACTION_STANDBY) return false;
+  uint8_t targets = request.targets;
+  if (request.flags & UDP_FLAG_ALL) {
+    targets = stationCount >= 8 ? 0xFF : (1u << stationCount) - 1;
+  } else if (targets >> stationCount) {
+    return false;
+  }
+  for (int i = 0; i < stationCount; i++) {
+    if (targets & (1u << i)) plan.actions[i] = request.action;
+  }
+  if (request.flags & UDP_FLAG_UNMAPPED) plan.unmappedAction = request.action;
+  return !plan.empty();
+}
+
+inline size_t encodeUdpHeader(uint8_t* frame, uint8_t type, uint16_t seq) {
+  frame[0] = 'L';
+  frame[1] = 'H';
+  frame[2] = UDP_PROTOCOL_VERSION;
+  frame[3] = type;
+  frame[4] = seq >> 8;
+  frame[5] = seq & 0xFF;
+  return 6;
+}
+
+inline size_t encodeUdpAck(uint8_t* frame, uint16_t seq, UdpAckCode code) {
+  encodeUdpHeader(frame, UDP_ACK, seq);
+  frame[6] = code;
+  frame[7] = 0;
+  return UDP_ACK_LEN;
+}
+
+inline size_t encodeUdpStatus(uint8_t* frame, uint16_t seq, UdpPhase phase, uint8_t targets, uint8_t switched,
+                              uint8_t failed, uint32_t elapsedMs) {
+  encodeUdpHeader(frame, UDP_STATUS, seq);
+  frame[6] = phase;
+  frame[7] = targets;
+  frame[8] = switched;
+  frame[9] = failed;
+  for (int i = 0; i < 4; i++) frame[10 + i] = elapsedMs >> (24 - 8 * i);
+  return UDP_STATUS_LEN;
+}
+
+// Compare tags without an early exit, so timing gives nothing away
+inline bool udpTagsEqual(const uint8_t* a, const uint8_t* b) {
+  uint8_t diff = 0;
+  for (int i = 0; i < UDP_TAG_LEN; i++) diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+enum UdpSequenceCheck : uint8_t { UDP_SEQ_NEW, UDP_SEQ_REPEAT, UDP_SEQ_OLD };
+
+// Last accepted sequence number. Numbers wrap, so "newer" means less than
+// half the space ahead. Until accept() or a restored mark, the first request
+// is always new.
+class UdpSequenceGuard {
+ public:
+  UdpSequenceCheck check(uint16_t seq) const {
+    if (!valid_) return UDP_SEQ_NEW;
+    if (seq == last_) return UDP_SEQ_REPEAT;
+    return (int16_t)(seq - last_) > 0 ? UDP_SEQ_NEW : UDP_SEQ_OLD;
+  }
+
+  void accept(uint16_t seq) {
+    last_ = seq;
+    valid_ = true;
+  }
+
+  void reset() { valid_ = false; }
+
+  bool valid() const { return valid_; }
+  uint16_t last() const { return last_; }
+
+ private:
+  uint16_t last_ = 0;
+  bool valid_ = false;
+};
+
+#define UDP_SEQUENCE_MAGIC 0x51455355u  // "USEQ"
+
+// The guard's state for one key, as stored in RTC memory and NVS. Plain data,
+// checked with valid() after a reset.
+struct UdpSequenceMark {
+  uint32_t magic;
+  uint32_t keyCrc;  // CRC-32 of the key the number belongs to
+  uint16_t last;
+  uint16_t check;  // ~last
+
+  void set(uint32_t crc, uint16_t seq) {
+    magic = UDP_SEQUENCE_MAGIC;
+    keyCrc = crc;
+    last = seq;
+    check = (uint16_t)~seq;
+  }
+  bool valid(uint32_t crc) const { return magic == UDP_SEQUENCE_MAGIC && keyCrc == crc && check == (uint16_t)~last; }
+};
+
+inline uint32_t udpKeyCrc(const char* key) { return configCrc32(reinterpret_cast<const uint8_t*>(key), strlen(key)); }
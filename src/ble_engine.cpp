@@ -0,0 +1,799 @@
+/** Command queue and BLE engine, see controller.h. Always built.
+ */
+#include "controller.h"
+
+#include <esp_timer.h>
+
+#include <atomic>
+
+#include "advert_classifier.h"
+#include "lighthouse_protocol.h"
+#include "spsc_ring.h"
+#include "station_transport.h"
+
+// GATT UUIDs per station type, built once from the transport traits
+template <class Traits>
+const NimBLEUUID& serviceUuid() {
+  static const NimBLEUUID uuid(Traits::kServiceUuid);
+  return uuid;
+}
+
+template <class Traits>
+const NimBLEUUID& characteristicUuid() {
+  static const NimBLEUUID uuid(Traits::kCharacteristicUuid);
+  return uuid;
+}
+
+// Stations found in the current scan, deduplicated by address. Only plain
+// records are kept, so NimBLE does not need to hold on to its scan results.
+DiscoveryTable<MAX_TRACKED_LH> discoveryTable;
+
+TraceCapture traceCapture = {};
+
+uint8_t currentCommand = NOTHING;
+
+// Per-station actions of the running command. Commands that arrive while one
+// is running are merged into pendingPlan and run together in the next cycle.
+BatchPlan activePlan;
+BatchPlan pendingPlan;
+bool commandPending = false;
+
+// V2 stations switched OFF wait in standby for config.parkWindowS first
+StandbyParking parking;
+
+// Desired against last confirmed state per configured station
+PowerReconciler reconciler;
+
+uint8_t stationPower[CONFIG_MAX_STATIONS];
+
+void scanEndedCB(NimBLEScanResults results);
+void finishCommandCycle();
+
+// Command frames for each configured V1 station, rebuilt only when the
+// station list changes so the send path never assembles frames.
+lighthouse::v1::StationFrames lighthouseFrames[CONFIG_MAX_STATIONS];
+
+void precomputeLighthouseFrames() {
+  for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+    if (i < config.stationCount && config.stations[i].version == 1) {
+      lighthouseFrames[i] = lighthouse::v1::makeStationFrames(config.stations[i].uniqueId);
+    } else {
+      lighthouseFrames[i] = lighthouse::v1::StationFrames();
+    }
+  }
+}
+
+// The scan callbacks run in the NimBLE host task. They only classify the
+// advert and push the result; loop() pops it in serviceBleEvents() and is the
+// only task that touches discoveryTable. The callbacks read config and
+// activePlan, which loop() only changes while no scan is running.
+enum BleEventKind : uint8_t { BLE_EVENT_STATION, BLE_EVENT_SCAN_ENDED };
+
+struct BleEvent {
+  uint8_t kind;
+  bool accepted;  // Part of the running command
+  DiscoveredStation station;
+};
+
+#define BLE_EVENT_RING 64
+SpscRing<BleEvent, BLE_EVENT_RING> bleEvents;
+
+// Set by serviceBleEvents() once the scan has ended
+static bool readyToConnect = false;
+
+// Set by loop() before it stops the scan itself. NimBLE then runs
+// scanEndedCB() synchronously on the loop task, which must not push: the ring
+// only has one producer, the host task.
+static std::atomic<bool> scanStoppedByLoop{false};
+
+// Command engine (see serviceCommandEngine). Each command must finish within
+// config.commandDeadlineMs: the scan gets at most ENGINE_SCAN_SHARE_PCT of it,
+// the rest is split across the stations found.
+#define ENGINE_SCAN_SHARE_PCT 40
+#define ENGINE_CONNECT_ATTEMPTS 3
+#define ENGINE_RETRY_BACKOFF_US 250000
+// Service discovery and write after connecting, per the slowest station type
+#define ENGINE_WRITE_RESERVE_US (lighthouse::SupportedStations::maxWriteReserveMs() * 1000)
+
+CommandEngine engine = {};
+
+CycleReport cycleReport;
+
+SpanRecorder spans;
+
+void beginCommandTrace() { spans.begin((uint32_t)esp_timer_get_time()); }
+void beginCommandTrace(uint32_t receivedUs) { spans.begin(receivedUs); }
+
+// Span of the running cycle that ends now
+void recordSpan(uint8_t phase, int64_t startedAt, int station, uint8_t outcome, uint8_t attempt = 0) {
+  spans.record(phase, engine.cycles, (uint32_t)startedAt, (uint32_t)esp_timer_get_time(), station, outcome, attempt);
+}
+
+// Transmit power per configured station, learned from RSSI and connect results
+TxPowerPolicy txPower;
+
+void startScanAndSetCommand(uint8_t command, const BatchPlan& plan) {
+  markBootPhase(bootTimeline.firstCommandMs, "First command");
+  ledPattern.togglesLeft = 0;
+  digitalWrite(ledPin, HIGH);
+  activePlan = plan;
+
+  int64_t now = esp_timer_get_time();
+  int64_t budget = (int64_t)config.commandDeadlineMs * 1000;
+  engine.phase = PHASE_SCAN;
+  engine.startedAt = now;
+  engine.deadline = now + budget;
+  engine.scanDeadline = now + min(budget * ENGINE_SCAN_SHARE_PCT / 100, (int64_t)config.tuning.scanTimeS * 1000000);
+  engine.station = 0;
+  engine.attempt = 0;
+  engine.success = true;
+  engine.preempt = false;
+  engine.doneMask = 0;
+  cycleReport.start(++engine.cycles);
+  spans.cycleStarted(engine.cycles, (uint32_t)now);
+
+  bleEnsureStarted();
+  bleEvents.drain();
+  discoveryTable.clear();
+  readyToConnect = false;
+  scanStoppedByLoop = false;
+  // The scan is normally stopped by serviceCommandEngine(); the duration is a backstop
+  NimBLEDevice::getScan()->start(config.tuning.scanTimeS, scanEndedCB);
+  currentCommand = command;
+}
+
+// Scan without sending anything, recording every advert into the trace buffer
+void startTraceCapture(uint32_t seconds) {
+  ledPattern.togglesLeft = 0;
+  digitalWrite(ledPin, HIGH);
+  activePlan.clear();
+  traceCapture.writer.reset(traceCapture.buffer, TRACE_BUFFER_BYTES);
+  traceCapture.startedAt = esp_timer_get_time();
+  traceCapture.active = true;
+  bleEnsureStarted();
+  bleEvents.drain();
+  readyToConnect = false;
+  scanStoppedByLoop = false;
+  discoveryTable.clear();
+  NimBLEDevice::getScan()->start(seconds, scanEndedCB);
+  currentCommand = CAPTURE_TRACE;
+}
+
+// Entry point for HTTP, MQTT and the buttons. Returns false if the command was
+// queued behind the one in progress. `source` (EventSource) is for the
+// journal. `parkable` is false for the OFF that ends a parking window, which
+// must not be turned back into standby.
+bool submitCommand(uint8_t command, const BatchPlan& request, uint8_t source, bool parkable) {
+  journalEvent(EVENT_COMMAND, source, packCommand(command, request));
+  // Whether it starts now or after the running cycle, this is cycle engine.cycles + 1
+  spans.submit(source, command, engine.cycles + 1, currentCommand != NOTHING, (uint32_t)esp_timer_get_time());
+  BatchPlan plan = request;
+  if (parkable) parking.apply(plan, config, millis());
+  reconciler.setDesired(plan, config.stationCount);
+  if (currentCommand == NOTHING) {
+    startScanAndSetCommand(command, plan);
+    return true;
+  }
+  if (!commandPending) {
+    pendingPlan.clear();
+    commandPending = true;
+  }
+  if (currentCommand != CAPTURE_TRACE && activePlan.conflictsWith(plan)) {
+    // e.g. OFF during an ON: stop the running command at its next step and
+    // carry over whatever it has not done yet, the new command wins
+    BatchPlan next = activePlan;
+    next.clearStations(engine.doneMask);
+    next.merge(pendingPlan);
+    pendingPlan = next;
+    engine.preempt = true;
+    Serial.println("Conflicting command, preempting the one in progress");
+  } else {
+    Serial.println("Command in progress, queued for the next cycle");
+  }
+  pendingPlan.merge(plan);
+  return false;
+}
+
+bool runScene(const char* name, uint8_t source) {
+  int index = findScene(config, name);
+  if (index < 0) return false;
+  Serial.printf("Running scene '%s'\n", name);
+  submitCommand(RUN_BATCH, planFromScene(config.scenes[index]), source);
+  return true;
+}
+
+// Put parked stations to sleep once their window has passed. Waits for an
+// idle engine so the OFF never preempts a command that was just requested.
+void serviceParking() {
+  if (currentCommand != NOTHING || parking.parkedMask() == 0) return;
+  uint8_t expired = parking.expired(millis());
+  if (expired == 0) return;
+  BatchPlan plan;
+  plan.clear();
+  for (int i = 0; i < config.stationCount; i++) {
+    if (expired & (1u << i)) plan.actions[i] = ACTION_OFF;
+  }
+  parking.release(expired);
+  Serial.printf("Parking window over, putting stations 0x%02X to sleep\n", expired);
+  submitCommand(TURN_OFF, plan, SOURCE_PARKING, false);
+}
+
+// Retry stations whose last command failed once their backoff has passed.
+// Stations that reached their desired state are left out, and like parking
+// this waits for an idle engine.
+void serviceReconciler() {
+  if (!config.reconcile || currentCommand != NOTHING || commandPending) return;
+  BatchPlan plan = reconciler.due(config.stationCount, millis());
+  if (plan.empty()) return;
+  Serial.printf("Reconciling stations 0x%02X\n", reconciler.divergedMask(config.stationCount));
+  submitCommand(RUN_BATCH, plan, SOURCE_RECONCILE, false);
+}
+
+class ClientCallbacks : public NimBLEClientCallbacks {
+  void onConnect(NimBLEClient* pClient) {
+    Serial.println("Connected");
+  }
+
+  void onDisconnect(NimBLEClient* pClient) {
+    Serial.print(pClient->getPeerAddress().toString().c_str());
+    Serial.println(" Disconnected - Starting scan");
+  }
+
+  bool onConnParamsUpdateRequest(NimBLEClient* pClient, const ble_gap_upd_params* params) {
+    if (params->itvl_min < 24) {
+      return false;
+    } else if (params->itvl_max > 40) {
+      return false;
+    } else if (params->latency > 2) {
+      return false;
+    } else if (params->supervision_timeout > 100) {
+      return false;
+    }
+    return true;
+  }
+};
+
+static ClientCallbacks clientCB;
+
+// From loop(): a station seen by the scan
+void recordDiscoveredLighthouse(const BleEvent& event) {
+  const DiscoveredStation& station = event.station;
+  NimBLEAddress address(station.address, station.addressType);
+  Serial.printf("%s Lighthouse %s (station %d)%s\n", station.version == 1 ? "V1" : "V2", address.toString().c_str(),
+                station.mappingIndex, event.accepted ? "" : " - not part of this command");
+  if (!event.accepted) return;
+  size_t before = discoveryTable.size();
+  if (!discoveryTable.upsert(station.address, station.addressType, station.version, station.mappingIndex, station.rssi)) {
+    Serial.printf("Discovery table full (%d), ignoring %s\n", MAX_TRACKED_LH, address.toString().c_str());
+  } else if (discoveryTable.size() == before) {
+    Serial.printf("Already known: %s\n", address.toString().c_str());
+  }
+}
+
+static void markScanEnded() {
+  Serial.printf("Scan Ended. Found %u lighthouses (%u repeat adverts, %u dropped, %u lost in handoff)\n",
+                (unsigned)discoveryTable.size(), (unsigned)discoveryTable.duplicates(),
+                (unsigned)discoveryTable.dropped(), (unsigned)bleEvents.dropped());
+  readyToConnect = true;
+}
+
+// From loop(): everything the scan callbacks pushed since the last call
+void serviceBleEvents() {
+  BleEvent event;
+  while (bleEvents.pop(event)) {
+    if (event.kind == BLE_EVENT_STATION) {
+      recordDiscoveredLighthouse(event);
+      continue;
+    }
+    markScanEnded();
+  }
+}
+
+class AdvertisedDeviceCallbacks : public NimBLEAdvertisedDeviceCallbacks {
+  void onResult(NimBLEAdvertisedDevice* advertisedDevice) {
+    const uint8_t* payload = advertisedDevice->getPayload();
+    size_t payloadLen = advertisedDevice->getPayloadLength();
+    const uint8_t* address = advertisedDevice->getAddress().getNative();
+    if (traceCapture.active) {
+      traceCapture.writer.append(esp_timer_get_time() - traceCapture.startedAt, address,
+                                 advertisedDevice->getAddress().getType(), advertisedDevice->getRSSI(), payload,
+                                 payloadLen);
+    }
+
+    // Parsed straight from the payload, nothing is allocated per advert
+    lighthouse::advert::AdvertMatch match =
+        lighthouse::advert::classifyAdvert(payload, payloadLen, address, config, activePlan, lighthouseV2Filtering);
+    if (match.version == 0) return;
+
+    // Copy what loop() needs; the device object is freed by NimBLE as soon as
+    // onResult() returns. The last slot is kept for the end of the scan.
+    BleEvent event = {BLE_EVENT_STATION, match.accept, {}};
+    memcpy(event.station.address, address, sizeof(event.station.address));
+    event.station.addressType = advertisedDevice->getAddress().getType();
+    event.station.version = match.version;
+    event.station.mappingIndex = match.mappingIndex;
+    event.station.rssi = advertisedDevice->getRSSI();
+    if (bleEvents.push(event, 1) && match.accept) wakeLoop(LOOP_EVENT_BLE);
+  }
+};
+
+void deleteAllClients() {
+  // Iterate over a copy, deleteClient() removes entries from the live list
+  std::list<NimBLEClient*> clientList(*NimBLEDevice::getClientList());
+  for (auto client : clientList) {
+    NimBLEDevice::deleteClient(client);
+  }
+}
+
+// Encoder context per station type: V1 frames are precomputed per configured
+// station, V2 needs nothing
+const lighthouse::v1::StationFrames& stationContext(lighthouse::StationTraits<1>, int mappingIndex) {
+  static const lighthouse::v1::StationFrames none;
+  return mappingIndex >= 0 ? lighthouseFrames[mappingIndex] : none;
+}
+
+lighthouse::StationTraits<2>::Context stationContext(lighthouse::StationTraits<2>, int) { return {}; }
+
+// Service discovery and the command write for one connected station; the
+// same ladder for every station type
+template <class Traits>
+bool writeStationCommand(NimBLEClient* pClient, const DiscoveredStation& station, uint8_t action) {
+  std::string peer = pClient->getPeerAddress().toString();
+  typename Traits::Frame frame{};
+  if (!Traits::encode(action, stationContext(Traits{}, station.mappingIndex), frame)) {
+    Serial.printf("❌ No valid %s frame for %s\n", Traits::kName, peer.c_str());
+    return false;
+  }
+
+  int64_t discoveryStarted = esp_timer_get_time();
+  auto discoveryDone = [&](uint8_t outcome) {
+    recordSpan(SPAN_DISCOVERY, discoveryStarted, station.mappingIndex, outcome);
+  };
+  NimBLERemoteService* pSvc = pClient->getService(serviceUuid<Traits>());
+  if (!pSvc) {
+    Serial.printf("❌ %s Service not found for %s\n", Traits::kName, peer.c_str());
+    discoveryDone(OUTCOME_WRITE_FAILED);
+    return false;
+  }
+  NimBLERemoteCharacteristic* pChr = pSvc->getCharacteristic(characteristicUuid<Traits>());
+  if (!pChr) {
+    Serial.printf("❌ %s Characteristic not found for %s\n", Traits::kName, peer.c_str());
+    discoveryDone(OUTCOME_WRITE_FAILED);
+    return false;
+  }
+  if (!pChr->canWrite()) {
+    Serial.printf("❌ %s Characteristic not writable for %s\n", Traits::kName, peer.c_str());
+    discoveryDone(OUTCOME_WRITE_FAILED);
+    return false;
+  }
+
+  // Read the power state first where the protocol has one; a station that is
+  // already there needs no write
+  if (Traits::kReadable && pChr->canRead()) {
+    auto value = pChr->readValue();
+    lighthouse::PowerState state = Traits::decode(reinterpret_cast<const uint8_t*>(value.data()), value.size());
+    if (lighthouse::stateSatisfies(state, action)) {
+      Serial.printf("✅ %s %s already %s\n", Traits::kName, peer.c_str(), lighthouse::powerStateName(state));
+      engine.writesSkipped++;
+      discoveryDone(OUTCOME_OK);
+      return true;
+    }
+  }
+  discoveryDone(OUTCOME_OK);
+
+  // Debug: Print command bytes
+  Serial.printf("Sending %s %s command:", Traits::kName, stationActionName(action));
+  for (size_t j = 0; j < Traits::kFrameSize; j++) {
+    Serial.printf(" %02X", frame[j]);
+  }
+  Serial.println();
+
+  int64_t writeStarted = esp_timer_get_time();
+  bool written = pChr->writeValue(frame.data(), Traits::kFrameSize);
+  recordSpan(SPAN_WRITE, writeStarted, station.mappingIndex, written ? OUTCOME_OK : OUTCOME_WRITE_FAILED);
+  if (!written) {
+    Serial.printf("❌ Failed to send %s command to %s\n", Traits::kName, peer.c_str());
+    return false;
+  }
+  Serial.printf("✅ Sent %s command to %s\n", Traits::kName, peer.c_str());
+  return true;
+}
+
+bool writeStationCommand(NimBLEClient* pClient, const DiscoveredStation& station, uint8_t action) {
+  bool success = false;
+  bool known = lighthouse::SupportedStations::dispatch(station.version, [&](auto traits) {
+    success = writeStationCommand<decltype(traits)>(pClient, station, action);
+  });
+  if (!known) {
+    Serial.printf("❌ Unknown station version %u\n", station.version);
+  }
+  return success;
+}
+
+// NimBLE 1.4 GATT calls (service and characteristic discovery, read, write)
+// have no timeout of their own: on a live link a station that stops
+// answering holds them until the 30 s ATT timeout. This one-shot timer
+// disconnects the client when the station's time is up. The host then fails
+// the pending procedure and the blocked call returns, at the latest when the
+// 510 ms supervision timeout ends the link. The client is only deleted at
+// the next wave or scan, long after the timer is disarmed.
+static esp_timer_handle_t gattWatchdog = nullptr;
+static std::atomic<NimBLEClient*> gattWatchdogClient{nullptr};
+
+static void onGattWatchdog(void*) {
+  NimBLEClient* client = gattWatchdogClient.exchange(nullptr);
+  if (client != nullptr) client->disconnect();
+}
+
+void armGattWatchdog(NimBLEClient* client, int64_t deadline) {
+  if (gattWatchdog == nullptr) {
+    esp_timer_create_args_t args = {};
+    args.callback = onGattWatchdog;
+    args.name = "gatt_watchdog";
+    if (esp_timer_create(&args, &gattWatchdog) != ESP_OK) return;
+  }
+  gattWatchdogClient = client;
+  esp_timer_start_once(gattWatchdog, max(deadline - esp_timer_get_time(), (int64_t)1));
+}
+
+// True if the timer fired and cut the station off
+bool disarmGattWatchdog() {
+  if (gattWatchdog != nullptr) esp_timer_stop(gattWatchdog);
+  return gattWatchdogClient.exchange(nullptr) == nullptr;
+}
+
+// Connect to a station, reusing a client from this wave if there is one.
+// Blocks for at most timeoutS seconds.
+NimBLEClient* connectStation(const NimBLEAddress& stationAddress, uint32_t timeoutS) {
+  NimBLEClient* pClient = NimBLEDevice::getClientByPeerAddress(stationAddress);
+  if (!pClient) {
+    if (NimBLEDevice::getClientListSize() >= NIMBLE_MAX_CONNECTIONS) {
+      Serial.println("Max clients reached - Unable to create client");
+      return nullptr;
+    }
+    pClient = NimBLEDevice::createClient();
+    pClient->setClientCallbacks(&clientCB, false);
+    pClient->setConnectionParams(12, 12, 0, 51);
+  }
+  pClient->setConnectTimeout(timeoutS);
+  if (pClient->isConnected() || pClient->connect(stationAddress, false)) {
+    return pClient;
+  }
+  NimBLEDevice::deleteClient(pClient);
+  return nullptr;
+}
+
+// True once every configured station the plan targets has been discovered.
+// Plans that include unconfigured V2 stations always scan to the end.
+bool allTargetsDiscovered() {
+  if (activePlan.unmappedAction != ACTION_NONE) return false;
+  for (int i = 0; i < config.stationCount; i++) {
+    if (activePlan.actions[i] == ACTION_NONE) continue;
+    bool found = false;
+    for (size_t j = 0; j < discoveryTable.size() && !found; j++) {
+      found = discoveryTable[j].mappingIndex == i;
+    }
+    if (!found) return false;
+  }
+  return true;
+}
+
+void recordStationOutcome(const DiscoveredStation& station, uint8_t outcome) {
+  if (station.mappingIndex >= 0) {
+    cycleReport.stations[station.mappingIndex].outcome = outcome;
+  } else if (outcome == OUTCOME_OK) {
+    cycleReport.unmappedOk++;
+  } else {
+    cycleReport.unmappedFailed++;
+  }
+}
+
+// A cycle that ran to its end (not preempted) gives every target an outcome:
+// stations left over were either never found or ran out of time
+void finalizeCycleReport() {
+  for (size_t j = engine.station; j < discoveryTable.size(); j++) {
+    if (discoveryTable[j].mappingIndex < 0 && activePlan.unmappedAction != ACTION_NONE) {
+      recordStationOutcome(discoveryTable[j], OUTCOME_TIMED_OUT);
+    }
+  }
+  for (int i = 0; i < config.stationCount; i++) {
+    StationResult& result = cycleReport.stations[i];
+    if (activePlan.actions[i] == ACTION_NONE || result.outcome != OUTCOME_PENDING) continue;
+    result.action = activePlan.actions[i];
+    result.outcome = OUTCOME_NOT_FOUND;
+    for (size_t j = 0; j < discoveryTable.size(); j++) {
+      if (discoveryTable[j].mappingIndex == i) result.outcome = OUTCOME_TIMED_OUT;
+    }
+  }
+}
+
+// Remember what a station was switched to; MQTT publishes it retained
+void setStationPower(int index, uint8_t action) {
+  if (index < 0 || index >= CONFIG_MAX_STATIONS || stationPower[index] == action) return;
+  stationPower[index] = action;
+  publishStationState(index);
+}
+
+// What the cycle confirmed or failed to do, for the reconciler and the
+// journal. Stations a preempted cycle did not reach carry over into the next
+// one instead.
+void reconcileCycleReport() {
+  uint32_t now = millis();
+  for (int i = 0; i < config.stationCount; i++) {
+    const StationResult& result = cycleReport.stations[i];
+    if (result.outcome != OUTCOME_PENDING) journalEvent(EVENT_STATION, i, packStationResult(result));
+    if (result.outcome == OUTCOME_OK) {
+      reconciler.observe(i, result.action);
+    } else if (result.outcome != OUTCOME_PENDING) {
+      reconciler.failed(i, result.action, now);
+    }
+  }
+}
+
+void completeCommand(const char* outcome) {
+  uint32_t elapsedMs = (esp_timer_get_time() - engine.startedAt) / 1000;
+  engine.lastMs = elapsedMs;
+  engine.maxMs = max(engine.maxMs, elapsedMs);
+  Serial.printf("Command %s after %u ms (deadline %u ms)\n", outcome, elapsedMs, (unsigned)config.commandDeadlineMs);
+
+  if (!cycleReport.preempted) finalizeCycleReport();
+  reconcileCycleReport();
+  recordSpan(SPAN_CYCLE, engine.startedAt, -1,
+             (engine.success ? CYCLE_SUCCESS : 0) | (cycleReport.preempted ? CYCLE_PREEMPTED : 0));
+  spans.cycleFinished(engine.cycles, cycleReport.preempted);
+  journalEvent(EVENT_CYCLE, (engine.success ? CYCLE_SUCCESS : 0) | (cycleReport.preempted ? CYCLE_PREEMPTED : 0),
+               packCycle(elapsedMs, cycleReport.unmappedOk, cycleReport.unmappedFailed));
+  mqttCycleDone(cycleReport);
+  udpCycleDone(cycleReport);
+
+  if (activePlan.includes(ACTION_ON)) {
+    presenceWakeCompleted(engine.success);
+  }
+
+  if (engine.success) {
+    Serial.println("Commands sent successfully");
+    
+  } else {
+    Serial.println("Some commands failed");
+  }
+  
+  engine.phase = PHASE_IDLE;
+  markBootPhase(bootTimeline.firstCommandDoneMs, "First command done");
+  finishCommandCycle();
+  // Blink without blocking; a queued command that just started takes the LED
+  if (currentCommand == NOTHING) {
+    if (engine.success) {
+      startLedPattern(2, 500); // Success: 2 slow blinks
+    } else {
+      startLedPattern(5, 100); // Error: 5 fast blinks
+    }
+  }
+}
+
+// One step of the running command per call: ending the scan, or one connect
+// attempt plus write. Every step is bounded by what is left of the command's
+// deadline, so loop() keeps servicing the network and buttons in between and
+// a conflicting newer command can take over at the next step.
+void serviceCommandEngine() {
+  int64_t now = esp_timer_get_time();
+
+  if (engine.phase == PHASE_SCAN) {
+    if (readyToConnect) {
+      readyToConnect = false;
+      cycleReport.scanMs = (now - engine.startedAt) / 1000;
+      recordSpan(SPAN_SCAN, engine.startedAt, -1, discoveryTable.size() > 0 ? OUTCOME_OK : OUTCOME_NOT_FOUND);
+      Serial.printf("Scan took %u ms\n", cycleReport.scanMs);
+      deleteAllClients();
+      if (engine.preempt) {
+        engine.preemptions++;
+        cycleReport.preempted = true;
+        completeCommand("preempted");
+      } else if (discoveryTable.size() == 0) {
+        Serial.println("No lighthouses found!");
+        engine.success = false;
+        completeCommand("failed");
+      } else {
+        engine.phase = PHASE_STATIONS;
+      }
+    } else if (engine.preempt || now >= engine.scanDeadline || allTargetsDiscovered()) {
+      // stop() calls scanEndedCB() on this task, so the end is marked here.
+      // Adverts the host task pushed before the cancel are taken first; if
+      // the scan timed out just before, its own end event is among them.
+      scanStoppedByLoop = true;
+      NimBLEDevice::getScan()->stop();
+      serviceBleEvents();
+      if (!readyToConnect) markScanEnded();
+    }
+    return;
+  }
+
+  if (engine.phase == PHASE_BACKOFF) {
+    if (now < engine.backoffUntil && !engine.preempt) return;
+    recordSpan(SPAN_BACKOFF, engine.backoffUntil - ENGINE_RETRY_BACKOFF_US,
+               discoveryTable[engine.station].mappingIndex, OUTCOME_PENDING, engine.attempt);
+    engine.phase = PHASE_STATIONS;
+  }
+
+  // PHASE_STATIONS
+  int count = discoveryTable.size();
+  if (engine.preempt) {
+    engine.preemptions++;
+    cycleReport.preempted = true;
+    completeCommand("preempted");
+    return;
+  }
+  if (engine.station >= count) {
+    completeCommand(engine.success ? "done" : "failed");
+    return;
+  }
+
+  int64_t remaining = engine.deadline - now;
+  if (remaining < 1000000 + ENGINE_WRITE_RESERVE_US) {
+    // Not even a minimum connect attempt fits, the rest of the stations fail
+    Serial.printf("❌ Deadline reached, %d lighthouses not switched\n", count - engine.station);
+    engine.timeouts++;
+    engine.success = false;
+    completeCommand("timed out");
+    return;
+  }
+
+  const DiscoveredStation& station = discoveryTable[engine.station];
+  NimBLEAddress stationAddress(station.address, station.addressType);
+
+  // Stations are processed in waves sized to the connection budget; the
+  // previous wave's clients are released before the next one starts.
+  if (engine.station % NIMBLE_MAX_CONNECTIONS == 0 && engine.attempt == 0) {
+    if (engine.station > 0) {
+      deleteAllClients();
+    }
+    Serial.printf("Starting wave %d: lighthouses %d-%d of %d\n", engine.station / NIMBLE_MAX_CONNECTIONS + 1,
+                  engine.station + 1, min(engine.station + NIMBLE_MAX_CONNECTIONS, count), count);
+  }
+
+  // Split what is left evenly over the remaining stations. Connect timeouts
+  // have one second resolution; a station may borrow up to one second from
+  // later ones, but never beyond the command's deadline.
+  int64_t share = remaining / (count - engine.station) - ENGINE_WRITE_RESERVE_US;
+  uint32_t timeoutS = constrain((uint32_t)(share / 1000000), 1u, 5u);
+
+  // Connections are made one at a time, so the default power applies to this one
+  uint8_t txLevel = txPower.levelFor(station.mappingIndex, station.rssi, config.adaptiveTxPower);
+  NimBLEDevice::setPower((esp_power_level_t)txLevel);
+
+  Serial.printf("Connection attempt %d/%d for %s (%u s, %+d dBm)\n", engine.attempt + 1, ENGINE_CONNECT_ATTEMPTS,
+                stationAddress.toString().c_str(), timeoutS, kTxPowerDbm[txLevel]);
+  int64_t connectStarted = esp_timer_get_time();
+  NimBLEClient* pClient = connectStation(stationAddress, timeoutS);
+  int64_t connectEnded = esp_timer_get_time();
+  txPower.recordConnect(station.mappingIndex, pClient != nullptr);
+  spans.record(SPAN_CONNECT, engine.cycles, (uint32_t)connectStarted, (uint32_t)connectEnded, station.mappingIndex,
+               pClient ? OUTCOME_OK : OUTCOME_CONNECT_FAILED, engine.attempt + 1);
+  uint8_t action = activePlan.actionFor(station.mappingIndex);
+  StationResult* result = station.mappingIndex >= 0 ? &cycleReport.stations[station.mappingIndex] : nullptr;
+  if (result) {
+    result->action = action;
+    result->attempts++;
+    result->connectMs += (connectEnded - connectStarted) / 1000;
+  }
+  if (!pClient) {
+    engine.attempt++;
+    if (engine.attempt < ENGINE_CONNECT_ATTEMPTS) {
+      Serial.println("Connection failed, retrying...");
+      engine.backoffUntil = esp_timer_get_time() + ENGINE_RETRY_BACKOFF_US;
+      engine.phase = PHASE_BACKOFF;
+      return;
+    }
+    Serial.printf("Failed to connect after %d attempts to %s\n", ENGINE_CONNECT_ATTEMPTS,
+                  stationAddress.toString().c_str());
+    engine.success = false;
+    recordStationOutcome(station, OUTCOME_CONNECT_FAILED);
+  } else {
+    Serial.print("Connected to: ");
+    Serial.println(pClient->getPeerAddress().toString().c_str());
+    Serial.printf("Processing lighthouse %d/%d\n", engine.station + 1, count);
+    // Discovery and write get what is left of the station's share, at least
+    // the write reserve, never past the command's deadline
+    int64_t gattDeadline = min(engine.deadline, max(connectStarted + share + ENGINE_WRITE_RESERVE_US,
+                                                    connectEnded + ENGINE_WRITE_RESERVE_US));
+    armGattWatchdog(pClient, gattDeadline);
+    bool written = writeStationCommand(pClient, station, action);
+    if (disarmGattWatchdog()) {
+      Serial.printf("❌ %s did not answer in time, disconnected\n", stationAddress.toString().c_str());
+      engine.gattAborts++;
+      written = false;
+    }
+    if (result) result->writeMs = (esp_timer_get_time() - connectEnded) / 1000;
+    if (written) {
+      if (station.mappingIndex >= 0) {
+        engine.doneMask |= 1u << station.mappingIndex;
+        setStationPower(station.mappingIndex, action);
+      }
+    } else {
+      engine.success = false;
+    }
+    recordStationOutcome(station, written ? OUTCOME_OK : OUTCOME_WRITE_FAILED);
+  }
+  engine.station++;
+  engine.attempt = 0;
+}
+
+// Only one per scan and the ring is drained before each scan starts, so this
+// always finds the slot station events leave free. Pushes only from the host
+// task after a natural timeout; a stop() from loop() marks the end itself.
+void scanEndedCB(NimBLEScanResults results) {
+  if (scanStoppedByLoop) return;
+  BleEvent event = {BLE_EVENT_SCAN_ENDED, false, {}};
+  bleEvents.push(event);
+  wakeLoop(LOOP_EVENT_BLE);
+}
+
+static AdvertisedDeviceCallbacks advertisedDeviceCallbacks;
+
+void bleEnsureStarted() {
+  if (bleStarted) return;
+
+  Serial.println("Initializing BLE...");
+  NimBLEDevice::init("");
+  NimBLEDevice::setPower(ESP_PWR_LVL_P9); /** +9db */
+  // Scan requests stay at full power, connects lower the default per station
+  NimBLEDevice::setPower(ESP_PWR_LVL_P9, ESP_BLE_PWR_TYPE_SCAN);
+
+  NimBLEScan* pScan = NimBLEDevice::getScan();
+  pScan->setAdvertisedDeviceCallbacks(&advertisedDeviceCallbacks, false);
+  pScan->setInterval(1349);
+  pScan->setWindow(449);
+  pScan->setActiveScan(true);
+  pScan->setMaxResults(0); // Adverts are copied into discoveryTable, don't keep NimBLE's copies
+
+  bleStarted = true;
+  powerStats.bleStartedAt = esp_timer_get_time();
+  powerStats.bleStarts++;
+}
+
+// Power the controller down between commands (low-power mode only)
+void bleShutdown() {
+  if (!bleStarted) return;
+
+  deleteAllClients();
+  NimBLEDevice::deinit(true);
+  bleStarted = false;
+  powerStats.bleOnUs += esp_timer_get_time() - powerStats.bleStartedAt;
+  Serial.println("BLE powered down");
+}
+
+// Return to idle after a scan/connect cycle, or go straight into the next
+// one if commands were queued meanwhile
+void finishCommandCycle() {
+  currentCommand = NOTHING;
+  activePlan.clear();
+  digitalWrite(ledPin, LOW);
+  
+  // Cleanup
+  deleteAllClients();
+  if (commandPending) {
+    // Everything queued meanwhile runs as one batch, BLE stays up for it
+    commandPending = false;
+    startScanAndSetCommand(RUN_BATCH, pendingPlan);
+  } else if (config.tuning.lowPower) {
+    bleShutdown();
+  }
+}
+
+// From loop(): the running command, or the end of a trace capture
+void serviceCommands() {
+  serviceBleEvents();
+  if (currentCommand == CAPTURE_TRACE) {
+    if (readyToConnect) {
+      readyToConnect = false;
+      traceCapture.active = false;
+      Serial.printf("Trace captured: %u adverts, %u bytes, %u dropped\n", traceCapture.writer.records(),
+                    (unsigned)traceCapture.writer.size(), traceCapture.writer.dropped());
+      finishCommandCycle();
+      if (currentCommand == NOTHING) {
+        startLedPattern(2, 500);
+      }
+    }
+  } else if (currentCommand != NOTHING) {
+    serviceCommandEngine();
+  }
+}
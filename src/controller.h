@@ -0,0 +1,462 @@
+/** State and hooks shared by the firmware components.
+ *
+ * The portable core (protocols, plans, configuration layout, codecs) is the
+ * header-only lighthouse_core library in lib/. The firmware around it is
+ * split into components, each of which can be left out at build time:
+ *
+ *   main.cpp        setup/loop, buttons, LED, power, config store, WiFi
+ *   ble_engine.cpp  command queue and the scan/connect/write engine
+ *   web_ui.cpp      web interface and /api/v1 (LH_WITH_WEB)
+ *   mqtt_link.cpp   MQTT commands, state and results (LH_WITH_MQTT)
+ *   udp_link.cpp    binary UDP control port (LH_WITH_UDP)
+ *   presence.cpp    VR PC presence pre-wake (LH_WITH_PRESENCE)
+ *   journal.cpp     event journal in flash, /api/v1/events (LH_WITH_JOURNAL)
+ *
+ * Everything network-facing needs LH_WITH_WIFI; -DLH_WITH_WIFI=0 builds the
+ * button-only controller without the WiFi stack. Calls from one component
+ * into another go through the hooks below, which turn into inline no-ops
+ * when their component is left out.
+ */
+#pragma once
+
+#ifndef LH_WITH_WIFI
+#define LH_WITH_WIFI 1
+#endif
+#ifndef LH_WITH_WEB
+#define LH_WITH_WEB LH_WITH_WIFI
+#endif
+#ifndef LH_WITH_MQTT
+#define LH_WITH_MQTT LH_WITH_WIFI
+#endif
+#ifndef LH_WITH_UDP
+#define LH_WITH_UDP LH_WITH_WIFI
+#endif
+#ifndef LH_WITH_PRESENCE
+#define LH_WITH_PRESENCE LH_WITH_WIFI
+#endif
+#ifndef LH_WITH_JOURNAL
+#define LH_WITH_JOURNAL LH_WITH_WEB
+#endif
+
+#if !LH_WITH_WIFI && (LH_WITH_WEB || LH_WITH_MQTT || LH_WITH_UDP || LH_WITH_PRESENCE)
+#error "The web UI, MQTT, UDP control and presence need LH_WITH_WIFI"
+#endif
+#if LH_WITH_JOURNAL && !LH_WITH_WEB
+#error "The event journal is read through the web API and needs LH_WITH_WEB"
+#endif
+
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 5
+#define NIMBLE_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#if LH_WITH_WIFI
+#include <WiFi.h>
+#endif
+#if LH_WITH_UDP || LH_WITH_PRESENCE
+#include <lwip/sockets.h>
+#endif
+
+#include "advert_trace.h"
+#include "batch_plan.h"
+#include "command_results.h"
+#include "command_spans.h"
+#include "config_store.h"
+#include "discovery_table.h"
+#include "event_journal.h"
+#include "power_reconciler.h"
+#include "standby_parking.h"
+#include "tx_power.h"
+#if LH_WITH_MQTT
+#include "mqtt_client.h"
+#include "mqtt_outbox.h"
+#include "tls_transport.h"
+#endif
+#if LH_WITH_PRESENCE
+#include "presence_tracker.h"
+#endif
+#if LH_WITH_UDP
+#include "udp_control.h"
+#endif
+#if LH_WITH_JOURNAL
+#include <LittleFS.h>
+#endif
+
+// main.cpp: configuration, telemetry, LED and power
+
+extern const uint8_t ledPin;
+extern const bool lighthouseV2Filtering;
+
+// Everything that survives a reboot (see config_store.h)
+extern ControllerConfig config;
+
+struct ConfigStoreState {
+  bool dirty;
+  unsigned long firstChange;
+  unsigned long lastChange;
+  uint32_t writes;
+  bool migrated;  // Built from the old per-key layout at boot
+};
+extern ConfigStoreState configStore;
+
+void configMarkDirty();
+
+struct HeapStats {
+  uint32_t freeBytes;
+  uint32_t minFreeBytes;
+  uint32_t largestBlock;
+  uint32_t minLargestBlock;
+  uint32_t shedEvents;
+  uint32_t journaledMinFree;  // Minimum free heap last recorded in the journal
+  bool shedding;
+  unsigned long lastSample;
+};
+extern HeapStats heapStats;
+
+// millis() at which each boot phase was first reached, 0 = not yet
+struct BootTimeline {
+  uint32_t bleReadyMs;
+  uint32_t wifiConnectedMs;
+  uint32_t webReadyMs;
+  uint32_t mqttConnectedMs;
+  uint32_t firstCommandMs;
+  uint32_t firstCommandDoneMs;
+};
+extern BootTimeline bootTimeline;
+extern uint32_t wifiReconnects;
+
+void markBootPhase(uint32_t& phase, const char* name);
+
+// Non-blocking blink pattern for indications that must not stall loop()
+struct LedPattern {
+  uint8_t togglesLeft;
+  uint16_t intervalMs;
+  unsigned long lastToggle;
+};
+extern LedPattern ledPattern;
+
+void startLedPattern(uint8_t times, uint16_t intervalMs);
+
+#define LOW_POWER_MIN_LATENCY_MS 20
+#define LOW_POWER_MAX_LATENCY_MS 1000
+
+// Residency counters, esp_timer microseconds
+struct PowerStats {
+  int64_t since;
+  int64_t idleUs;
+  int64_t bleOnUs;
+  int64_t bleStartedAt;
+  uint32_t bleStarts;
+  bool lightSleep;
+};
+extern PowerStats powerStats;
+extern bool bleStarted;
+
+void applyPowerMode();
+
+// loop() blocks on an event group between passes. Anything that happens
+// outside the loop task (button interrupts, BLE callbacks) sets its bit so it
+// is handled at once instead of at the next tick.
+#define LOOP_EVENT_BUTTON 0x01
+#define LOOP_EVENT_BLE 0x02
+#define LOOP_EVENTS_ALL (LOOP_EVENT_BUTTON | LOOP_EVENT_BLE)
+
+void wakeLoop(uint32_t events);
+
+struct LoopStats {
+  uint32_t wakes;       // Passes that ended an idle wait
+  uint32_t eventWakes;  // ... ended by an event rather than the tick
+  // Button edge (interrupt) to command submission, long presses excluded
+  uint32_t inputs;
+  uint32_t lastInputUs;
+  uint32_t maxInputUs;
+  uint64_t totalInputUs;
+};
+extern LoopStats loopStats;
+uint32_t buttonEdges();
+
+// Presence settings are part of the stored configuration in every build
+#define PRESENCE_DEFAULT_PORT 27036  // Steam client, listening whenever Steam runs
+#define PRESENCE_DEFAULT_GRACE_S 600
+#define PRESENCE_GRACE_MAX_S 14400
+
+// ble_engine.cpp: commands and the BLE engine
+
+enum { NOTHING = 0, TURN_ON_PERM = 1, TURN_OFF = 2, RUN_BATCH = 3, CAPTURE_TRACE = 4, TURN_STANDBY = 5 };
+
+// Stations remembered per scan. This is independent of the connection limit:
+// commands are sent in waves of at most NIMBLE_MAX_CONNECTIONS stations.
+#ifndef MAX_TRACKED_LH
+#define MAX_TRACKED_LH 32
+#endif
+
+extern DiscoveryTable<MAX_TRACKED_LH> discoveryTable;
+
+// Raw advert capture for replay on a host (tools/trace_replay). The buffer
+// is only allocated while a trace is being captured or waiting for download.
+#ifndef TRACE_BUFFER_BYTES
+#define TRACE_BUFFER_BYTES 16384
+#endif
+#define TRACE_MAX_SECONDS 60
+
+struct TraceCapture {
+  bool active;
+  int64_t startedAt;
+  uint8_t* buffer;
+  AdvertTraceWriter writer;
+};
+extern TraceCapture traceCapture;
+
+extern uint8_t currentCommand;
+extern BatchPlan activePlan;
+extern BatchPlan pendingPlan;
+extern bool commandPending;
+
+// Last power state switched per configured station
+extern uint8_t stationPower[CONFIG_MAX_STATIONS];
+extern StandbyParking parking;
+extern PowerReconciler reconciler;
+extern TxPowerPolicy txPower;
+
+// Each command must finish within config.commandDeadlineMs
+#define COMMAND_DEADLINE_DEFAULT_MS 15000
+#define COMMAND_DEADLINE_MIN_MS 3000
+#define COMMAND_DEADLINE_MAX_MS 60000
+
+enum EnginePhase : uint8_t { PHASE_IDLE, PHASE_SCAN, PHASE_STATIONS, PHASE_BACKOFF };
+
+struct CommandEngine {
+  uint8_t phase;
+  int64_t startedAt;
+  int64_t deadline;
+  int64_t scanDeadline;
+  int64_t backoffUntil;
+  int station;       // Next discoveryTable entry
+  uint8_t attempt;
+  bool success;
+  bool preempt;      // A conflicting command is waiting, stop at the next step
+  uint8_t doneMask;  // Configured stations switched so far
+  uint32_t cycles;   // Cycles started since boot, numbers CycleReport
+  // Statistics for /api/v1/status
+  uint32_t lastMs;
+  uint32_t maxMs;
+  uint32_t timeouts;
+  uint32_t preemptions;
+  uint32_t writesSkipped;  // Read back as already switched
+  uint32_t gattAborts;     // Stations disconnected for overrunning their share
+};
+extern CommandEngine engine;
+
+// Per-station outcome and timings of the running cycle
+extern CycleReport cycleReport;
+
+// Per-phase timing of recent commands, /api/v1/traces
+extern SpanRecorder spans;
+
+// At each command entry point, before the request is parsed. Buttons pass
+// the time of the interrupt.
+void beginCommandTrace();
+void beginCommandTrace(uint32_t receivedUs);
+
+bool submitCommand(uint8_t command, const BatchPlan& request, uint8_t source, bool parkable = true);
+bool runScene(const char* name, uint8_t source);
+void startTraceCapture(uint32_t seconds);
+void precomputeLighthouseFrames();
+void serviceParking();
+void serviceReconciler();
+void serviceCommands();
+void bleEnsureStarted();
+void bleShutdown();
+
+// web_ui.cpp
+
+#if LH_WITH_WEB
+void setupWebServer();
+void startWebServer();
+void serviceWebServer();
+#else
+inline void setupWebServer() {}
+inline void startWebServer() {}
+inline void serviceWebServer() {}
+#endif
+
+// mqtt_link.cpp
+
+#if LH_WITH_MQTT
+#define MQTT_TOPIC_LEN (sizeof(config.mqtt.topic) + 24)
+
+// Full topic strings, rebuilt only when the base topic or stations change
+struct MqttTopics {
+  char command[MQTT_TOPIC_LEN];
+  char batch[MQTT_TOPIC_LEN];
+  char scene[MQTT_TOPIC_LEN];
+  char presence[MQTT_TOPIC_LEN];
+  char availability[MQTT_TOPIC_LEN];
+  char result[MQTT_TOPIC_LEN];
+  char lighthouseCommand[CONFIG_MAX_STATIONS][MQTT_TOPIC_LEN];
+  char lighthouseStatus[CONFIG_MAX_STATIONS][MQTT_TOPIC_LEN];
+  char lighthouseName[CONFIG_MAX_STATIONS][MQTT_TOPIC_LEN];
+};
+
+// Connect timing, to compare reconnects with and without TLS session
+// resumption. Times run from the start of connectMqtt().
+struct MqttConnectStats {
+  uint32_t attempts;
+  uint32_t connects;          // CONNACK received
+  uint32_t sessionsPresent;   // The broker still had our subscriptions
+  uint32_t resubscribesSkipped;
+  uint32_t lastTransportMs;   // Name lookup, TCP connect and TLS handshake
+  uint32_t lastConnackMs;
+  bool lastResumed;           // TLS session resumed on the last connect
+  uint32_t fullCount, fullTotalMs;        // Attempt to CONNACK, full handshake or plain TCP
+  uint32_t resumedCount, resumedTotalMs;  // Attempt to CONNACK, TLS session resumed
+};
+
+extern TlsTransport mqttTransport;
+extern MqttClient<TlsTransport> mqttClient;
+extern MqttOutbox mqttOutbox;
+extern MqttTopics mqttTopics;
+extern CommandTracker commandTracker;
+extern MqttConnectStats mqttConnectStats;
+
+bool connectMqtt();
+void buildMqttTopics();
+void setupMqtt();
+void serviceMqtt(unsigned long now);
+bool mqttBusy();
+void mqttNetworkUp(unsigned long now);
+void mqttStationsChanged();
+void mqttSettingsChanged();
+void mqttReconnectNow();
+bool setMqttCaCert(const char* pem);
+size_t loadMqttCaCert(char* pem, size_t size);
+bool saveMqttCaCert(const char* pem);
+uint32_t loadMqttSubscribedCrc();
+bool saveMqttSubscribedCrc(uint32_t crc);
+void mqttCycleDone(const CycleReport& report);
+void abandonCommandResults();
+void publishStationState(int index);
+void publishMqttNames();
+#else
+inline void setupMqtt() {}
+inline void serviceMqtt(unsigned long) {}
+inline bool mqttBusy() { return false; }
+inline void mqttNetworkUp(unsigned long) {}
+inline void mqttStationsChanged() {}
+inline void mqttCycleDone(const CycleReport&) {}
+inline void abandonCommandResults() {}
+inline void publishStationState(int) {}
+inline void publishMqttNames() {}
+#endif
+
+// udp_link.cpp
+
+#if LH_WITH_UDP
+#define UDP_STREAMS_MAX 4
+
+struct UdpStream {
+  bool active;
+  struct sockaddr_in peer;
+  uint16_t seq;
+  uint32_t firstCycle;  // Engine cycle the command runs in, see submitCommand()
+  unsigned long receivedAt;
+  uint8_t targets;
+  uint8_t switched;  // Outcomes collected from finished cycles
+  uint8_t failed;
+  uint8_t sentPhase;  // Last status sent, to send only changes
+  uint8_t sentSwitched;
+  uint8_t sentFailed;
+};
+
+struct UdpControl {
+  int fd;
+  uint16_t boundPort;
+  UdpSequenceGuard sequence;  // Keyed requests only
+  // Last request, so a retransmission gets the same ack again
+  struct sockaddr_in lastPeer;
+  uint16_t lastSeq;
+  uint8_t lastAck;
+  bool lastValid;
+  UdpStream streams[UDP_STREAMS_MAX];
+  uint32_t received;
+  uint32_t commands;
+  uint32_t pings;
+  uint32_t rejected;
+  uint32_t repeats;
+};
+extern UdpControl udpControl;
+
+void serviceUdpControl();
+void udpCycleDone(const CycleReport& report);
+bool loadUdpSequenceMark(UdpSequenceMark& mark);
+bool saveUdpSequenceMark(const UdpSequenceMark& mark);
+#else
+inline void serviceUdpControl() {}
+inline void udpCycleDone(const CycleReport&) {}
+#endif
+
+// presence.cpp
+
+#if LH_WITH_PRESENCE
+struct PresenceProbe {
+  int fd;
+  unsigned long startedAt;
+  unsigned long lastStarted;
+  uint32_t probes;
+};
+
+extern PresenceTracker presence;
+extern PresenceProbe presenceProbe;
+
+void servicePresence();
+void presenceWakeCompleted(bool success);
+#else
+inline void servicePresence() {}
+inline void presenceWakeCompleted(bool) {}
+#endif
+
+// journal.cpp
+
+#if LH_WITH_JOURNAL
+struct JournalState {
+  bool mounted;
+  unsigned long pendingSince;  // millis() when the oldest record not in flash was added
+  uint32_t writtenSeq;         // Next sequence number the flash files expect
+  uint32_t flushes;
+  uint32_t writeErrors;
+};
+
+extern EventTail eventTail;
+extern JournalState journalState;
+
+// Reads the journal oldest first, from flash and then from the tail, one
+// small block at a time
+class JournalCursor {
+ public:
+  explicit JournalCursor(uint32_t fromSeq);
+  ~JournalCursor() { file_.close(); }
+  bool next(EventRecord& record);
+
+ private:
+  bool refill();
+
+  bool openSegment();
+
+  uint32_t seq_;      // Lowest sequence number still wanted
+  int segment_;       // Flash segment being read
+  int segmentsLeft_;  // Including segment_, 0 = reading the tail
+  File file_;
+  EventRecord buffer_[8];
+  uint8_t buffered_ = 0;
+  uint8_t pos_ = 0;
+  bool fromFlash_ = false;
+};
+
+void setupJournal();
+void serviceJournal(unsigned long now);
+void journalEvent(uint8_t type, uint8_t arg, uint32_t value);
+#else
+inline void setupJournal() {}
+inline void serviceJournal(unsigned long) {}
+inline void journalEvent(uint8_t, uint8_t, uint32_t) {}
+#endif
@@ -0,0 +1,159 @@
+/** Event journal component (LH_WITH_JOURNAL), see controller.h.
+ */
+#include "controller.h"
+
+#if LH_WITH_JOURNAL
+
+#include <esp_system.h>
+
+// Flash is written once this many records wait, or once the oldest has
+// waited this long; a crash in between loses nothing, the tail is in RTC memory
+#define JOURNAL_FLUSH_RECORDS (EVENT_TAIL_RECORDS / 2)
+#define JOURNAL_FLUSH_INTERVAL_MS 60000
+
+// The newest records, kept across a crash or soft reset (see event_journal.h)
+RTC_NOINIT_ATTR EventTail eventTail;
+
+JournalState journalState = {};
+
+void journalPath(char* path, size_t size, int segment) { snprintf(path, size, "/journal%d.bin", segment); }
+
+// Last whole record of a segment file. Returns the file size, 0 if missing.
+size_t readLastRecord(int segment, EventRecord& record) {
+  char path[20];
+  journalPath(path, sizeof(path), segment);
+  File file = LittleFS.open(path, "r");
+  if (!file) return 0;
+  size_t size = file.size();
+  size_t whole = size - size % sizeof(EventRecord);
+  bool valid = whole >= sizeof(EventRecord) && file.seek(whole - sizeof(EventRecord)) &&
+               file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record) &&
+               record.type != 0 && journalSegment(record.seq) == segment;
+  file.close();
+  return valid ? size : 0;
+}
+
+void journalEvent(uint8_t type, uint8_t arg, uint32_t value) {
+  if (eventTail.unflushed() == 0) journalState.pendingSince = millis();
+  eventTail.append(type, arg, value, millis());
+}
+
+// Copy everything not yet in flash, one write per segment touched
+void flushJournal() {
+  if (!journalState.mounted) return;
+  while (eventTail.unflushed() > 0) {
+    uint32_t seq = eventTail.flushedSeq;
+    uint32_t run = eventTail.nextFlushRun();
+    char path[20];
+    journalPath(path, sizeof(path), journalSegment(seq));
+    // The first record of a new lap replaces the segment's old contents
+    bool sameLap = journalState.writtenSeq > 0 &&
+                   (journalState.writtenSeq - 1) / JOURNAL_SEGMENT_RECORDS == seq / JOURNAL_SEGMENT_RECORDS;
+    File file = LittleFS.open(path, sameLap ? "a" : "w");
+    size_t bytes = run * sizeof(EventRecord);
+    bool written = file && file.write(reinterpret_cast<const uint8_t*>(&eventTail.at(seq)), bytes) == bytes;
+    file.close();
+    if (!written) {
+      journalState.writeErrors++;
+      Serial.printf("❌ Journal write to %s failed\n", path);
+      return;
+    }
+    eventTail.flushedSeq += run;
+    journalState.writtenSeq = seq + run;
+    journalState.flushes++;
+  }
+}
+
+// Early in setup(): pick up where the flash files and RTC memory left off,
+// then record the boot itself
+void setupJournal() {
+  uint32_t recovered = eventTail.restore();
+  journalState.mounted = LittleFS.begin(false);
+  uint32_t flashNextSeq = 0;
+  uint16_t lastBoot = 0;
+  if (journalState.mounted) {
+    for (int i = 0; i < JOURNAL_SEGMENTS; i++) {
+      EventRecord last;
+      size_t size = readLastRecord(i, last);
+      if (size == 0 || last.seq < flashNextSeq) continue;
+      flashNextSeq = last.seq + 1;
+      lastBoot = last.boot;
+      // A write torn by a reset leaves a partial record; appending after it
+      // would misalign the segment, so continue in the next one
+      if (size % sizeof(EventRecord) != 0) {
+        flashNextSeq += JOURNAL_SEGMENT_RECORDS - flashNextSeq % JOURNAL_SEGMENT_RECORDS;
+      }
+    }
+  } else {
+    Serial.println("❌ LittleFS mount failed - events are only kept in RTC memory");
+  }
+  journalState.writtenSeq = flashNextSeq;
+  eventTail.resume(flashNextSeq, lastBoot);
+  journalEvent(EVENT_BOOT, (uint8_t)esp_reset_reason(), recovered);
+  Serial.printf("Journal: boot %u, next event %u, %u recovered from RTC memory\n", eventTail.boot,
+                (unsigned)eventTail.nextSeq, (unsigned)recovered);
+  if (recovered > 0) flushJournal();
+}
+
+void serviceJournal(unsigned long now) {
+  uint32_t waiting = eventTail.unflushed();
+  if (waiting >= JOURNAL_FLUSH_RECORDS || (waiting > 0 && now - journalState.pendingSince >= JOURNAL_FLUSH_INTERVAL_MS)) {
+    flushJournal();
+  }
+}
+
+JournalCursor::JournalCursor(uint32_t fromSeq) : seq_(fromSeq), segment_(0), segmentsLeft_(0) {
+  if (!journalState.mounted || journalState.writtenSeq == 0 || seq_ >= journalState.writtenSeq) return;
+  // Oldest segment first: the one after the segment written last
+  segment_ = (journalSegment(journalState.writtenSeq - 1) + 1) % JOURNAL_SEGMENTS;
+  segmentsLeft_ = JOURNAL_SEGMENTS;
+}
+
+// Open segment_ unless all of it is older than what is wanted
+bool JournalCursor::openSegment() {
+  EventRecord last;
+  if (readLastRecord(segment_, last) == 0 || last.seq < seq_) return false;
+  char path[20];
+  journalPath(path, sizeof(path), segment_);
+  file_ = LittleFS.open(path, "r");
+  return (bool)file_;
+}
+
+// Next block of records: more of the open segment, the next segment, or
+// finally the records that are only in the tail
+bool JournalCursor::refill() {
+  pos_ = buffered_ = 0;
+  while (segmentsLeft_ > 0) {
+    if (file_ || openSegment()) {
+      int len = file_.read(reinterpret_cast<uint8_t*>(buffer_), sizeof(buffer_));
+      if (len >= (int)sizeof(EventRecord)) {
+        buffered_ = len / sizeof(EventRecord);
+        fromFlash_ = true;
+        return true;
+      }
+      file_.close();
+    }
+    segment_ = (segment_ + 1) % JOURNAL_SEGMENTS;
+    segmentsLeft_--;
+  }
+
+  fromFlash_ = false;
+  uint32_t seq = seq_ > eventTail.firstSeq ? seq_ : eventTail.firstSeq;
+  while (seq < eventTail.nextSeq && buffered_ < sizeof(buffer_) / sizeof(buffer_[0])) {
+    buffer_[buffered_++] = eventTail.at(seq++);
+  }
+  return buffered_ > 0;
+}
+
+bool JournalCursor::next(EventRecord& record) {
+  while (pos_ < buffered_ || refill()) {
+    record = buffer_[pos_++];
+    if (record.type == 0 || record.seq < seq_) continue;
+    if (fromFlash_ && journalSegment(record.seq) != segment_) continue;
+    seq_ = record.seq + 1;
+    return true;
+  }
+  return false;
+}
+
+#endif  // LH_WITH_JOURNAL
@@ -8,21 +8,25 @@
  *
  */
 
-#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 5
-#define NIMBLE_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#include "controller.h"
 
-#include <Arduino.h>
-#include <NimBLEDevice.h>
 #include "JC_Button.h"
-#include <WiFi.h>
-#include <WebServer.h>
-#include <PubSubClient.h>
 #include <Preferences.h>
+#include <esp_heap_caps.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <freertos/event_groups.h>
+
+#include "lighthouse_protocol.h"
+#include "udp_control.h"
 
 // For Version 1 (HTC) Base Stations:
 
-// You can place up to CONFIG_BT_NIMBLE_MAX_CONNECTIONS amount of IDs here.
-// (ESP32 max is 9) Find this on the back of your Base Station. Technically you
+// You can place as many IDs here as you like; stations beyond the connection
+// limit (CONFIG_BT_NIMBLE_MAX_CONNECTIONS, ESP32 max is 9) are handled in
+// successive waves. Find this on the back of your Base Station. Technically you
 // only need to enter the B station ID, but C will look around for B for a while
 // before shutting down, so I personally put both in :) This is required to turn
 // the Base Station off immediately, and as such, this app is configured so if
@@ -30,39 +34,19 @@
 // My Base Stations for example: "7F35E5C5", "034996AB"  
 // Based on your .ini file: 0x3BBF1347, 0x6BC162BD, etc.
 // Mapping: Advertised Name -> Full 8-character ID 
+// These are the defaults for the first boot. After that the stations, like
+// their names, are part of the stored configuration (see /api/v1/station).
 struct LighthouseMapping {
   const char* advertisedId;    // Last part of "HTC BS XXXXXX"
   const char* fullId;          // Full 8-character ID for commands
+  const char* name;            // Custom name (can be changed via web interface)
 };
 
 const LighthouseMapping lighthouseMappings[] = {
-  {"C21347", "3BBF1347"},  // HTC BS C21347 -> 0x3BBF1347 from .ini (Master B)
-  {"F862BD", "6BC162BD"}   // HTC BS F862BD -> 0x6BC162BD from .ini (Master B)
+  {"C21347", "3BBF1347", "Room 1 Master (C21347)"},  // HTC BS C21347 -> 0x3BBF1347 from .ini (Master B)
+  {"F862BD", "6BC162BD", "Room 2 Master (F862BD)"}   // HTC BS F862BD -> 0x6BC162BD from .ini (Master B)
 };
 
-// Custom names for each lighthouse (can be changed via web interface)
-String lighthouseNames[] = {"Room 1 Master (C21347)", "Room 2 Master (F862BD)"};
-
-// Helper function to get full ID from advertised ID
-const char* getFullIdFromAdvertised(const char* advertisedId) {
-  for (int i = 0; i < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0]); i++) {
-    if (strcmp(advertisedId, lighthouseMappings[i].advertisedId) == 0) {
-      return lighthouseMappings[i].fullId;
-    }
-  }
-  return nullptr;
-}
-
-// Helper function to get mapping index from advertised ID
-int getMappingIndexFromAdvertised(const char* advertisedId) {
-  for (int i = 0; i < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0]); i++) {
-    if (strcmp(advertisedId, lighthouseMappings[i].advertisedId) == 0) {
-      return i;
-    }
-  }
-  return -1;
-}
-
 // For Version 2.0 Base Stations:
 
 // You can have the app just turn on/off every 2.0 Base Station it finds by
@@ -72,786 +56,500 @@ int getMappingIndexFromAdvertised(const char* advertisedId) {
 const bool lighthouseV2Filtering = false;
 // Enter the full MAC Address of your desired Base Stations below
 // You can find this with NRF Connect or a similar app on your smartphone
-// Example: lighthouseLHBMACs[] = {NimBLEAddress("D3:EA:E4:A4:58:DF")};
+// Example: lighthouseV2MACs[] = {"D3:EA:E4:A4:58:DF"};
+// Like the V1 mappings, these seed the stored configuration on first boot.
 
-static NimBLEAddress lighthouseV2MACs[] = {};
+static const char* lighthouseV2MACs[] = {};
 
 // Connect an LED to this pin to get info on if there was an issue during the
 // command (if an error does happen, just try it again a couple times) Just a
 // couple slow-ish blinks: Success Many fast blinks: Error, try again
 const uint8_t ledPin = 25;
 
-Button offButton(32);  // define the pin for button (pull to ground to activate)
+const uint8_t offButtonPin = 32;
+const uint8_t onButtonPin = 33;
+
+#define BUTTON_DEBOUNCE_MS 25
+
+Button offButton(offButtonPin, BUTTON_DEBOUNCE_MS);  // define the pin for button (pull to ground to activate)
 
-Button onButton(33);  // define the pin for button (pull to ground to activate)
+Button onButton(onButtonPin, BUTTON_DEBOUNCE_MS);  // define the pin for button (pull to ground to activate)
 
+#if LH_WITH_WIFI
 const char* ssid = "Oben";        // TODO: set your WiFi SSID
 const char* password = "06385538"; // TODO: set your WiFi password
+#endif
 
-WebServer server(80);
-
-// MQTT Configuration
-WiFiClient wifiClient;
-PubSubClient mqttClient(wifiClient);
 Preferences preferences;
 
-// MQTT Settings (will be loaded from preferences)
-String mqttServer = "";
-int mqttPort = 1883;
-String mqttUsername = "";
-String mqttPassword = "";
-String mqttTopic = "lighthouse";
-bool mqttEnabled = false;
-unsigned long lastMqttReconnectAttempt = 0;
-
-// The remote service we wish to connect to.
-static NimBLEUUID serviceUUIDHTC("0000cb00-0000-1000-8000-00805f9b34fb");
-// The characteristic of the remote service we are interested in.
-static NimBLEUUID characteristicUUIDHTC("0000cb01-0000-1000-8000-00805f9b34fb");
-
-static NimBLEUUID serviceUUIDV2("00001523-1212-efde-1523-785feabcd124");
-static NimBLEUUID characteristicUUIDV2("00001525-1212-efde-1523-785feabcd124");
-
-enum { NOTHING = 0, TURN_ON_PERM = 1, TURN_OFF = 2 };
-
-#define MAX_DISCOVERABLE_LH CONFIG_BT_NIMBLE_MAX_CONNECTIONS
-
-static NimBLEAdvertisedDevice* discoveredLighthouses[MAX_DISCOVERABLE_LH];
-
-uint8_t discoveredLighthouseVersions[MAX_DISCOVERABLE_LH];
-
-// Store the lighthouse ID index for each discovered lighthouse
-int discoveredLighthouseIds[MAX_DISCOVERABLE_LH];
-
-uint8_t currentCommand = NOTHING;
-
-int lighthouseCount = 0;
-
-int targetLighthouseIndex = -1; // -1 means all lighthouses, 0+ means specific lighthouse
+// Everything that survives a reboot - stations, names, MQTT settings and
+// tuning - lives in this one struct, stored as a single NVS blob (see
+// config_store.h). Changes call configMarkDirty(); serviceConfigStore() writes
+// the blob once edits have been quiet for CONFIG_SAVE_DEBOUNCE_MS, so HTTP
+// handlers never wait on flash and bursts of edits cost one write.
+ControllerConfig config;
+
+#define CONFIG_NAMESPACE "lighthouse"
+#define CONFIG_BLOB_KEY "config"
+#define MQTT_CA_KEY "mqtt_ca"  // PEM, too big for the blob
+#define MQTT_SUBSCRIBED_KEY "mqtt_subs"  // Changes with the broker session, kept out of the blob
+#define UDP_SEQUENCE_KEY "udp_seq"  // Changes with every UDP command, kept out of the blob
+#define CONFIG_SAVE_DEBOUNCE_MS 2000
+#define CONFIG_SAVE_MAX_DELAY_MS 10000
+#define DEFAULT_SCAN_TIME_S 5 /** 0 = scan forever. In seconds */
+
+ConfigStoreState configStore = {};
+
+// Heap watermarks, sampled from loop(). While free heap or the largest free
+// block is below its threshold we shed load: HTML pages answer 503 and
+// non-essential MQTT publishes are skipped. BLE commands keep working.
+#define HEAP_SAMPLE_INTERVAL_MS 1000
+#define HEAP_SHED_FREE_BYTES 24576
+#define HEAP_SHED_BLOCK_BYTES 8192
+#define HEAP_RECOVER_MARGIN_PCT 25
+#define HEAP_LOW_EVENT_STEP 4096  // Journal a new minimum once it is this much lower
+
+HeapStats heapStats = {0, 0, 0, UINT32_MAX, 0, 0, false, 0};
+
+// Bring-up is staged: LED, buttons and BLE are ready straight out of setup(),
+// WiFi, the web server and MQTT come up from loop() in the background and
+// reconnect on their own.
+uint32_t wifiReconnects = 0;
+#if LH_WITH_WIFI
+#define WIFI_RETRY_INTERVAL_MS 15000
+
+enum NetworkState { NET_CONNECTING, NET_ONLINE };
+NetworkState networkState = NET_CONNECTING;
+unsigned long wifiAttemptStarted = 0;
+#endif
+
+BootTimeline bootTimeline = {};
+
+void markBootPhase(uint32_t& phase, const char* name) {
+  if (phase != 0) return;
+  phase = millis();
+  Serial.printf("[boot] %s at %u ms\n", name, phase);
+}
 
-void scanEndedCB(NimBLEScanResults results);
+LedPattern ledPattern = {0, 0, 0};
+
+// Low-power mode: WiFi max modem sleep, automatic light sleep when the core
+// supports it (a lower CPU clock otherwise), wakeup on the button GPIOs, and
+// the BLE stack only powered while a command runs. config.tuning.maxCommandLatencyMs bounds
+// how long loop() idles between socket polls, i.e. the added HTTP/MQTT/UDP
+// latency. Buttons and BLE wake it through loopEvents in either mode.
+#ifndef LH_LOW_POWER_DEFAULT
+#define LH_LOW_POWER_DEFAULT false
+#endif
+#define LOW_POWER_DEFAULT_LATENCY_MS 100
+#define ACTIVE_LOOP_DELAY_MS 10
+#define IDLE_LOOP_TICK_MS 1000  // Without WiFi: heap samples, config saves, parking, retries
+
+bool bleStarted = false;
+PowerStats powerStats = {};
+
+EventGroupHandle_t loopEvents = nullptr;
+LoopStats loopStats = {};
+
+// Scenes the buttons run when they exist, otherwise all on / all off. Holding
+// OFF for BUTTON_LONG_PRESS_MS sends everything to standby instead.
+#define BUTTON_ON_SCENE "button-on"
+#define BUTTON_OFF_SCENE "button-off"
+#define BUTTON_STANDBY_SCENE "button-standby"
+#define BUTTON_LONG_PRESS_MS 1000
+
+bool offButtonHeld = false;  // Long press already handled, ignore the release
+
+// Button edges, from the GPIO interrupt. Only the pin's interrupt writes the
+// volatile fields, loop() only reads them.
+struct ButtonInput {
+  gpio_num_t pin;
+  volatile uint32_t lastEdgeUs;
+  volatile uint32_t burstStartUs;  // First edge after BUTTON_DEBOUNCE_MS of quiet
+  volatile uint32_t edges;
+};
+ButtonInput offInput = {(gpio_num_t)offButtonPin, 0, 0, 0};
+ButtonInput onInput = {(gpio_num_t)onButtonPin, 0, 0, 0};
 
-// MQTT function declarations
-bool connectMqtt();
-void loadMqttConfig();
-void saveMqttConfig();
-void publishMqttStatus();
-void handleMqttConfig();
-void handleMqttSave();
+uint32_t buttonEdges() { return offInput.edges + onInput.edges; }
 
-// Function to create lighthouse command with proper structure
-void makeLighthouseCommand(uint8_t* buffer, uint8_t cmdId, uint16_t timeout, const char* uniqueId) {
-  // Clear buffer
-  memset(buffer, 0, 20);
-  
-  // Header
-  buffer[0] = 0x12;
-  
-  // Command ID (0x00 = wake, 0x02 = sleep)
-  buffer[1] = cmdId;
-  
-  // Timeout (2 bytes, big endian)
-  buffer[2] = (timeout >> 8) & 0xFF;
-  buffer[3] = timeout & 0xFF;
-  
-  // Convert unique ID from hex string to 4 bytes (little endian)
-  uint32_t id = strtoul(uniqueId, NULL, 16);
-  buffer[4] = id & 0xFF;
-  buffer[5] = (id >> 8) & 0xFF;
-  buffer[6] = (id >> 16) & 0xFF;
-  buffer[7] = (id >> 24) & 0xFF;
-  
-  // Remaining 12 bytes are already zero from memset
+void wakeLoop(uint32_t events) {
+  if (loopEvents != nullptr) xEventGroupSetBits(loopEvents, events);
 }
 
-static bool readyToConnect = false;
-static uint32_t scanTime = 5; /** 0 = scan forever. In seconds */
-
-void startScanAndSetCommand(uint8_t command) {
-  digitalWrite(ledPin, HIGH);
-  lighthouseCount = 0;
-  for (uint8_t i = 0; i < MAX_DISCOVERABLE_LH; i++) {
-    discoveredLighthouses[i] = nullptr;
-    discoveredLighthouseVersions[i] = 0;
-    discoveredLighthouseIds[i] = -1;
-  }
-  NimBLEDevice::getScan()->start(scanTime, scanEndedCB);
-  currentCommand = command;
+// The interrupt waits for the level opposite to the current one and is
+// flipped on every edge. Light sleep can only wake on a level, so the same
+// setting doubles as the wakeup source in low-power mode.
+gpio_int_type_t nextButtonLevel(gpio_num_t pin) {
+  return gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
 }
 
-void handleRoot() {
-  String html = "<html><head><title>Lighthouse Controller</title>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1'>";
-  html += "<meta charset='UTF-8'>";
-  html += "<style>";
-  html += "body { font-family: Arial, sans-serif; margin: 20px; background-color: #f5f5f5; }";
-  html += ".container { max-width: 800px; margin: 0 auto; }";
-  html += ".lighthouse { border: 1px solid #ddd; margin: 10px 0; padding: 15px; border-radius: 8px; background-color: white; box-shadow: 0 2px 4px rgba(0,0,0,0.1); }";
-  html += ".lighthouse h3 { margin-top: 0; color: #333; border-bottom: 1px solid #eee; padding-bottom: 10px; }";
-  html += ".button { font-size: 14px; padding: 8px 15px; margin: 5px; border: none; border-radius: 4px; cursor: pointer; text-decoration: none; display: inline-block; }";
-  html += ".on-btn { background-color: #4CAF50; color: white; }";
-  html += ".off-btn { background-color: #f44336; color: white; }";
-  html += ".edit-btn { background-color: #2196F3; color: white; }";
-  html += ".save-btn { background-color: #FF9800; color: white; }";
-  html += ".on-btn:hover { background-color: #45a049; }";
-  html += ".off-btn:hover { background-color: #da190b; }";
-  html += ".edit-btn:hover { background-color: #1976D2; }";
-  html += ".save-btn:hover { background-color: #F57C00; }";
-  html += ".status { font-weight: bold; margin: 15px 0; padding: 10px; background-color: #e3f2fd; border-radius: 4px; }";
-  html += ".lighthouse-id { font-size: 12px; color: #666; margin: 5px 0; }";
-  html += ".name-input { padding: 5px; margin: 5px; border: 1px solid #ccc; border-radius: 3px; }";
-  html += ".controls { margin-top: 10px; }";
-  html += "h1 { text-align: center; color: #333; }";
-  html += ".discovery-info { text-align: center; margin: 20px 0; font-weight: bold; }";
-  html += "</style></head><body>";
-  
-  html += "<div class='container'>";
-  html += "<h1>SteamVR Lighthouse Controller</h1>";
-  
-  // Status section
-  html += "<div class='status'>Status: ";
-  if (currentCommand == NOTHING) {
-    html += "Ready";
-  } else if (currentCommand == TURN_ON_PERM) {
-    html += "Turning ON...";
-  } else if (currentCommand == TURN_OFF) {
-    html += "Turning OFF...";
-  }
-  html += "</div>";
-  
-  // All lighthouses control
-  html += "<div class='lighthouse'>";
-  html += "<h3>All Lighthouses</h3>";
-  html += "<div class='controls'>";
-  html += "<a href='/on'><button class='button on-btn'>Turn All ON</button></a>";
-  html += "<a href='/off'><button class='button off-btn'>Turn All OFF</button></a>";
-  html += "</div>";
-  html += "</div>";
-  
-  // Individual lighthouse controls
-  for (int i = 0; i < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0]); i++) {
-    html += "<div class='lighthouse'>";
-    html += "<h3>" + lighthouseNames[i] + "</h3>";
-    html += "<div class='lighthouse-id'>ID: " + String(lighthouseMappings[i].advertisedId) + "</div>";
-    
-    html += "<div class='controls'>";
-    html += "<a href='/on?id=" + String(i) + "'><button class='button on-btn'>Turn ON</button></a>";
-    html += "<a href='/off?id=" + String(i) + "'><button class='button off-btn'>Turn OFF</button></a>";
-    html += "<button class='button edit-btn' onclick='editName(" + String(i) + ")'>Rename</button>";
-    html += "</div>";
-    
-    // Hidden rename form
-    html += "<div id='rename-" + String(i) + "' style='display:none; margin-top:10px;'>";
-    html += "<input type='text' id='name-" + String(i) + "' class='name-input' value='" + lighthouseNames[i] + "' placeholder='Enter new name'>";
-    html += "<button class='button save-btn' onclick='saveName(" + String(i) + ")'>Save</button>";
-    html += "<button class='button off-btn' onclick='cancelEdit(" + String(i) + ")'>Cancel</button>";
-    html += "</div>";
-    
-    html += "</div>";
-  }
-  
-  html += "<div class='discovery-info'>Discovered Lighthouses: " + String(lighthouseCount) + "</div>";
-  
-  // MQTT status and configuration link
-  html += "<div style='text-align: center; margin: 20px 0;'>";
-  html += "<strong>MQTT Status:</strong> ";
-  if (mqttEnabled) {
-    html += "<span style='color: " + String(mqttClient.connected() ? "green" : "red") + "'>";
-    html += mqttClient.connected() ? "Connected" : "Disconnected";
-    html += "</span>";
-  } else {
-    html += "<span style='color: gray'>Disabled</span>";
-  }
-  html += " | <a href='/mqtt' class='button edit-btn'>Configure MQTT</a>";
-  html += "</div>";
-  
-  // JavaScript for rename functionality
-  html += "<script>";
-  html += "function editName(id) {";
-  html += "  document.getElementById('rename-' + id).style.display = 'block';";
-  html += "}";
-  html += "function cancelEdit(id) {";
-  html += "  document.getElementById('rename-' + id).style.display = 'none';";
-  html += "}";
-  html += "function saveName(id) {";
-  html += "  var newName = document.getElementById('name-' + id).value;";
-  html += "  if (newName.trim() !== '') {";
-  html += "    window.location.href = '/rename?id=' + id + '&name=' + encodeURIComponent(newName);";
-  html += "  }";
-  html += "}";
-  html += "</script>";
-  
-  html += "</div></body></html>";
-  server.send(200, "text/html", html);
+// Not IRAM_ATTR: the ISR service is installed without ESP_INTR_FLAG_IRAM, so
+// the handler is not called while the flash cache is off, and
+// gpio_get_level()/gpio_set_intr_type() do not live in IRAM anyway.
+void onButtonEdge(void* arg) {
+  ButtonInput& input = *static_cast<ButtonInput*>(arg);
+  gpio_set_intr_type(input.pin, nextButtonLevel(input.pin));
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  if (now - input.lastEdgeUs > BUTTON_DEBOUNCE_MS * 1000) input.burstStartUs = now;
+  input.lastEdgeUs = now;
+  input.edges++;
+  BaseType_t woken = pdFALSE;
+  xEventGroupSetBitsFromISR(loopEvents, LOOP_EVENT_BUTTON, &woken);
+  portYIELD_FROM_ISR(woken);
 }
 
-void handleOn() {
-  if (currentCommand == NOTHING) {
-    String targetId = server.arg("id");
-    if (targetId.length() > 0) {
-      // Individual lighthouse control
-      int lighthouseIndex = targetId.toInt();
-      if (lighthouseIndex >= 0 && lighthouseIndex < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0])) {
-        targetLighthouseIndex = lighthouseIndex;
-        startScanAndSetCommand(TURN_ON_PERM);
-        server.send(200, "text/html", "<html><body><h1>Turning ON Lighthouse " + String(lighthouseMappings[lighthouseIndex].advertisedId) + "...</h1><p><a href='/'>Back</a></p></body></html>");
-      } else {
-        server.send(400, "text/html", "<html><body><h1>Invalid lighthouse index</h1><p><a href='/'>Back</a></p></body></html>");
-      }
-    } else {
-      // All lighthouses control
-      targetLighthouseIndex = -1; // -1 means all lighthouses
-      startScanAndSetCommand(TURN_ON_PERM);
-      server.send(200, "text/html", "<html><body><h1>Turning ON All Lighthouses...</h1><p><a href='/'>Back</a></p></body></html>");
-    }
+void armButton(ButtonInput& input) {
+  if (config.tuning.lowPower) {
+    gpio_wakeup_enable(input.pin, nextButtonLevel(input.pin));
   } else {
-    server.send(200, "text/html", "<html><body><h1>Command already in progress</h1><p><a href='/'>Back</a></p></body></html>");
+    gpio_wakeup_disable(input.pin);
+    gpio_set_intr_type(input.pin, nextButtonLevel(input.pin));
   }
 }
 
-void handleOff() {
-  if (currentCommand == NOTHING) {
-    String targetId = server.arg("id");
-    if (targetId.length() > 0) {
-      // Individual lighthouse control
-      int lighthouseIndex = targetId.toInt();
-      if (lighthouseIndex >= 0 && lighthouseIndex < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0])) {
-        targetLighthouseIndex = lighthouseIndex;
-        startScanAndSetCommand(TURN_OFF);
-        server.send(200, "text/html", "<html><body><h1>Turning OFF Lighthouse " + String(lighthouseMappings[lighthouseIndex].advertisedId) + "...</h1><p><a href='/'>Back</a></p></body></html>");
-      } else {
-        server.send(400, "text/html", "<html><body><h1>Invalid lighthouse index</h1><p><a href='/'>Back</a></p></body></html>");
-      }
-    } else {
-      // All lighthouses control
-      targetLighthouseIndex = -1; // -1 means all lighthouses
-      startScanAndSetCommand(TURN_OFF);
-      server.send(200, "text/html", "<html><body><h1>Turning OFF All Lighthouses...</h1><p><a href='/'>Back</a></p></body></html>");
-    }
-  } else {
-    server.send(200, "text/html", "<html><body><h1>Command already in progress</h1><p><a href='/'>Back</a></p></body></html>");
+void setupButtons() {
+  offButton.begin();
+  onButton.begin();
+  gpio_install_isr_service(0);  // Already installed is fine
+  for (ButtonInput* input : {&offInput, &onInput}) {
+    gpio_isr_handler_add(input->pin, onButtonEdge, input);
+    armButton(*input);
+    gpio_intr_enable(input->pin);
   }
 }
 
-void handleRename() {
-  String targetId = server.arg("id");
-  String newName = server.arg("name");
-  
-  if (targetId.length() > 0 && newName.length() > 0) {
-    int lighthouseIndex = targetId.toInt();
-    if (lighthouseIndex >= 0 && lighthouseIndex < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0])) {
-      // Limit name length and sanitize
-      newName = newName.substring(0, 20); // Max 20 characters
-      lighthouseNames[lighthouseIndex] = newName;
-      
-      // Redirect back to main page
-      server.sendHeader("Location", "/");
-      server.send(302, "text/plain", "");
-    } else {
-      server.send(400, "text/html", "<html><body><h1>Invalid lighthouse index</h1><p><a href='/'>Back</a></p></body></html>");
-    }
-  } else {
-    server.send(400, "text/html", "<html><body><h1>Missing parameters</h1><p><a href='/'>Back</a></p></body></html>");
-  }
+void applyPowerMode() {
+#if LH_WITH_WIFI
+  // WiFi keeps associated in modem sleep and wakes for beacons/traffic
+  WiFi.setSleep(config.tuning.lowPower ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+#endif
+
+#if CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pmConfig = {};
+  pmConfig.max_freq_mhz = 240;
+  pmConfig.min_freq_mhz = config.tuning.lowPower ? 80 : 240;
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  pmConfig.light_sleep_enable = config.tuning.lowPower;
+#endif
+  powerStats.lightSleep = esp_pm_configure(&pmConfig) == ESP_OK && pmConfig.light_sleep_enable;
+#else
+  // No power management in this core build: at least drop the clock
+  setCpuFrequencyMhz(config.tuning.lowPower ? 80 : 240);
+  powerStats.lightSleep = false;
+#endif
+
+  // The button interrupts wake the chip from light sleep (see armButton())
+  armButton(offInput);
+  armButton(onInput);
+  if (config.tuning.lowPower) esp_sleep_enable_gpio_wakeup();
+
+  if (!config.tuning.lowPower) {
+    bleEnsureStarted();
+  } else if (currentCommand == NOTHING) {
+    bleShutdown();
+  }
+
+  Serial.printf("Power mode: %s (latency bound %u ms, light sleep %s)\n", config.tuning.lowPower ? "low power" : "normal",
+                config.tuning.maxCommandLatencyMs, powerStats.lightSleep ? "on" : "off");
 }
 
-void handleMqttConfig() {
-  String html = "<html><head><title>MQTT Configuration</title>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1'>";
-  html += "<style>";
-  html += "body { font-family: Arial, sans-serif; margin: 20px; background-color: #f5f5f5; }";
-  html += ".container { max-width: 600px; margin: 0 auto; background-color: white; padding: 20px; border-radius: 8px; box-shadow: 0 2px 4px rgba(0,0,0,0.1); }";
-  html += ".form-group { margin-bottom: 15px; }";
-  html += "label { display: block; margin-bottom: 5px; font-weight: bold; }";
-  html += "input[type='text'], input[type='password'], input[type='number'] { width: 100%; padding: 8px; border: 1px solid #ddd; border-radius: 4px; box-sizing: border-box; }";
-  html += "input[type='checkbox'] { margin-right: 8px; }";
-  html += ".button { background-color: #4CAF50; color: white; padding: 10px 20px; border: none; border-radius: 4px; cursor: pointer; font-size: 16px; margin-right: 10px; }";
-  html += ".button:hover { background-color: #45a049; }";
-  html += ".back-btn { background-color: #6c757d; }";
-  html += ".back-btn:hover { background-color: #5a6268; }";
-  html += "h1 { color: #333; }";
-  html += ".status { margin: 10px 0; padding: 10px; background-color: #e3f2fd; border-radius: 4px; }";
-  html += "</style></head><body>";
-  
-  html += "<div class='container'>";
-  html += "<h1>MQTT Configuration</h1>";
-  
-  // Show current MQTT status
-  html += "<div class='status'>";
-  html += "<strong>Current Status:</strong> ";
-  if (mqttEnabled) {
-    html += mqttClient.connected() ? "Connected" : "Enabled but not connected";
-  } else {
-    html += "Disabled";
-  }
-  html += "</div>";
-  
-  html += "<form method='POST' action='/mqtt-save'>";
-  
-  html += "<div class='form-group'>";
-  html += "<label><input type='checkbox' name='enabled' " + String(mqttEnabled ? "checked" : "") + "> Enable MQTT</label>";
-  html += "</div>";
-  
-  html += "<div class='form-group'>";
-  html += "<label for='server'>MQTT Server:</label>";
-  html += "<input type='text' id='server' name='server' value='" + mqttServer + "' placeholder='192.168.1.100'>";
-  html += "</div>";
-  
-  html += "<div class='form-group'>";
-  html += "<label for='port'>Port:</label>";
-  html += "<input type='number' id='port' name='port' value='" + String(mqttPort) + "' placeholder='1883'>";
-  html += "</div>";
-  
-  html += "<div class='form-group'>";
-  html += "<label for='username'>Username:</label>";
-  html += "<input type='text' id='username' name='username' value='" + mqttUsername + "' placeholder='Optional'>";
-  html += "</div>";
-  
-  html += "<div class='form-group'>";
-  html += "<label for='password'>Password:</label>";
-  html += "<input type='password' id='password' name='password' value='" + mqttPassword + "' placeholder='Optional'>";
-  html += "</div>";
-  
-  html += "<div class='form-group'>";
-  html += "<label for='topic'>Base Topic:</label>";
-  html += "<input type='text' id='topic' name='topic' value='" + mqttTopic + "' placeholder='lighthouse'>";
-  html += "</div>";
-  
-  html += "<div style='margin-top: 20px;'>";
-  html += "<p><strong>MQTT Topics that will be used:</strong></p>";
-  html += "<ul>";
-  html += "<li><code>" + mqttTopic + "/command</code> - Send 'on' or 'off' to control all lighthouses</li>";
-  html += "<li><code>" + mqttTopic + "/lighthouse0/command</code> - Control individual lighthouse</li>";
-  html += "<li><code>" + mqttTopic + "/lighthouse1/command</code> - Control individual lighthouse</li>";
-  html += "<li><code>" + mqttTopic + "/lighthouse0/status</code> - Lighthouse status (published)</li>";
-  html += "<li><code>" + mqttTopic + "/lighthouse0/name</code> - Lighthouse name (published)</li>";
-  html += "</ul>";
-  html += "</div>";
-  
-  html += "<button type='submit' class='button'>Save Configuration</button>";
-  html += "<a href='/' class='button back-btn'>Back to Main</a>";
-  html += "</form>";
-  
-  html += "</div></body></html>";
-  
-  server.send(200, "text/html", html);
-}
+uint32_t msUntil(uint32_t deadline, uint32_t now) { return (int32_t)(deadline - now) > 0 ? deadline - now : 0; }
 
-void handleMqttSave() {
-  mqttEnabled = server.hasArg("enabled");
-  mqttServer = server.arg("server");
-  mqttPort = server.arg("port").toInt();
-  if (mqttPort <= 0) mqttPort = 1883;
-  mqttUsername = server.arg("username");
-  mqttPassword = server.arg("password");
-  mqttTopic = server.arg("topic");
-  if (mqttTopic.length() == 0) mqttTopic = "lighthouse";
-  
-  // Save configuration
-  saveMqttConfig();
-  
-  // Disconnect existing MQTT connection if any
-  if (mqttClient.connected()) {
-    mqttClient.disconnect();
+// The buttons need another look once a bounce has settled (JC_Button ignores
+// changes for BUTTON_DEBOUNCE_MS after accepting one), and when a held OFF
+// button turns into a long press
+uint32_t buttonWaitMs() {
+  uint32_t now = millis();
+  uint32_t waitMs = UINT32_MAX;
+  if ((digitalRead(offButtonPin) == LOW) != offButton.isPressed()) {
+    waitMs = min(waitMs, msUntil(offButton.lastChange() + BUTTON_DEBOUNCE_MS, now));
   }
-  
-  // Try to connect with new settings
-  if (mqttEnabled) {
-    connectMqtt();
+  if ((digitalRead(onButtonPin) == LOW) != onButton.isPressed()) {
+    waitMs = min(waitMs, msUntil(onButton.lastChange() + BUTTON_DEBOUNCE_MS, now));
   }
-  
-  // Redirect back to MQTT config page
-  server.sendHeader("Location", "/mqtt");
-  server.send(302, "text/plain", "");
-}
-
-class ClientCallbacks : public NimBLEClientCallbacks {
-  void onConnect(NimBLEClient* pClient) {
-    Serial.println("Connected");
+  if (offButton.isPressed() && !offButtonHeld) {
+    waitMs = min(waitMs, msUntil(offButton.lastChange() + BUTTON_LONG_PRESS_MS, now));
   }
+  return waitMs;
+}
 
-  void onDisconnect(NimBLEClient* pClient) {
-    Serial.print(pClient->getPeerAddress().toString().c_str());
-    Serial.println(" Disconnected - Starting scan");
-  }
+// Replaces the fixed delay(10): block until an event or the next tick.
+// MqttClient, WebServer and WiFiUDP read non-blocking lwIP sockets, and lwIP
+// has no callback that could set a bit in loopEvents when data arrives. The
+// sockets are only polled, so with WiFi the tick is ACTIVE_LOOP_DELAY_MS, or
+// half the latency budget in low-power mode so the core can sleep. Without
+// WiFi nothing else needs polling and the loop sleeps until something happens.
+void idleWait() {
+  uint32_t waitMs = IDLE_LOOP_TICK_MS;
+#if LH_WITH_WIFI
+  waitMs = config.tuning.lowPower ? max(ACTIVE_LOOP_DELAY_MS, config.tuning.maxCommandLatencyMs / 2)
+                                  : ACTIVE_LOOP_DELAY_MS;
+#endif
+  if (currentCommand != NOTHING || ledPattern.togglesLeft > 0 || mqttBusy()) waitMs = ACTIVE_LOOP_DELAY_MS;
+  waitMs = min(waitMs, buttonWaitMs());
+
+  int64_t start = esp_timer_get_time();
+  EventBits_t events = xEventGroupWaitBits(loopEvents, LOOP_EVENTS_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(waitMs));
+  powerStats.idleUs += esp_timer_get_time() - start;
+  loopStats.wakes++;
+  if (events & LOOP_EVENTS_ALL) loopStats.eventWakes++;
+}
 
-  bool onConnParamsUpdateRequest(NimBLEClient* pClient, const ble_gap_upd_params* params) {
-    if (params->itvl_min < 24) {
-      return false;
-    } else if (params->itvl_max > 40) {
-      return false;
-    } else if (params->latency > 2) {
-      return false;
-    } else if (params->supervision_timeout > 100) {
-      return false;
-    }
-    return true;
-  }
-};
+// A button's scene, or the plain command when the scene does not exist.
+// `edge` is the press or release that triggered it; long presses pass null
+// and are not counted as input latency.
+void runButtonCommand(const char* scene, uint8_t command, StationAction action, const ButtonInput* edge) {
+  uint32_t edgeUs = edge ? edge->burstStartUs : (uint32_t)esp_timer_get_time();
+  beginCommandTrace(edgeUs);
+  if (!runScene(scene, SOURCE_BUTTON)) {
+    submitCommand(command, BatchPlan::all(action, config.stationCount), SOURCE_BUTTON);
+  }
+  if (edge == nullptr) return;
+  uint32_t latencyUs = (uint32_t)esp_timer_get_time() - edgeUs;
+  loopStats.inputs++;
+  loopStats.lastInputUs = latencyUs;
+  loopStats.maxInputUs = max(loopStats.maxInputUs, latencyUs);
+  loopStats.totalInputUs += latencyUs;
+  Serial.printf("Button to command: %u us\n", (unsigned)latencyUs);
+}
 
-static ClientCallbacks clientCB;
+void startLedPattern(uint8_t times, uint16_t intervalMs) {
+  digitalWrite(ledPin, HIGH);
+  ledPattern.togglesLeft = times * 2 - 1;
+  ledPattern.intervalMs = intervalMs;
+  ledPattern.lastToggle = millis();
+}
 
-class AdvertisedDeviceCallbacks : public NimBLEAdvertisedDeviceCallbacks {
-  void onResult(NimBLEAdvertisedDevice* advertisedDevice) {
-    Serial.print("Advertised Device found: ");
-    Serial.println(advertisedDevice->toString().c_str());
+void serviceLedPattern() {
+  if (ledPattern.togglesLeft == 0 || currentCommand != NOTHING) return;
+  unsigned long now = millis();
+  if (now - ledPattern.lastToggle < ledPattern.intervalMs) return;
+  ledPattern.lastToggle = now;
+  ledPattern.togglesLeft--;
+  digitalWrite(ledPin, ledPattern.togglesLeft % 2 ? HIGH : LOW);
+}
 
-    if (lighthouseCount >= MAX_DISCOVERABLE_LH) {
-      return;
+// Heap telemetry and load shedding
+void updateHeapStats() {
+  unsigned long now = millis();
+  if (heapStats.lastSample != 0 && now - heapStats.lastSample < HEAP_SAMPLE_INTERVAL_MS) return;
+  heapStats.lastSample = now;
+
+  heapStats.freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  heapStats.minFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heapStats.largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  if (heapStats.largestBlock < heapStats.minLargestBlock) {
+    heapStats.minLargestBlock = heapStats.largestBlock;
+  }
+  if (heapStats.journaledMinFree == 0) {
+    heapStats.journaledMinFree = heapStats.minFreeBytes;
+  } else if (heapStats.minFreeBytes + HEAP_LOW_EVENT_STEP <= heapStats.journaledMinFree) {
+    heapStats.journaledMinFree = heapStats.minFreeBytes;
+    journalEvent(EVENT_HEAP_LOW, 0, heapStats.minFreeBytes);
+  }
+
+  if (!heapStats.shedding) {
+    if (heapStats.freeBytes < HEAP_SHED_FREE_BYTES || heapStats.largestBlock < HEAP_SHED_BLOCK_BYTES) {
+      heapStats.shedding = true;
+      heapStats.shedEvents++;
+      journalEvent(EVENT_HEAP_LOW, 1, heapStats.freeBytes);
+      Serial.printf("Low heap (%u free, %u largest block) - shedding load\n", heapStats.freeBytes,
+                    heapStats.largestBlock);
     }
+  } else if (heapStats.freeBytes > HEAP_SHED_FREE_BYTES * (100 + HEAP_RECOVER_MARGIN_PCT) / 100 &&
+             heapStats.largestBlock > HEAP_SHED_BLOCK_BYTES * (100 + HEAP_RECOVER_MARGIN_PCT) / 100) {
+    heapStats.shedding = false;
+    Serial.printf("Heap recovered (%u free, %u largest block)\n", heapStats.freeBytes, heapStats.largestBlock);
+  }
+}
 
-    // Check for V1 (HTC) Base Stations
-    if (advertisedDevice->isAdvertisingService(serviceUUIDHTC)) {
-      String advertisedName = advertisedDevice->getName().c_str();
-      Serial.println("=== HTC Base Station Found ===");
-      Serial.printf("Advertised Name: '%s'\n", advertisedName.c_str());
-      Serial.printf("MAC Address: %s\n", advertisedDevice->getAddress().toString().c_str());
-      
-      for (int i = 0; i < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0]); i++) {
-        Serial.printf("Checking against mapping[%d]: advertised='%s', fullId='%s'\n", i, lighthouseMappings[i].advertisedId, lighthouseMappings[i].fullId);
-        if (advertisedName.indexOf(lighthouseMappings[i].advertisedId) >= 0) {
-          // Check if we're targeting a specific lighthouse
-          if (targetLighthouseIndex >= 0 && targetLighthouseIndex != i) {
-            Serial.printf("Skipping - not target lighthouse (want %d, this is %d)\n", targetLighthouseIndex, i);
-            continue; // Skip this lighthouse if we're not targeting it
-          }
-          
-          Serial.printf("✅ MATCH! Found V1 Lighthouse: %s (Full ID: %s)\n", advertisedName.c_str(), lighthouseMappings[i].fullId);
-          discoveredLighthouses[lighthouseCount] = advertisedDevice;
-          discoveredLighthouseVersions[lighthouseCount] = 1;
-          discoveredLighthouseIds[lighthouseCount] = i; // Store the mapping index
-          lighthouseCount++;
-          break;
-        }
-      }
-      Serial.println("===============================");
+// Defaults for a fresh device: the compiled-in stations and MQTT disabled
+void seedDefaultConfig() {
+  memset(&config, 0, sizeof(config));
+  for (int i = 0; i < sizeof(lighthouseMappings) / sizeof(lighthouseMappings[0]) && config.stationCount < CONFIG_MAX_STATIONS; i++) {
+    StationConfig& station = config.stations[config.stationCount];
+    station.version = 1;
+    strlcpy(station.advertisedId, lighthouseMappings[i].advertisedId, sizeof(station.advertisedId));
+    station.uniqueId = lighthouse::v1::uniqueId(lighthouseMappings[i].fullId);
+    strlcpy(station.name, lighthouseMappings[i].name, sizeof(station.name));
+    if (station.uniqueId == 0) {
+      Serial.printf("Invalid lighthouse ID '%s' in mapping %d\n", lighthouseMappings[i].fullId, i);
+      continue;
     }
-    // Check for V2 Base Stations
-    else if (advertisedDevice->isAdvertisingService(serviceUUIDV2)) {
-      bool shouldAdd = true;
-      
-      if (lighthouseV2Filtering) {
-        shouldAdd = false;
-        for (int i = 0; i < sizeof(lighthouseV2MACs) / sizeof(lighthouseV2MACs[0]); i++) {
-          if (advertisedDevice->getAddress().equals(lighthouseV2MACs[i])) {
-            shouldAdd = true;
-            break;
-          }
-        }
-      }
-      
-      if (shouldAdd) {
-        Serial.printf("Found V2 Lighthouse: %s\n", advertisedDevice->getAddress().toString().c_str());
-        discoveredLighthouses[lighthouseCount] = advertisedDevice;
-        discoveredLighthouseVersions[lighthouseCount] = 2;
-        discoveredLighthouseIds[lighthouseCount] = -1; // V2 doesn't need ID index
-        lighthouseCount++;
-      }
+    config.stationCount++;
+  }
+  for (int i = 0; i < sizeof(lighthouseV2MACs) / sizeof(lighthouseV2MACs[0]) && config.stationCount < CONFIG_MAX_STATIONS; i++) {
+    StationConfig& station = config.stations[config.stationCount];
+    station.version = 2;
+    if (!parseMacAddress(lighthouseV2MACs[i], station.mac)) {
+      Serial.printf("Invalid V2 MAC address '%s'\n", lighthouseV2MACs[i]);
+      continue;
     }
-  }
-};
-
-bool sendLighthouseCommands() {
-  // Clean up existing clients
-  auto clientList = NimBLEDevice::getClientList();
-  for (auto client : *clientList) {
-    NimBLEDevice::deleteClient(client);
-  }
+    snprintf(station.name, sizeof(station.name), "Lighthouse %s", lighthouseV2MACs[i]);
+    config.stationCount++;
+  }
+  config.mqtt.port = 1883;
+  strlcpy(config.mqtt.topic, "lighthouse", sizeof(config.mqtt.topic));
+  config.tuning.scanTimeS = DEFAULT_SCAN_TIME_S;
+  config.tuning.lowPower = LH_LOW_POWER_DEFAULT;
+  config.tuning.maxCommandLatencyMs = LOW_POWER_DEFAULT_LATENCY_MS;
+  config.commandDeadlineMs = COMMAND_DEADLINE_DEFAULT_MS;
+  config.parkWindowS = 0;
+  config.presence.port = PRESENCE_DEFAULT_PORT;
+  config.presence.graceS = PRESENCE_DEFAULT_GRACE_S;
+  config.adaptiveTxPower = 1;
+  config.udp.port = UDP_CONTROL_DEFAULT_PORT;
+  config.reconcile = 1;
+  config.mqttTls = 0;
+}
 
-  if (lighthouseCount == 0) {
-    Serial.println("No lighthouses found!");
+// Settings written by firmware before the single-blob store existed
+bool migrateLegacyConfig() {
+  if (!preferences.isKey("mqtt_server") && !preferences.isKey("mqtt_enabled")) {
     return false;
   }
-
-  bool success = true;
-
-  for (int i = 0; i < lighthouseCount; i++) {
-    if (discoveredLighthouses[i] == nullptr) continue;
-
-    if (NimBLEDevice::getClientListSize() >= NIMBLE_MAX_CONNECTIONS) {
-      Serial.println("Max clients reached");
-      break;
-    }
-
-    NimBLEClient* pClient = nullptr;
-
-    if (NimBLEDevice::getClientListSize()) {
-      pClient = NimBLEDevice::getClientByPeerAddress(discoveredLighthouses[i]->getAddress());
-      if (pClient) {
-        if (!pClient->connect(discoveredLighthouses[i], false)) {
-          Serial.println("Reconnect failed");
-          continue;
-        }
-        Serial.println("Reconnected client");
-      }
-    }
-
-    if (!pClient) {
-      if (NimBLEDevice::getClientListSize() >= NIMBLE_MAX_CONNECTIONS) {
-        Serial.println("Max clients reached - Unable to create client");
-        continue;
-      }
-
-      pClient = NimBLEDevice::createClient();
-      Serial.println("New client created");
-
-      pClient->setClientCallbacks(&clientCB, false);
-      pClient->setConnectionParams(12, 12, 0, 51);
-      pClient->setConnectTimeout(5);
-
-      // Try to connect with retry
-      bool connected = false;
-      for (int retry = 0; retry < 3; retry++) {
-        Serial.printf("Connection attempt %d/3 for %s\n", retry + 1, discoveredLighthouses[i]->getAddress().toString().c_str());
-        if (pClient->connect(discoveredLighthouses[i])) {
-          connected = true;
-          break;
-        }
-        if (retry < 2) {
-          Serial.println("Connection failed, retrying...");
-          delay(1000); // Wait 1 second before retry
-        }
-      }
-      
-      if (!connected) {
-        NimBLEDevice::deleteClient(pClient);
-        Serial.printf("Failed to connect after 3 attempts to %s\n", discoveredLighthouses[i]->getAddress().toString().c_str());
-        success = false;
-        continue;
-      }
-    }
-
-    Serial.print("Connected to: ");
-    Serial.println(pClient->getPeerAddress().toString().c_str());
-
-    NimBLERemoteService* pSvc = nullptr;
-    NimBLERemoteCharacteristic* pChr = nullptr;
-
-    // Handle V1 (HTC) Base Stations
-    if (discoveredLighthouseVersions[i] == 1) {
-      Serial.printf("Processing V1 lighthouse %d/%d\n", i + 1, lighthouseCount);
-      pSvc = pClient->getService(serviceUUIDHTC);
-      if (pSvc) {
-        pChr = pSvc->getCharacteristic(characteristicUUIDHTC);
-        if (pChr) {
-          if (pChr->canWrite()) {
-            // Create proper 20-byte command structure
-            uint8_t command[20];
-            int mappingIndex = discoveredLighthouseIds[i];
-            const char* lighthouseId = lighthouseMappings[mappingIndex].fullId;
-            
-            if (currentCommand == TURN_ON_PERM) {
-              // Wake command: 0x00 with no timeout
-              makeLighthouseCommand(command, 0x00, 0, lighthouseId);
-              Serial.printf("Sending WAKE command (0x00) with ID %s\n", lighthouseId);
-            } else {
-              // Sleep command: 0x02 with timeout 1
-              makeLighthouseCommand(command, 0x02, 1, lighthouseId);
-              Serial.printf("Sending SLEEP command (0x02) with ID %s\n", lighthouseId);
-            }
-            
-            // Debug: Print command bytes
-            Serial.print("Command bytes: ");
-            for (int j = 0; j < 20; j++) {
-              Serial.printf("%02X ", command[j]);
-            }
-            Serial.println();
-            
-            if (pChr->writeValue(command, 20)) {
-              Serial.printf("✅ Sent V1 command to %s\n", pClient->getPeerAddress().toString().c_str());
-            } else {
-              Serial.printf("❌ Failed to send V1 command to %s\n", pClient->getPeerAddress().toString().c_str());
-              success = false;
-            }
-          } else {
-            Serial.printf("❌ Characteristic not writable for %s\n", pClient->getPeerAddress().toString().c_str());
-            success = false;
-          }
-        } else {
-          Serial.printf("❌ Characteristic not found for %s\n", pClient->getPeerAddress().toString().c_str());
-          success = false;
-        }
-      } else {
-        Serial.printf("❌ Service not found for %s\n", pClient->getPeerAddress().toString().c_str());
-        success = false;
-      }
-    }
-    // Handle V2 Base Stations
-    else if (discoveredLighthouseVersions[i] == 2) {
-      Serial.printf("Processing V2 lighthouse %d/%d\n", i + 1, lighthouseCount);
-      pSvc = pClient->getService(serviceUUIDV2);
-      if (pSvc) {
-        pChr = pSvc->getCharacteristic(characteristicUUIDV2);
-        if (pChr) {
-          if (pChr->canWrite()) {
-            uint8_t command = (currentCommand == TURN_ON_PERM) ? 0x01 : 0x00;
-            if (pChr->writeValue(&command, 1)) {
-              Serial.printf("✅ Sent V2 command %02X to %s\n", command, pClient->getPeerAddress().toString().c_str());
-            } else {
-              Serial.printf("❌ Failed to send V2 command to %s\n", pClient->getPeerAddress().toString().c_str());
-              success = false;
-            }
-          } else {
-            Serial.printf("❌ V2 Characteristic not writable for %s\n", pClient->getPeerAddress().toString().c_str());
-            success = false;
-          }
-        } else {
-          Serial.printf("❌ V2 Characteristic not found for %s\n", pClient->getPeerAddress().toString().c_str());
-          success = false;
-        }
-      } else {
-        Serial.printf("❌ V2 Service not found for %s\n", pClient->getPeerAddress().toString().c_str());
-        success = false;
-      }
-    }
-
-    delay(100); // Small delay between commands
+  preferences.getString("mqtt_server", config.mqtt.server, sizeof(config.mqtt.server));
+  config.mqtt.port = preferences.getInt("mqtt_port", 1883);
+  preferences.getString("mqtt_user", config.mqtt.username, sizeof(config.mqtt.username));
+  preferences.getString("mqtt_pass", config.mqtt.password, sizeof(config.mqtt.password));
+  if (preferences.getString("mqtt_topic", config.mqtt.topic, sizeof(config.mqtt.topic)) == 0 || config.mqtt.topic[0] == '\0') {
+    strlcpy(config.mqtt.topic, "lighthouse", sizeof(config.mqtt.topic));
   }
-
-  return success;
+  config.mqtt.enabled = preferences.getBool("mqtt_enabled", false);
+  return true;
 }
 
-void scanEndedCB(NimBLEScanResults results) {
-  Serial.print("Scan Ended. Found ");
-  Serial.print(lighthouseCount);
-  Serial.println(" lighthouses");
+bool saveConfig() {
+  sealConfig(config);
+  preferences.begin(CONFIG_NAMESPACE, false);
+  size_t written = preferences.putBytes(CONFIG_BLOB_KEY, &config, sizeof(config));
+  preferences.end();
+  if (written != sizeof(config)) {
+    Serial.println("❌ Failed to write configuration");
+    return false;
+  }
+  configStore.writes++;
+  return true;
+}
 
-  readyToConnect = true;
+#if LH_WITH_MQTT
+// The broker's CA certificate for MQTT over TLS, NUL-terminated. Returns its
+// length, 0 if none is stored or it does not fit.
+size_t loadMqttCaCert(char* pem, size_t size) {
+  preferences.begin(CONFIG_NAMESPACE, true);
+  size_t len = preferences.getBytesLength(MQTT_CA_KEY);
+  bool loaded = len > 0 && len < size && preferences.getBytes(MQTT_CA_KEY, pem, len) == len;
+  preferences.end();
+  if (!loaded) return 0;
+  pem[len] = '\0';
+  return len;
 }
 
-void blinkLED(int times, int delayMs) {
-  for (int i = 0; i < times; i++) {
-    digitalWrite(ledPin, HIGH);
-    delay(delayMs);
-    digitalWrite(ledPin, LOW);
-    delay(delayMs);
-  }
+// nullptr removes it
+bool saveMqttCaCert(const char* pem) {
+  preferences.begin(CONFIG_NAMESPACE, false);
+  bool saved = pem != nullptr ? preferences.putBytes(MQTT_CA_KEY, pem, strlen(pem)) == strlen(pem)
+                              : !preferences.isKey(MQTT_CA_KEY) || preferences.remove(MQTT_CA_KEY);
+  preferences.end();
+  return saved;
 }
 
-// MQTT Configuration Functions
-void loadMqttConfig() {
-  preferences.begin("lighthouse", false);
-  mqttServer = preferences.getString("mqtt_server", "");
-  mqttPort = preferences.getInt("mqtt_port", 1883);
-  mqttUsername = preferences.getString("mqtt_user", "");
-  mqttPassword = preferences.getString("mqtt_pass", "");
-  mqttTopic = preferences.getString("mqtt_topic", "lighthouse");
-  mqttEnabled = preferences.getBool("mqtt_enabled", false);
+// CRC of the topic filters the broker's session holds for us, 0 if unknown
+uint32_t loadMqttSubscribedCrc() {
+  preferences.begin(CONFIG_NAMESPACE, true);
+  uint32_t crc = preferences.getUInt(MQTT_SUBSCRIBED_KEY, 0);
   preferences.end();
+  return crc;
 }
 
-void saveMqttConfig() {
-  preferences.begin("lighthouse", false);
-  preferences.putString("mqtt_server", mqttServer);
-  preferences.putInt("mqtt_port", mqttPort);
-  preferences.putString("mqtt_user", mqttUsername);
-  preferences.putString("mqtt_pass", mqttPassword);
-  preferences.putString("mqtt_topic", mqttTopic);
-  preferences.putBool("mqtt_enabled", mqttEnabled);
+bool saveMqttSubscribedCrc(uint32_t crc) {
+  preferences.begin(CONFIG_NAMESPACE, false);
+  bool saved = preferences.putUInt(MQTT_SUBSCRIBED_KEY, crc) == sizeof(crc);
   preferences.end();
+  return saved;
+}
+#endif
+
+#if LH_WITH_UDP
+// High-water sequence number of keyed UDP requests (see udp_link.cpp)
+bool loadUdpSequenceMark(UdpSequenceMark& mark) {
+  preferences.begin(CONFIG_NAMESPACE, true);
+  bool loaded = preferences.getBytesLength(UDP_SEQUENCE_KEY) == sizeof(mark) &&
+                preferences.getBytes(UDP_SEQUENCE_KEY, &mark, sizeof(mark)) == sizeof(mark);
+  preferences.end();
+  return loaded;
 }
 
-void mqttCallback(char* topic, byte* payload, unsigned int length) {
-  String message;
-  for (int i = 0; i < length; i++) {
-    message += (char)payload[i];
-  }
-  
-  Serial.printf("MQTT message received: %s = %s\n", topic, message.c_str());
-  
-  String topicStr = String(topic);
-  
-  // Handle lighthouse commands
-  if (topicStr.endsWith("/command")) {
-    if (message == "on") {
-      startScanAndSetCommand(TURN_ON_PERM);
-    } else if (message == "off") {
-      startScanAndSetCommand(TURN_OFF);
+bool saveUdpSequenceMark(const UdpSequenceMark& mark) {
+  preferences.begin(CONFIG_NAMESPACE, false);
+  bool saved = preferences.putBytes(UDP_SEQUENCE_KEY, &mark, sizeof(mark)) == sizeof(mark);
+  preferences.end();
+  return saved;
+}
+#endif
+
+// One blob read at boot. Falls back to the defaults (and the old per-key MQTT
+// settings) if the blob is missing or fails its CRC.
+void loadConfig() {
+  seedDefaultConfig();
+
+  uint8_t blob[sizeof(ControllerConfig)];
+  preferences.begin(CONFIG_NAMESPACE, false);
+  size_t len = preferences.getBytesLength(CONFIG_BLOB_KEY);
+  bool loaded = len > 0 && len <= sizeof(blob) && preferences.getBytes(CONFIG_BLOB_KEY, blob, len) == len &&
+                overlayStoredConfig(config, blob, len);
+  if (!loaded) {
+    if (len > 0) {
+      Serial.printf("❌ Stored configuration invalid (%u bytes), using defaults\n", (unsigned)len);
     }
+    configStore.migrated = migrateLegacyConfig();
   }
-  // Handle individual lighthouse commands
-  else if (topicStr.indexOf("/lighthouse") > 0) {
-    // Extract lighthouse index from topic like "lighthouse/lighthouse0/command"
-    int startIdx = topicStr.indexOf("/lighthouse") + 11;
-    int endIdx = topicStr.indexOf("/", startIdx);
-    if (endIdx > startIdx) {
-      String lighthouseIndexStr = topicStr.substring(startIdx, endIdx);
-      int lighthouseIndex = lighthouseIndexStr.toInt();
-      
-      if (lighthouseIndex >= 0 && lighthouseIndex < 2) { // Only support 2 masters
-        targetLighthouseIndex = lighthouseIndex;
-        if (message == "on") {
-          startScanAndSetCommand(TURN_ON_PERM);
-        } else if (message == "off") {
-          startScanAndSetCommand(TURN_OFF);
-        }
+  preferences.end();
+
+  if (configStore.migrated) {
+    // Write the blob before dropping the old keys, a power cut in between
+    // just repeats the migration
+    if (saveConfig()) {
+      preferences.begin(CONFIG_NAMESPACE, false);
+      const char* legacyKeys[] = {"mqtt_server", "mqtt_port", "mqtt_user", "mqtt_pass", "mqtt_topic", "mqtt_enabled"};
+      for (int i = 0; i < sizeof(legacyKeys) / sizeof(legacyKeys[0]); i++) {
+        preferences.remove(legacyKeys[i]);
       }
+      preferences.end();
+      Serial.println("✅ Migrated settings to the configuration blob");
     }
+  } else if (loaded && len != sizeof(ControllerConfig)) {
+    // Older layout: rewrite it so appended fields are stored too
+    configMarkDirty();
   }
+
+  Serial.printf("Configuration: %u stations, %u bytes%s\n", config.stationCount, (unsigned)sizeof(ControllerConfig),
+                loaded ? "" : " (defaults)");
 }
 
-bool connectMqtt() {
-  if (!mqttEnabled || mqttServer.length() == 0) {
-    return false;
-  }
-  
-  if (mqttClient.connected()) {
-    return true;
-  }
-  
-  Serial.printf("Attempting MQTT connection to %s:%d...\n", mqttServer.c_str(), mqttPort);
-  mqttClient.setServer(mqttServer.c_str(), mqttPort);
-  mqttClient.setCallback(mqttCallback);
-  
-  String clientId = "lighthouse-esp32-" + String(random(0xffff), HEX);
-  bool connected = false;
-  
-  if (mqttUsername.length() > 0 && mqttPassword.length() > 0) {
-    connected = mqttClient.connect(clientId.c_str(), mqttUsername.c_str(), mqttPassword.c_str());
-  } else {
-    connected = mqttClient.connect(clientId.c_str());
+void configMarkDirty() {
+  unsigned long now = millis();
+  if (!configStore.dirty) {
+    configStore.dirty = true;
+    configStore.firstChange = now;
   }
-  
-  if (connected) {
-    Serial.println("MQTT connected");
-    // Subscribe to command topics
-    String cmdTopic = mqttTopic + "/command";
-    mqttClient.subscribe(cmdTopic.c_str());
-    Serial.printf("Subscribed to: %s\n", cmdTopic.c_str());
-    
-    // Subscribe to individual lighthouse command topics
-    for (int i = 0; i < 2; i++) {
-      String individualTopic = mqttTopic + "/lighthouse" + String(i) + "/command";
-      mqttClient.subscribe(individualTopic.c_str());
-      Serial.printf("Subscribed to: %s\n", individualTopic.c_str());
-    }
-    
-    // Publish availability
-    String availTopic = mqttTopic + "/availability";
-    mqttClient.publish(availTopic.c_str(), "online", true);
-  } else {
-    Serial.printf("MQTT connection failed, rc=%d\n", mqttClient.state());
-  }
-  
-  return connected;
+  configStore.lastChange = now;
 }
 
-void publishMqttStatus() {
-  if (!mqttClient.connected()) return;
-  
-  // Publish lighthouse status for each discovered lighthouse
-  for (int i = 0; i < lighthouseCount && i < 2; i++) { // Only publish for 2 masters
-    String statusTopic = mqttTopic + "/lighthouse" + String(i) + "/status";
-    String nameTopic = mqttTopic + "/lighthouse" + String(i) + "/name";
-    
-    // Publish status (simplified - in real implementation you'd track actual state)
-    mqttClient.publish(statusTopic.c_str(), "unknown");
-    
-    // Publish name
-    if (discoveredLighthouseIds[i] >= 0 && discoveredLighthouseIds[i] < 2) {
-      String name = preferences.getString(("name_" + String(discoveredLighthouseIds[i])).c_str(), lighthouseNames[discoveredLighthouseIds[i]]);
-      mqttClient.publish(nameTopic.c_str(), name.c_str());
-    }
+// Write-behind: flush once edits have settled, or after CONFIG_SAVE_MAX_DELAY_MS
+// of continuous edits. Held off while a command has the radio busy.
+void serviceConfigStore() {
+  if (!configStore.dirty || currentCommand != NOTHING) return;
+  unsigned long now = millis();
+  if (now - configStore.lastChange < CONFIG_SAVE_DEBOUNCE_MS && now - configStore.firstChange < CONFIG_SAVE_MAX_DELAY_MS) {
+    return;
+  }
+  configStore.dirty = false;
+  if (saveConfig()) {
+    Serial.printf("Configuration saved (%u writes)\n", configStore.writes);
+  } else {
+    configMarkDirty(); // Retry after the debounce
   }
 }
 
@@ -859,123 +557,121 @@ void setup() {
   Serial.begin(115200);
   Serial.println("Starting SteamVR Lighthouse Controller...");
 
+  // Event history from flash and whatever a crash left in RTC memory
+  setupJournal();
+
   // Initialize LED pin
   pinMode(ledPin, OUTPUT);
   digitalWrite(ledPin, LOW);
 
-  // Initialize buttons
-  offButton.begin();
-  onButton.begin();
+  // Load the stored configuration (one NVS read) and build command frames
+  // for the configured lighthouses
+  loadConfig();
+  precomputeLighthouseFrames();
 
-  // Initialize BLE
-  Serial.println("Initializing BLE...");
-  NimBLEDevice::init("");
-  NimBLEDevice::setPower(ESP_PWR_LVL_P9); /** +9db */
+  // MQTT topics, and messages still undelivered before a crash or reset
+  setupMqtt();
 
-  NimBLEScan* pScan = NimBLEDevice::getScan();
-  pScan->setAdvertisedDeviceCallbacks(new AdvertisedDeviceCallbacks(), false);
-  pScan->setInterval(1349);
-  pScan->setWindow(449);
-  pScan->setActiveScan(true);
+  // Buttons are interrupt driven and wake loop() through loopEvents
+  loopEvents = xEventGroupCreate();
+  setupButtons();
 
-  // Initialize WiFi
+  // Initialize BLE and power management (in low-power mode BLE is started
+  // on demand by each command)
+  powerStats.since = esp_timer_get_time();
+  applyPowerMode();
+  markBootPhase(bootTimeline.bleReadyMs, "BLE and buttons ready");
+
+  // Mount LittleFS and register web routes, the server starts with WiFi
+  setupWebServer();
+
+#if LH_WITH_WIFI
+  // Start WiFi without waiting for it, serviceNetwork() finishes bring-up
   Serial.println("Connecting to WiFi...");
+  WiFi.setAutoReconnect(true);
   WiFi.begin(ssid, password);
-  
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    Serial.print(".");
-  }
-  
-  Serial.println("");
-  Serial.println("WiFi connected!");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-
-  // Setup web server
-  server.on("/", handleRoot);
-  server.on("/on", handleOn);
-  server.on("/off", handleOff);
-  server.on("/rename", handleRename);
-  server.on("/mqtt", handleMqttConfig);
-  server.on("/mqtt-save", HTTP_POST, handleMqttSave);
-  server.begin();
-  Serial.println("Web server started");
-
-  // Load and initialize MQTT configuration
-  loadMqttConfig();
-  if (mqttEnabled) {
-    connectMqtt();
-  }
+  wifiAttemptStarted = millis();
+#endif
 
   // Initial LED blink to show setup complete
-  blinkLED(3, 200);
+  startLedPattern(3, 200);
   
   Serial.println("Setup complete!");
-  Serial.println("Web interface available at: http://" + WiFi.localIP().toString());
 }
 
-void loop() {
-  server.handleClient();
-  
-  // Handle MQTT
-  if (mqttEnabled) {
-    if (!mqttClient.connected()) {
-      unsigned long now = millis();
-      if (now - lastMqttReconnectAttempt > 5000) { // Try to reconnect every 5 seconds
-        lastMqttReconnectAttempt = now;
-        if (connectMqtt()) {
-          Serial.println("MQTT reconnected");
-        }
-      }
-    } else {
-      mqttClient.loop();
+#if LH_WITH_WIFI
+// WiFi, web server and MQTT bring-up and reconnects. Never blocks waiting for
+// the network, so buttons and BLE keep working while the AP is away.
+void serviceNetwork() {
+  unsigned long now = millis();
+
+  if (WiFi.status() != WL_CONNECTED) {
+    if (networkState == NET_ONLINE) {
+      Serial.println("WiFi connection lost, reconnecting...");
+      networkState = NET_CONNECTING;
+      wifiAttemptStarted = now;
+      wifiReconnects++;
+      journalEvent(EVENT_WIFI_RECONNECT, 0, wifiReconnects);
+    } else if (now - wifiAttemptStarted >= WIFI_RETRY_INTERVAL_MS) {
+      Serial.println("WiFi still not connected, retrying...");
+      WiFi.disconnect();
+      WiFi.begin(ssid, password);
+      wifiAttemptStarted = now;
     }
+    return;
+  }
+
+  if (networkState == NET_CONNECTING) {
+    networkState = NET_ONLINE;
+    markBootPhase(bootTimeline.wifiConnectedMs, "WiFi connected");
+    Serial.printf("IP address: %s\n", WiFi.localIP().toString().c_str());
+
+    startWebServer();
+    mqttNetworkUp(now);
   }
+
+  serviceWebServer();
+  serviceMqtt(now);
+}
+#endif
+
+void loop() {
+  updateHeapStats();
+  serviceJournal(millis());
+#if LH_WITH_WIFI
+  serviceNetwork();
+#endif
+  serviceLedPattern();
+  serviceConfigStore();
+  serviceParking();
+  serviceReconciler();
+  servicePresence();
+  serviceUdpControl();
   
   // Handle button presses
   offButton.read();
   onButton.read();
   
-  if (offButton.wasPressed() && currentCommand == NOTHING) {
-    Serial.println("Off button pressed");
-    startScanAndSetCommand(TURN_OFF);
+  // OFF acts on release so a long press can mean standby instead
+  if (!offButtonHeld && offButton.pressedFor(BUTTON_LONG_PRESS_MS)) {
+    offButtonHeld = true;
+    Serial.println("Off button held, standby");
+    runButtonCommand(BUTTON_STANDBY_SCENE, TURN_STANDBY, ACTION_STANDBY, nullptr);
+  }
+  if (offButton.wasReleased()) {
+    if (!offButtonHeld) {
+      Serial.println("Off button pressed");
+      runButtonCommand(BUTTON_OFF_SCENE, TURN_OFF, ACTION_OFF, &offInput);
+    }
+    offButtonHeld = false;
   }
   
-  if (onButton.wasPressed() && currentCommand == NOTHING) {
+  if (onButton.wasPressed()) {
     Serial.println("On button pressed");
-    startScanAndSetCommand(TURN_ON_PERM);
+    runButtonCommand(BUTTON_ON_SCENE, TURN_ON_PERM, ACTION_ON, &onInput);
   }
 
-  // Handle BLE operations
-  if (readyToConnect && currentCommand != NOTHING) {
-    readyToConnect = false;
-    
-    bool success = sendLighthouseCommands();
-    
-    if (success) {
-      Serial.println("Commands sent successfully");
-      blinkLED(2, 500); // Success: 2 slow blinks
-      
-      // Publish status update via MQTT
-      if (mqttClient.connected()) {
-        publishMqttStatus();
-      }
-    } else {
-      Serial.println("Some commands failed");
-      blinkLED(5, 100); // Error: 5 fast blinks
-    }
-    
-    currentCommand = NOTHING;
-    targetLighthouseIndex = -1; // Reset target
-    digitalWrite(ledPin, LOW);
-    
-    // Cleanup
-    auto clientList = NimBLEDevice::getClientList();
-    for (auto client : *clientList) {
-      NimBLEDevice::deleteClient(client);
-    }
-  }
+  serviceCommands();
 
-  delay(10);
+  idleWait();
 }
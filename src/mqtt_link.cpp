@@ -0,0 +1,513 @@
+/** MQTT component (LH_WITH_MQTT), see controller.h.
+ */
+#include "controller.h"
+
+#if LH_WITH_MQTT
+
+#include <esp_timer.h>
+
+#include "chunked_writer.h"
+
+// MQTT Configuration
+TlsTransport mqttTransport;
+MqttClient<TlsTransport> mqttClient(mqttTransport);
+
+// Everything published goes through the outbox and is delivered at QoS 1 (see
+// mqtt_outbox.h). In RTC memory it also survives a crash or soft reset.
+#ifndef MQTT_OUTBOX_PERSIST
+#define MQTT_OUTBOX_PERSIST 1
+#endif
+#if MQTT_OUTBOX_PERSIST
+RTC_NOINIT_ATTR
+#endif
+MqttOutbox mqttOutbox;
+#define MQTT_KEEPALIVE_S 15
+#define MQTT_RECONNECT_INTERVAL_MS 5000
+#define MQTT_CA_MAX_BYTES 4096
+
+// The TLS session of the last connection, offered again after a crash, soft
+// reset or deep sleep (see tls_transport.h)
+#ifndef MQTT_TLS_SESSION_PERSIST
+#define MQTT_TLS_SESSION_PERSIST 1
+#endif
+#if MQTT_TLS_SESSION_PERSIST
+RTC_NOINIT_ATTR TlsSessionBlob mqttTlsSession;
+#endif
+
+unsigned long lastMqttReconnectAttempt = 0;
+// TLS settings and the CA certificate go to the transport before the next
+// connect
+bool mqttTransportStale = true;
+
+// The broker keeps our subscriptions between connections (clean session off,
+// stable client ID), so a reconnect that finds its session does not
+// subscribe again. mqttSubscribedCrc is the CRC of the topic filters the
+// session holds. It is kept in NVS, as the broker's session outlives a
+// reboot. When the topics no longer match it, the next connect asks for a
+// clean session, which drops the old subscriptions. It is 0 from the first
+// SUBSCRIBE until the last SUBACK, so a half-subscribed session is never
+// trusted.
+#define MQTT_SUBSCRIPTIONS_MAX (4 + CONFIG_MAX_STATIONS)
+uint32_t mqttSubscribedCrc = 0;
+uint16_t mqttSubacksPending[MQTT_SUBSCRIPTIONS_MAX];
+uint8_t mqttSubacksPendingCount = 0;
+bool mqttSubscribeRefused = false;
+
+int64_t mqttConnectStartedUs = 0;
+bool mqttAttemptOpen = false;  // Connecting, failure not reported yet
+uint32_t mqttFailuresReported = 0;
+MqttConnectStats mqttConnectStats = {};
+
+MqttTopics mqttTopics;
+
+// Commands sent with a correlation ID that wait for their result (see
+// command_results.h)
+CommandTracker commandTracker;
+
+void publishMqttStatus();
+void publishCommandResult(const TrackedCommand& tracked);
+void publishCommandRejected(const CommandEnvelope& envelope, const char* error);
+void onMqttConnected(bool sessionPresent);
+void onMqttAck(uint16_t packetId);
+void onMqttSuback(uint16_t packetId, bool granted);
+bool subscribeMqttTopics();
+void reportMqttFailure();
+
+// MQTT Configuration Functions
+void buildMqttTopics() {
+  memset(&mqttTopics, 0, sizeof(mqttTopics));
+  snprintf(mqttTopics.command, MQTT_TOPIC_LEN, "%s/command", config.mqtt.topic);
+  snprintf(mqttTopics.batch, MQTT_TOPIC_LEN, "%s/batch", config.mqtt.topic);
+  snprintf(mqttTopics.scene, MQTT_TOPIC_LEN, "%s/scene", config.mqtt.topic);
+  snprintf(mqttTopics.presence, MQTT_TOPIC_LEN, "%s/presence", config.mqtt.topic);
+  snprintf(mqttTopics.availability, MQTT_TOPIC_LEN, "%s/availability", config.mqtt.topic);
+  snprintf(mqttTopics.result, MQTT_TOPIC_LEN, "%s/result", config.mqtt.topic);
+  for (int i = 0; i < config.stationCount; i++) {
+    snprintf(mqttTopics.lighthouseCommand[i], MQTT_TOPIC_LEN, "%s/lighthouse%d/command", config.mqtt.topic, i);
+    snprintf(mqttTopics.lighthouseStatus[i], MQTT_TOPIC_LEN, "%s/lighthouse%d/status", config.mqtt.topic, i);
+    snprintf(mqttTopics.lighthouseName[i], MQTT_TOPIC_LEN, "%s/lighthouse%d/name", config.mqtt.topic, i);
+  }
+}
+
+// The topic filters the controller subscribes to
+size_t mqttSubscriptionTopics(const char* topics[MQTT_SUBSCRIPTIONS_MAX]) {
+  size_t n = 0;
+  topics[n++] = mqttTopics.command;
+  topics[n++] = mqttTopics.batch;
+  topics[n++] = mqttTopics.scene;
+#if LH_WITH_PRESENCE
+  topics[n++] = mqttTopics.presence;
+#endif
+  for (int i = 0; i < config.stationCount; i++) topics[n++] = mqttTopics.lighthouseCommand[i];
+  return n;
+}
+
+uint32_t mqttSubscriptionsCrc() {
+  const char* topics[MQTT_SUBSCRIPTIONS_MAX];
+  size_t n = mqttSubscriptionTopics(topics);
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < n; i++) crc = crc32Update(crc, reinterpret_cast<const uint8_t*>(topics[i]), strlen(topics[i]) + 1);
+  return ~crc;
+}
+
+bool mqttSubscriptionsStale() { return mqttSubscribedCrc != mqttSubscriptionsCrc(); }
+
+void setMqttSubscribedCrc(uint32_t crc) {
+  if (crc == mqttSubscribedCrc) return;
+  mqttSubscribedCrc = crc;
+  if (!saveMqttSubscribedCrc(crc)) Serial.println("❌ MQTT: subscription state not saved");
+}
+
+// Payload is not NUL-terminated
+bool payloadEquals(const byte* payload, unsigned int length, const char* text) {
+  return length == strlen(text) && memcmp(payload, text, length) == 0;
+}
+
+// Command topics take the plain command or a JSON envelope with a
+// correlation ID (see command_results.h); commands with an ID get one message
+// on the result topic once every station they target has an outcome.
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+  beginCommandTrace();
+  Serial.printf("MQTT message received: %s = %.*s\n", topic, (int)length, (const char*)payload);
+
+#if LH_WITH_PRESENCE
+  // Presence of the VR PC, e.g. from a Home Assistant device tracker
+  if (strcmp(topic, mqttTopics.presence) == 0) {
+    bool present;
+    if (parsePresencePayload((const char*)payload, length, present)) {
+      presence.mqttReport(present);
+    } else {
+      Serial.println("Invalid presence payload");
+    }
+    return;
+  }
+#endif
+
+  CommandEnvelope envelope;
+  if (!parseCommandEnvelope((const char*)payload, length, envelope)) {
+    Serial.println("Invalid command payload");
+    return;
+  }
+  const char* text = envelope.command;
+  BatchPlan plan;
+  uint8_t command = RUN_BATCH;
+  const char* error = nullptr;
+
+  if (strcmp(topic, mqttTopics.batch) == 0) {
+    // Batch: "0:on,1:off,all:standby"
+    if (!parseBatchPlan(text, envelope.commandLen, config.stationCount, plan)) error = "invalid batch";
+  } else if (strcmp(topic, mqttTopics.scene) == 0) {
+    // Scene: payload is the scene name
+    int index = findScene(config, text);
+    if (index < 0) {
+      error = "unknown scene";
+    } else {
+      Serial.printf("Running scene '%s'\n", text);
+      plan = planFromScene(config.scenes[index]);
+    }
+  } else {
+    int station = -2;  // -1: all stations
+    if (strcmp(topic, mqttTopics.command) == 0) station = -1;
+    for (int i = 0; i < config.stationCount && station == -2; i++) {
+      if (strcmp(topic, mqttTopics.lighthouseCommand[i]) == 0) station = i;
+    }
+    if (station == -2) return;
+    StationAction action = parseStationAction(text, envelope.commandLen);
+    command = action == ACTION_ON ? TURN_ON_PERM : action == ACTION_OFF ? TURN_OFF : TURN_STANDBY;
+    if (action == ACTION_NONE) {
+      error = "unknown command";
+    } else {
+      plan = station == -1 ? BatchPlan::all(action, config.stationCount) : BatchPlan::single(station, action);
+    }
+  }
+
+  if (!error && envelope.id[0] != '\0' && !commandTracker.track(envelope, plan, engine.cycles + 1, millis())) {
+    error = "too many commands waiting for results";
+  }
+  if (error) {
+    Serial.printf("Command rejected: %s\n", error);
+    if (envelope.id[0] != '\0') publishCommandRejected(envelope, error);
+    return;
+  }
+  // Whether it starts now or after the running cycle, this is cycle engine.cycles + 1
+  submitCommand(command, plan, SOURCE_MQTT);
+}
+
+// TLS on or off, the CA certificate from NVS, and the TLS session kept in
+// RTC memory
+void prepareMqttTransport() {
+  mqttTransportStale = false;
+  mqttTransport.setTls(config.mqttTls);
+  if (!config.mqttTls) return;
+  char* pem = (char*)malloc(MQTT_CA_MAX_BYTES);
+  bool stored = pem != nullptr && loadMqttCaCert(pem, MQTT_CA_MAX_BYTES) > 0;
+  if (!mqttTransport.setCACert(stored ? pem : nullptr)) {
+    Serial.println("❌ MQTT CA certificate does not parse - the broker is not verified");
+  }
+  free(pem);
+#if MQTT_TLS_SESSION_PERSIST
+  if (mqttTransport.importSession(mqttTlsSession)) {
+    Serial.printf("MQTT: TLS session for %s:%u kept across the reset\n", mqttTlsSession.host, mqttTlsSession.port);
+  }
+#endif
+}
+
+bool connectMqtt() {
+  if (!config.mqtt.enabled || config.mqtt.server[0] == '\0') {
+    return false;
+  }
+  
+  if (mqttClient.connected() || mqttClient.connecting()) {
+    return true;
+  }
+  
+  if (mqttTransportStale) prepareMqttTransport();
+  Serial.printf("Attempting MQTT%s connection to %s:%d...\n", config.mqttTls ? " (TLS)" : "", config.mqtt.server,
+                config.mqtt.port);
+  mqttClient.setServer(config.mqtt.server, config.mqtt.port);
+  mqttClient.setCallback(mqttCallback);
+  mqttClient.setAckCallback(onMqttAck);
+  mqttClient.setSubackCallback(onMqttSuback);
+  mqttClient.setConnectedCallback(onMqttConnected);
+  
+  // The same ID on every connect, or the broker would not find our session
+  char clientId[32];
+  snprintf(clientId, sizeof(clientId), "lighthouse-esp32-%06lx", (unsigned long)(ESP.getEfuseMac() >> 24) & 0xFFFFFF);
+  MqttConnectOptions options = {};
+  options.clientId = clientId;
+  options.username = config.mqtt.username;
+  options.password = config.mqtt.password;
+  // The broker marks us offline if the connection dies without a goodbye
+  options.willTopic = mqttTopics.availability;
+  options.willMessage = "offline";
+  options.willRetain = true;
+  options.cleanSession = mqttSubscriptionsStale();
+  options.keepAliveS = MQTT_KEEPALIVE_S;
+  
+  // Only starts: mqttClient.loop() opens the connection and sends CONNECT,
+  // and the CONNACK ends up in onMqttConnected()
+  mqttConnectStats.attempts++;
+  mqttConnectStartedUs = esp_timer_get_time();
+  mqttAttemptOpen = mqttClient.connect(options, millis());
+  if (!mqttAttemptOpen) reportMqttFailure();
+  return mqttAttemptOpen;
+}
+
+void reportMqttFailure() {
+  if (mqttTransport.stats().failures == mqttFailuresReported) {
+    Serial.printf("MQTT connection failed, rc=%d\n", mqttClient.state());
+  } else {
+    // Transport errors are -errno, or mbedtls codes for TLS
+    Serial.printf("MQTT connection failed, rc=%d, transport error %d\n", mqttClient.state(),
+                  mqttTransport.stats().lastError);
+  }
+  mqttFailuresReported = mqttTransport.stats().failures;
+}
+
+void onMqttConnected(bool sessionPresent) {
+  Serial.println("MQTT connected");
+  markBootPhase(bootTimeline.mqttConnectedMs, "MQTT connected");
+  journalEvent(EVENT_MQTT_CONNECT, sessionPresent, 0);
+  mqttAttemptOpen = false;
+  uint32_t connackMs = (uint32_t)((esp_timer_get_time() - mqttConnectStartedUs) / 1000);
+  MqttConnectStats& stats = mqttConnectStats;
+  stats.connects++;
+  stats.lastConnackMs = connackMs;
+  stats.lastTransportMs = mqttTransport.stats().lastOpenMs;
+  stats.lastResumed = mqttTransport.tls() && mqttTransport.stats().lastResumed;
+#if MQTT_TLS_SESSION_PERSIST
+  // Possibly a fresh ticket; without a session to keep nothing is offered
+  // after a reset
+  if (!mqttTransport.exportSession(mqttTlsSession)) mqttTlsSession.magic = 0;
+#endif
+  if (stats.lastResumed) {
+    stats.resumedCount++;
+    stats.resumedTotalMs += connackMs;
+  } else {
+    stats.fullCount++;
+    stats.fullTotalMs += connackMs;
+  }
+  Serial.printf("MQTT: CONNACK after %u ms (transport %u ms%s)\n", connackMs, stats.lastTransportMs,
+                stats.lastResumed ? ", TLS session resumed" : "");
+
+  if (sessionPresent && !mqttSubscriptionsStale()) {
+    stats.sessionsPresent++;
+    stats.resubscribesSkipped++;
+    Serial.println("MQTT: broker kept the session, subscriptions unchanged");
+  } else if (!subscribeMqttTopics()) {
+    // Reconnect with a clean session and try again
+    Serial.println("❌ MQTT: subscribe could not be sent");
+    mqttClient.disconnect();
+    return;
+  }
+  
+  // Publish availability
+  mqttClient.publish(mqttTopics.availability, "online", true);
+  // The broker may have restarted without its retained messages: queue the
+  // current state of everything, and resend what was never acknowledged
+  mqttOutbox.requeueInflight();
+  publishMqttNames();
+  publishMqttStatus();
+}
+
+void onMqttAck(uint16_t packetId) { mqttOutbox.ack(packetId); }
+
+// Command topics. The subscriptions count once every SUBACK is in.
+bool subscribeMqttTopics() {
+  setMqttSubscribedCrc(0);
+  const char* topics[MQTT_SUBSCRIPTIONS_MAX];
+  size_t n = mqttSubscriptionTopics(topics);
+  mqttSubacksPendingCount = 0;
+  mqttSubscribeRefused = false;
+  for (size_t i = 0; i < n; i++) {
+    uint16_t packetId = mqttClient.subscribe(topics[i]);
+    if (packetId == 0) return false;
+    mqttSubacksPending[mqttSubacksPendingCount++] = packetId;
+    Serial.printf("Subscribed to: %s\n", topics[i]);
+  }
+  return true;
+}
+
+void onMqttSuback(uint16_t packetId, bool granted) {
+  for (uint8_t i = 0; i < mqttSubacksPendingCount; i++) {
+    if (mqttSubacksPending[i] != packetId) continue;
+    mqttSubacksPending[i] = mqttSubacksPending[--mqttSubacksPendingCount];
+    if (!granted) {
+      Serial.printf("❌ MQTT: broker refused subscription %u\n", packetId);
+      mqttSubscribeRefused = true;
+    }
+    if (mqttSubacksPendingCount == 0 && !mqttSubscribeRefused) setMqttSubscribedCrc(mqttSubscriptionsCrc());
+    return;
+  }
+}
+
+// Send what the outbox holds while the connection has room
+void serviceMqttOutbox() {
+  mqttOutbox.flush([] { return mqttClient.nextPacketId(); },
+                   [](const char* topic, const uint8_t* payload, size_t len, bool retain, uint16_t packetId, bool dup) {
+                     return mqttClient.publish(topic, payload, len, retain, 1, packetId, dup, millis());
+                   });
+}
+
+const char* stationPowerName(uint8_t action) { return action == ACTION_NONE ? "unknown" : stationActionName(action); }
+
+// Retained state per station, "unknown" until the controller has switched it
+void publishStationState(int index) {
+  if (!config.mqtt.enabled) return;
+  mqttOutbox.push(mqttTopics.lighthouseStatus[index], stationPowerName(stationPower[index]),
+                  OUTBOX_STATE | OUTBOX_RETAIN);
+}
+
+#define COMMAND_RESULT_MAX_LEN 768
+
+typedef ChunkedWriter<TextBufferSink, 128> TextWriter;
+
+void publishCommandReply(const char* replyTopic, TextBufferSink& sink) {
+  if (!config.mqtt.enabled) return;
+  if (sink.overflow) Serial.println("Command result truncated");
+  mqttOutbox.push(replyTopic[0] != '\0' ? replyTopic : mqttTopics.result, sink.data, 0);
+}
+
+void publishCommandResult(const TrackedCommand& tracked) {
+  char payload[COMMAND_RESULT_MAX_LEN];
+  TextBufferSink sink(payload, sizeof(payload));
+  {
+    TextWriter json(sink);
+    json.print("{\"id\":");
+    json.printJsonString(tracked.id);
+    json.printf(",\"result\":\"%s\",\"elapsed_ms\":%u,\"cycles\":%u,\"scan_ms\":%u,\"stations\":[",
+                tracked.success() ? "ok" : "failed", (unsigned)(millis() - tracked.submittedMs), tracked.cycles,
+                tracked.scanMs);
+    bool first = true;
+    for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+      if (!(tracked.targetMask & (1u << i))) continue;
+      const StationResult& result = tracked.stations[i];
+      json.printf("%s{\"index\":%d,\"action\":\"%s\",\"outcome\":\"%s\",\"retries\":%u,", first ? "" : ",", i,
+                  stationActionName(result.action), stationOutcomeName(result.outcome),
+                  result.attempts > 0 ? result.attempts - 1u : 0u);
+      json.printf("\"connect_ms\":%u,\"write_ms\":%u}", result.connectMs, result.writeMs);
+      first = false;
+    }
+    json.print("]");
+    if (tracked.unmappedTargeted) {
+      json.printf(",\"unmapped\":{\"ok\":%u,\"failed\":%u}", tracked.unmappedOk, tracked.unmappedFailed);
+    }
+    json.print("}");
+  }
+  Serial.printf("Command '%s' %s\n", tracked.id, tracked.success() ? "succeeded" : "failed");
+  publishCommandReply(tracked.replyTopic, sink);
+}
+
+// Commands with an ID that never started still get an answer
+void publishCommandRejected(const CommandEnvelope& envelope, const char* error) {
+  char payload[COMMAND_ID_LEN + 96];
+  TextBufferSink sink(payload, sizeof(payload));
+  {
+    TextWriter json(sink);
+    json.print("{\"id\":");
+    json.printJsonString(envelope.id);
+    json.print(",\"result\":\"rejected\",\"error\":");
+    json.printJsonString(error);
+    json.print("}");
+  }
+  publishCommandReply(envelope.replyTopic, sink);
+}
+
+void publishMqttStatus() {
+  for (int i = 0; i < config.stationCount; i++) {
+    publishStationState(i);
+  }
+}
+
+// Names are retained, published on connect and whenever one changes
+void publishMqttNames() {
+  if (!config.mqtt.enabled) return;
+  for (int i = 0; i < config.stationCount; i++) {
+    mqttOutbox.push(mqttTopics.lighthouseName[i], config.stations[i].name, OUTBOX_STATE | OUTBOX_RETAIN);
+  }
+}
+
+// After loadConfig(): topics from the stored settings, and whatever was still
+// undelivered before a crash or reset
+void setupMqtt() {
+  buildMqttTopics();
+  mqttSubscribedCrc = loadMqttSubscribedCrc();
+  size_t keptMessages = mqttOutbox.restore();
+  mqttClient.seedPacketId(mqttOutbox.lastPacketId);
+  if (keptMessages > 0) {
+    Serial.printf("MQTT outbox: %u messages kept across the reset\n", (unsigned)keptMessages);
+  }
+}
+
+// Connect right away once WiFi is up instead of waiting for the retry interval
+void mqttNetworkUp(unsigned long now) { lastMqttReconnectAttempt = now - MQTT_RECONNECT_INTERVAL_MS; }
+
+// Never waits for the broker: connecting, reading and keepalive are all
+// steps of mqttClient.loop()
+void serviceMqtt(unsigned long now) {
+  if (!config.mqtt.enabled) return;
+  if (mqttClient.loop(now)) {
+    serviceMqttOutbox();
+    return;
+  }
+  if (mqttClient.connecting()) return;
+  if (mqttAttemptOpen) {
+    mqttAttemptOpen = false;
+    reportMqttFailure();
+  }
+  if (now - lastMqttReconnectAttempt >= MQTT_RECONNECT_INTERVAL_MS) {
+    // Try to reconnect every 5 seconds; the outbox keeps what is published meanwhile
+    lastMqttReconnectAttempt = now;
+    connectMqtt();
+  }
+}
+
+// Connecting, or received messages still to hand out: the loop should not
+// idle long
+bool mqttBusy() { return mqttClient.connecting() || mqttClient.inboxPending() > 0; }
+
+// Topics are derived from the station list
+void mqttStationsChanged() {
+  buildMqttTopics();
+  if (mqttClient.connected()) {
+    mqttClient.disconnect(); // Reconnect resubscribes with the new topics
+  }
+}
+
+// The next connect sets the transport up from scratch, without the session
+// kept so far: it was established under the old settings
+void resetMqttTransport() {
+  mqttTransportStale = true;
+#if MQTT_TLS_SESSION_PERSIST
+  mqttTlsSession.magic = 0;
+#endif
+}
+
+// After the web UI changed server, topic or TLS settings
+void mqttSettingsChanged() {
+  buildMqttTopics();
+  resetMqttTransport();
+  mqttReconnectNow();
+}
+
+void mqttReconnectNow() {
+  if (mqttClient.connected() || mqttClient.connecting()) mqttClient.disconnect();
+  lastMqttReconnectAttempt = millis();
+  connectMqtt();
+}
+
+// PEM text, nullptr to remove it. Stored in NVS and used from the next
+// connect on.
+bool setMqttCaCert(const char* pem) {
+  if ((pem != nullptr && !TlsTransport::parsesAsCert(pem)) || !saveMqttCaCert(pem)) return false;
+  resetMqttTransport();
+  return true;
+}
+
+// From completeCommand()
+void mqttCycleDone(const CycleReport& report) { commandTracker.cycleDone(report, publishCommandResult); }
+
+// Stations were renumbered: report what is known for commands in flight
+void abandonCommandResults() { commandTracker.abandonAll(publishCommandResult); }
+
+#endif  // LH_WITH_MQTT
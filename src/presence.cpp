@@ -0,0 +1,97 @@
+/** Presence pre-wake component (LH_WITH_PRESENCE), see controller.h.
+ */
+#include "controller.h"
+
+#if LH_WITH_PRESENCE
+
+// Presence of the VR PC (see presence_tracker.h). The LAN probe is a
+// non-blocking TCP connect: an accepted connection or a reset both prove the
+// PC is up, only silence until the timeout counts as absent. This needs no
+// raw sockets (ICMP) and works whether or not anything listens on the port.
+// With config.presence.portOnly a reset counts as absent, so presence follows
+// a service (Steam) rather than the machine.
+// Scenes "presence-on" / "presence-off" replace the default all on / all off.
+#define PRESENCE_PROBE_INTERVAL_MS 5000
+#define PRESENCE_PROBE_TIMEOUT_MS 1500
+#define PRESENCE_ON_SCENE "presence-on"
+#define PRESENCE_OFF_SCENE "presence-off"
+
+PresenceTracker presence;
+
+PresenceProbe presenceProbe = {-1};
+
+void finishPresenceProbe(bool reachable) {
+  close(presenceProbe.fd);
+  presenceProbe.fd = -1;
+  presence.probeResult(reachable);
+}
+
+void startPresenceProbe() {
+  IPAddress ip;
+  if (!ip.fromString(config.presence.host)) return;
+  presenceProbe.lastStarted = millis();
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.presence.port);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+  presenceProbe.fd = fd;
+  presenceProbe.startedAt = millis();
+  presenceProbe.probes++;
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+    finishPresenceProbe(true);
+  } else if (errno != EINPROGRESS) {
+    finishPresenceProbe(errno == ECONNREFUSED && !config.presence.portOnly);
+  }
+}
+
+// Check the pending connect without waiting
+void pollPresenceProbe() {
+  fd_set writable;
+  FD_ZERO(&writable);
+  FD_SET(presenceProbe.fd, &writable);
+  struct timeval noWait = {0, 0};
+  if (select(presenceProbe.fd + 1, nullptr, &writable, nullptr, &noWait) > 0) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(presenceProbe.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    finishPresenceProbe(error == 0 || (error == ECONNREFUSED && !config.presence.portOnly));
+  } else if (millis() - presenceProbe.startedAt >= PRESENCE_PROBE_TIMEOUT_MS) {
+    finishPresenceProbe(false);
+  }
+}
+
+void servicePresence() {
+  if (!config.presence.enabled) return;
+  unsigned long now = millis();
+  if (presenceProbe.fd >= 0) {
+    pollPresenceProbe();
+  } else if (config.presence.host[0] != '\0' && WiFi.status() == WL_CONNECTED &&
+             now - presenceProbe.lastStarted >= PRESENCE_PROBE_INTERVAL_MS) {
+    startPresenceProbe();
+  }
+
+  switch (presence.update(now, (uint32_t)config.presence.graceS * 1000)) {
+    case PRESENCE_WAKE:
+      Serial.println("VR PC present, pre-waking the stations");
+      if (!runScene(PRESENCE_ON_SCENE, SOURCE_PRESENCE)) {
+        submitCommand(TURN_ON_PERM, BatchPlan::all(ACTION_ON, config.stationCount), SOURCE_PRESENCE);
+      }
+      break;
+    case PRESENCE_SLEEP:
+      Serial.printf("VR PC gone for %u s, putting the stations to sleep\n", (unsigned)config.presence.graceS);
+      if (!runScene(PRESENCE_OFF_SCENE, SOURCE_PRESENCE)) {
+        submitCommand(TURN_OFF, BatchPlan::all(ACTION_OFF, config.stationCount), SOURCE_PRESENCE);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// From completeCommand(): an ON command finished, for the wake latency stats
+void presenceWakeCompleted(bool success) { presence.wakeCompleted(millis(), success); }
+
+#endif  // LH_WITH_PRESENCE
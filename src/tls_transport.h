@@ -0,0 +1,540 @@
+/** Non-blocking TCP transport for MqttClient, optionally TLS with session
+ * resumption. Part of the MQTT component (LH_WITH_MQTT), see controller.h.
+ *
+ * Nothing here waits for the network. connectStart() only starts the name
+ * lookup; connectPoll(), called from the loop, moves the connection through
+ * lookup, TCP connect and TLS handshake and reports when it is open, so a
+ * broker that is down or unreachable costs a few polls instead of seconds of
+ * the loop. The lookup runs on the lwIP thread, TCP connects in the
+ * background, and the handshake is stepped as the broker's answers arrive.
+ * Writes go into tx_ and leave as the socket takes them; reads only return
+ * what has already arrived.
+ *
+ * A full TLS handshake costs the ESP32 one to two seconds of key exchange and
+ * certificate checking, on every reconnect. Those steps are computation that
+ * cannot be split, so each runs to its end inside one poll, but the poll
+ * returns after TLS_STEP_BUDGET_US so the loop gets a turn between them.
+ * After the first handshake the session (a ticket if the broker issues them,
+ * otherwise the session ID) is kept and offered on the next connect to the
+ * same host and port. A broker that still knows it skips the key exchange and
+ * the certificate: one round trip, no public key operations. A broker that
+ * has forgotten it simply does a full handshake, so offering a stale session
+ * costs nothing.
+ *
+ * exportSession() and importSession() move the session through TlsSessionBlob,
+ * plain data the firmware keeps in RTC memory so resumption also survives a
+ * soft reset or deep sleep.
+ *
+ * Without a CA certificate the connection is encrypted but the broker is not
+ * authenticated. With one, the broker's certificate must chain to it and name
+ * the host connected to.
+ *
+ * Written against lwIP and mbedtls 2.28 as shipped with the ESP32 Arduino
+ * core 2.x (platformio.ini pins the platform). Whether the broker took the
+ * offered session is read from the session it negotiated, which mbedtls 3
+ * no longer exposes.
+ */
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include <esp_timer.h>
+#include <lwip/dns.h>
+#include <lwip/sockets.h>
+#include <lwip/tcpip.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/version.h>
+#include <mbedtls/x509_crt.h>
+
+#include "config_store.h"
+#include "mqtt_client.h"
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#error "tls_transport.h compares mbedtls_ssl_session fields, which are private from mbedtls 3"
+#endif
+
+#define TLS_CONNECT_TIMEOUT_MS 3000  // Name lookup and TCP connect, each
+#define TLS_HANDSHAKE_TIMEOUT_MS 10000
+#define TLS_STEP_BUDGET_US 20000  // A poll runs no further handshake steps after this
+#ifndef TLS_TX_BUFFER_BYTES
+#define TLS_TX_BUFFER_BYTES 2048  // Written but not yet taken by the socket
+#endif
+#ifndef TLS_SESSION_BLOB_BYTES
+#define TLS_SESSION_BLOB_BYTES 1280  // Ticket plus the broker's certificate
+#endif
+#define TLS_SESSION_MAGIC 0x53534C54u  // "TLSS"
+
+struct TlsStats {
+  uint32_t handshakes;  // Completed, resumed ones included
+  uint32_t resumed;
+  uint32_t failures;    // Lookup, TCP connect or handshake failed
+  int lastError;        // mbedtls error or -errno of the last failure
+  bool lastResumed;
+  uint32_t lastOpenMs;  // connectStart() to open: lookup, TCP connect and handshake
+};
+
+// A session as plain data, see exportSession()
+struct TlsSessionBlob {
+  uint32_t magic;
+  uint32_t crc;  // CRC-32 of everything after it, up to the end of data[len]
+  char host[64];
+  uint16_t port;
+  uint16_t len;
+  uint8_t data[TLS_SESSION_BLOB_BYTES];
+
+  size_t crcLength() const { return offsetof(TlsSessionBlob, data) - offsetof(TlsSessionBlob, host) + len; }
+  void seal() { crc = configCrc32(reinterpret_cast<const uint8_t*>(host), crcLength()); }
+  bool valid() const {
+    return magic == TLS_SESSION_MAGIC && len <= sizeof(data) &&
+           crc == configCrc32(reinterpret_cast<const uint8_t*>(host), crcLength());
+  }
+};
+
+class TlsTransport {
+ public:
+  TlsTransport() {
+    mbedtls_ssl_init(&ssl_);
+    mbedtls_ssl_config_init(&conf_);
+    mbedtls_ctr_drbg_init(&drbg_);
+    mbedtls_entropy_init(&entropy_);
+    mbedtls_x509_crt_init(&ca_);
+    mbedtls_ssl_session_init(&session_);
+  }
+
+  ~TlsTransport() {
+    stop();
+    mbedtls_ssl_session_free(&session_);
+    mbedtls_x509_crt_free(&ca_);
+    mbedtls_ssl_free(&ssl_);
+    mbedtls_ssl_config_free(&conf_);
+    mbedtls_ctr_drbg_free(&drbg_);
+    mbedtls_entropy_free(&entropy_);
+  }
+
+  TlsTransport(const TlsTransport&) = delete;
+  TlsTransport& operator=(const TlsTransport&) = delete;
+
+  // Both take effect at the next connectStart()
+  void setTls(bool enabled) {
+    if (enabled != tls_) forgetSession();
+    tls_ = enabled;
+  }
+  bool tls() const { return tls_; }
+  void setResumption(bool enabled) { resumption_ = enabled; }
+  bool resumption() const { return resumption_; }
+
+  // NUL-terminated PEM, nullptr to stop checking the broker. Returns false
+  // (and checks nothing) if it does not parse.
+  bool setCACert(const char* pem) {
+    mbedtls_x509_crt_free(&ca_);
+    mbedtls_x509_crt_init(&ca_);
+    caLoaded_ = pem != nullptr && mbedtls_x509_crt_parse(&ca_, reinterpret_cast<const uint8_t*>(pem), strlen(pem) + 1) == 0;
+    forgetSession();  // It was established under different rules
+    return caLoaded_ || pem == nullptr;
+  }
+  bool verifying() const { return caLoaded_; }
+
+  // Check a PEM certificate before storing it
+  static bool parsesAsCert(const char* pem) {
+    mbedtls_x509_crt cert;
+    mbedtls_x509_crt_init(&cert);
+    bool parsed = mbedtls_x509_crt_parse(&cert, reinterpret_cast<const uint8_t*>(pem), strlen(pem) + 1) == 0;
+    mbedtls_x509_crt_free(&cert);
+    return parsed;
+  }
+
+  // Start connecting, connectPoll() does the rest. False if it cannot even
+  // start.
+  bool connectStart(const char* host, uint16_t port, uint32_t nowMs) {
+    stop();
+    if (strlen(host) >= sizeof(host_)) {
+      fail(-ENAMETOOLONG);
+      return false;
+    }
+    // A lookup the lwIP thread is still working on cannot be taken back:
+    // wait for it if it is for the same host, otherwise try again later
+    bool pending = dns_.status.load(std::memory_order_acquire) == DNS_PENDING;
+    if (pending && strcmp(dns_.host, host) != 0) {
+      fail(-EBUSY);
+      return false;
+    }
+    if (!pending) {
+      strcpy(dns_.host, host);
+      dns_.status.store(DNS_PENDING, std::memory_order_release);
+      if (tcpip_callback(startLookup, &dns_) != ERR_OK) {
+        dns_.status.store(DNS_FAILED, std::memory_order_release);
+        fail(-ENOMEM);
+        return false;
+      }
+    }
+    strcpy(host_, host);
+    port_ = port;
+    startedMs_ = nowMs;
+    enterPhase(PHASE_RESOLVING, nowMs);
+    return true;
+  }
+
+  // Take the connection as far as it gets without waiting
+  TransportStatus connectPoll(uint32_t nowMs) {
+    if (phase_ == PHASE_RESOLVING) {
+      int8_t status = dns_.status.load(std::memory_order_acquire);
+      if (status == DNS_PENDING) {
+        return nowMs - phaseStartedMs_ >= TLS_CONNECT_TIMEOUT_MS ? fail(-ETIMEDOUT) : TRANSPORT_PENDING;
+      }
+      if (status != DNS_FOUND) return fail(-EHOSTUNREACH);
+      int error = openSocket(dns_.address);
+      if (error != 0) return fail(-error);
+      enterPhase(PHASE_CONNECTING, nowMs);
+    }
+    if (phase_ == PHASE_CONNECTING) {
+      int error = connectResult();
+      if (error == EINPROGRESS) {
+        return nowMs - phaseStartedMs_ >= TLS_CONNECT_TIMEOUT_MS ? fail(-ETIMEDOUT) : TRANSPORT_PENDING;
+      }
+      if (error != 0) return fail(-error);
+      if (!tls_) return opened(nowMs);
+      if (!handshakeStart()) return fail(stats_.lastError);
+      enterPhase(PHASE_HANDSHAKING, nowMs);
+    }
+    if (phase_ == PHASE_HANDSHAKING) return handshakeStep(nowMs);
+    return phase_ == PHASE_OPEN ? TRANSPORT_OPEN : TRANSPORT_FAILED;
+  }
+
+  bool connected() {
+    if (phase_ != PHASE_OPEN) return false;
+    flush();
+    fill();
+    return !closed_;
+  }
+
+  int available() {
+    if (phase_ != PHASE_OPEN) return 0;
+    fill();
+    return (int)(rxLen_ - rxPos_);
+  }
+
+  int read() {
+    if (available() <= 0) return -1;
+    return rx_[rxPos_++];
+  }
+
+  // Room for write(), which takes all of its data or none
+  int availableForWrite() const { return phase_ == PHASE_OPEN && !closed_ ? (int)(sizeof(tx_) - txLen_) : 0; }
+
+  size_t write(const uint8_t* data, size_t len) {
+    if (len > (size_t)availableForWrite()) return 0;
+    memcpy(tx_ + txLen_, data, len);
+    txLen_ += len;
+    flush();
+    return len;
+  }
+
+  // What the socket takes of the unsent data still goes out
+  void stop() {
+    if (phase_ == PHASE_OPEN && !closed_) {
+      flush();
+      if (tls_) mbedtls_ssl_close_notify(&ssl_);
+    }
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    phase_ = PHASE_IDLE;
+    closed_ = false;
+    rxPos_ = rxLen_ = 0;
+    txLen_ = tlsPending_ = 0;
+  }
+
+  bool haveSession() const { return haveSession_; }
+
+  void forgetSession() {
+    mbedtls_ssl_session_free(&session_);
+    mbedtls_ssl_session_init(&session_);
+    haveSession_ = false;
+  }
+
+  // False if there is no session or it does not fit; the RAM copy still works
+  bool exportSession(TlsSessionBlob& blob) const {
+    size_t len = 0;
+    if (!haveSession_ || mbedtls_ssl_session_save(&session_, blob.data, sizeof(blob.data), &len) != 0) return false;
+    blob.magic = TLS_SESSION_MAGIC;
+    strncpy(blob.host, sessionHost_, sizeof(blob.host));
+    blob.port = sessionPort_;
+    blob.len = (uint16_t)len;
+    blob.seal();
+    return true;
+  }
+
+  bool importSession(const TlsSessionBlob& blob) {
+    if (!tls_ || !blob.valid()) return false;
+    forgetSession();
+    if (mbedtls_ssl_session_load(&session_, blob.data, blob.len) != 0) {
+      forgetSession();
+      return false;
+    }
+    strncpy(sessionHost_, blob.host, sizeof(sessionHost_) - 1);
+    sessionPort_ = blob.port;
+    haveSession_ = true;
+    return true;
+  }
+
+  const TlsStats& stats() const { return stats_; }
+
+ private:
+  enum Phase : uint8_t { PHASE_IDLE, PHASE_RESOLVING, PHASE_CONNECTING, PHASE_HANDSHAKING, PHASE_OPEN };
+  enum DnsStatus : int8_t { DNS_FAILED = -1, DNS_IDLE, DNS_PENDING, DNS_FOUND };
+
+  // The lwIP thread writes the address, then the status
+  struct DnsLookup {
+    char host[64] = "";
+    uint32_t address = 0;  // IPv4, network order
+    std::atomic<int8_t> status{DNS_IDLE};
+  };
+
+  // On the lwIP thread. Numeric addresses and cached names answer at once.
+  static void startLookup(void* context) {
+    DnsLookup* lookup = static_cast<DnsLookup*>(context);
+    ip_addr_t address;
+    err_t err = dns_gethostbyname_addrtype(lookup->host, &address, lookupDone, lookup, LWIP_DNS_ADDRTYPE_IPV4);
+    if (err == ERR_OK) {
+      lookupDone(lookup->host, &address, lookup);
+    } else if (err != ERR_INPROGRESS) {
+      lookupDone(lookup->host, nullptr, lookup);
+    }
+  }
+
+  static void lookupDone(const char* name, const ip_addr_t* address, void* context) {
+    DnsLookup* lookup = static_cast<DnsLookup*>(context);
+    if (address != nullptr) lookup->address = ip_2_ip4(address)->addr;
+    lookup->status.store(address != nullptr ? DNS_FOUND : DNS_FAILED, std::memory_order_release);
+  }
+
+  void enterPhase(Phase phase, uint32_t nowMs) {
+    phase_ = phase;
+    phaseStartedMs_ = nowMs;
+  }
+
+  TransportStatus fail(int error) {
+    stats_.failures++;
+    stats_.lastError = error;
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    phase_ = PHASE_IDLE;
+    return TRANSPORT_FAILED;
+  }
+
+  TransportStatus opened(uint32_t nowMs) {
+    stats_.lastOpenMs = nowMs - startedMs_;
+    phase_ = PHASE_OPEN;
+    return TRANSPORT_OPEN;
+  }
+
+  // Non-blocking socket with the connect under way. Returns 0 or an errno.
+  int openSocket(uint32_t address) {
+    fd_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd_ < 0) return errno;
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+    int noDelay = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    struct sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port_);
+    server.sin_addr.s_addr = address;
+    if (::connect(fd_, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) == 0) return 0;
+    return errno == EINPROGRESS ? 0 : errno;
+  }
+
+  // 0 once connected, EINPROGRESS while still connecting, otherwise the error
+  int connectResult() {
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd_, &writable);
+    struct timeval noWait = {0, 0};
+    int ready = select(fd_ + 1, nullptr, &writable, nullptr, &noWait);
+    if (ready < 0) return errno;
+    if (ready == 0) return EINPROGRESS;
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &errorLen) != 0) return errno;
+    return error;
+  }
+
+  bool setupTls() {
+    if (tlsReady_) return true;
+    static const char kPersonalization[] = "lighthouse-mqtt";
+    tlsReady_ = mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_,
+                                      reinterpret_cast<const uint8_t*>(kPersonalization), sizeof(kPersonalization)) == 0 &&
+                mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                            MBEDTLS_SSL_PRESET_DEFAULT) == 0;
+    if (!tlsReady_) return false;
+    mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    tlsReady_ = mbedtls_ssl_setup(&ssl_, &conf_) == 0;
+    return tlsReady_;
+  }
+
+  bool handshakeStart() {
+    int rc = setupTls() ? mbedtls_ssl_session_reset(&ssl_) : MBEDTLS_ERR_SSL_ALLOC_FAILED;
+    if (rc == 0) rc = mbedtls_ssl_set_hostname(&ssl_, host_);
+    if (rc != 0) {
+      stats_.lastError = rc;
+      return false;
+    }
+    mbedtls_ssl_conf_authmode(&conf_, caLoaded_ ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_ca_chain(&conf_, caLoaded_ ? &ca_ : nullptr, nullptr);
+    mbedtls_ssl_set_bio(&ssl_, this, sendCallback, recvCallback, nullptr);
+    offered_ = resumption_ && haveSession_ && sessionPort_ == port_ && strcmp(sessionHost_, host_) == 0 &&
+               mbedtls_ssl_set_session(&ssl_, &session_) == 0;
+    resumed_ = false;
+    return true;
+  }
+
+  bool handshakeOver() const {
+#if MBEDTLS_VERSION_NUMBER >= 0x03020000
+    return mbedtls_ssl_is_handshake_over(&ssl_);
+#else
+    return ssl_.state == MBEDTLS_SSL_HANDSHAKE_OVER;  // No accessor before 3.2
+#endif
+  }
+
+  // mbedtls_ssl_handshake() one step at a time, so the loop gets a turn
+  // between the expensive ones
+  TransportStatus handshakeStep(uint32_t nowMs) {
+    if (nowMs - phaseStartedMs_ >= TLS_HANDSHAKE_TIMEOUT_MS) return handshakeFailed(MBEDTLS_ERR_SSL_TIMEOUT);
+    int64_t budgetEnd = esp_timer_get_time() + TLS_STEP_BUDGET_US;
+    while (!handshakeOver()) {
+      int rc = mbedtls_ssl_handshake_step(&ssl_);
+      if (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE) return TRANSPORT_PENDING;
+      if (rc != 0) return handshakeFailed(rc);
+      if (esp_timer_get_time() >= budgetEnd) return TRANSPORT_PENDING;
+    }
+
+    // A resumed session keeps the master secret of the one offered, a full
+    // handshake derives a new one. The session ID cannot tell: with a ticket
+    // the client sends a fresh random ID that the broker echoes.
+    mbedtls_ssl_session negotiated;
+    mbedtls_ssl_session_init(&negotiated);
+    bool haveNegotiated = mbedtls_ssl_get_session(&ssl_, &negotiated) == 0;
+    resumed_ = offered_ && haveNegotiated && memcmp(negotiated.master, session_.master, sizeof(session_.master)) == 0;
+    stats_.handshakes++;
+    if (resumed_) stats_.resumed++;
+    stats_.lastResumed = resumed_;
+    // The session just resumed or a new one, possibly with a fresh ticket
+    forgetSession();
+    if (resumption_ && haveNegotiated) {
+      session_ = negotiated;  // Takes over its certificate and ticket
+      haveSession_ = true;
+      strcpy(sessionHost_, host_);
+      sessionPort_ = port_;
+    } else {
+      mbedtls_ssl_session_free(&negotiated);
+    }
+    return opened(nowMs);
+  }
+
+  TransportStatus handshakeFailed(int rc) {
+    // Do not offer it again if the broker chokes on it
+    if (offered_) forgetSession();
+    return fail(rc);
+  }
+
+  static int sendCallback(void* context, const unsigned char* data, size_t len) {
+    TlsTransport* self = static_cast<TlsTransport*>(context);
+    int n = ::send(self->fd_, data, len, MSG_DONTWAIT);
+    if (n >= 0) return n;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+
+  static int recvCallback(void* context, unsigned char* data, size_t len) {
+    TlsTransport* self = static_cast<TlsTransport*>(context);
+    int n = ::recv(self->fd_, data, len, MSG_DONTWAIT);
+    if (n >= 0) return n;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+  }
+
+  // Hand tx_ to the socket as far as it takes it. After WANT_WRITE mbedtls
+  // has to be called again with the same length.
+  void flush() {
+    while (txLen_ > 0 && !closed_) {
+      int n;
+      if (tls_) {
+        size_t len = tlsPending_ > 0 ? tlsPending_ : txLen_;
+        n = mbedtls_ssl_write(&ssl_, tx_, len);
+        if (n == MBEDTLS_ERR_SSL_WANT_WRITE || n == MBEDTLS_ERR_SSL_WANT_READ) {
+          tlsPending_ = len;
+          return;
+        }
+        tlsPending_ = 0;
+      } else {
+        n = ::send(fd_, tx_, txLen_, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+      }
+      if (n <= 0) {
+        closed_ = true;
+        return;
+      }
+      memmove(tx_, tx_ + n, txLen_ - n);
+      txLen_ -= n;
+    }
+  }
+
+  // Pull whatever has arrived into rx_
+  void fill() {
+    if (rxPos_ < rxLen_ || closed_) return;
+    rxPos_ = rxLen_ = 0;
+    int n;
+    bool wouldBlock;
+    if (tls_) {
+      n = mbedtls_ssl_read(&ssl_, rx_, sizeof(rx_));
+      wouldBlock = n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE;
+    } else {
+      n = ::recv(fd_, rx_, sizeof(rx_), MSG_DONTWAIT);
+      wouldBlock = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    if (n > 0) {
+      rxLen_ = n;
+    } else if (!wouldBlock) {
+      closed_ = true;  // Closed by the broker, or broken
+    }
+  }
+
+  int fd_ = -1;
+  Phase phase_ = PHASE_IDLE;
+  bool closed_ = false;
+  bool tls_ = false;
+  bool resumption_ = true;
+  bool tlsReady_ = false;
+  bool caLoaded_ = false;
+  bool offered_ = false;  // A kept session was offered in this handshake
+  bool resumed_ = false;
+  char host_[64] = "";
+  uint16_t port_ = 0;
+  uint32_t startedMs_ = 0;
+  uint32_t phaseStartedMs_ = 0;
+  DnsLookup dns_;
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  mbedtls_ctr_drbg_context drbg_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_x509_crt ca_;
+  mbedtls_ssl_session session_;
+  bool haveSession_ = false;
+  char sessionHost_[64] = "";
+  uint16_t sessionPort_ = 0;
+  TlsStats stats_ = {};
+  uint8_t rx_[256];
+  size_t rxPos_ = 0;
+  size_t rxLen_ = 0;
+  uint8_t tx_[TLS_TX_BUFFER_BYTES];
+  size_t txLen_ = 0;
+  size_t tlsPending_ = 0;  // Length of the mbedtls_ssl_write() to repeat
+};
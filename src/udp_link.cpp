@@ -0,0 +1,254 @@
+/** UDP control component (LH_WITH_UDP), see controller.h.
+ */
+#include "controller.h"
+
+#if LH_WITH_UDP
+
+#include <mbedtls/md.h>
+
+// Binary control datagrams (see udp_control.h). The socket is non-blocking
+// and read into a fixed buffer from loop(); each command request gets an ack
+// at once and then a status datagram whenever its stations make progress,
+// the last one with UDP_PHASE_DONE. Status goes to the last
+// UDP_STREAMS_MAX senders; a newer request takes over the oldest stream.
+#define UDP_RECEIVE_BURST 4  // Datagrams handled per loop() pass
+#define UDP_SEQUENCE_SAVE_SPACING_MS 1000  // Between NVS writes of the sequence mark
+
+UdpControl udpControl = {-1};
+
+// Keyed replay protection across reboots (see UdpSequenceMark). Every
+// accepted request updates the RTC copy, which survives a crash or soft
+// reset. Commands also mark the NVS copy dirty; serviceUdpControl() writes
+// it on a pass without datagrams, so acks never wait on flash. Pings are
+// harmless to replay and stay out of flash.
+RTC_NOINIT_ATTR UdpSequenceMark udpSequenceRtc;
+static bool udpSequenceDirty = false;
+static unsigned long udpSequenceSavedAt = 0;
+
+// Guard from the newer of the RTC and NVS copies for the current key
+void restoreUdpSequence() {
+  uint32_t keyCrc = udpKeyCrc(config.udp.key);
+  UdpSequenceMark stored;
+  bool haveStored = loadUdpSequenceMark(stored) && stored.valid(keyCrc);
+  bool haveRtc = udpSequenceRtc.valid(keyCrc);
+  if (haveRtc && haveStored && (int16_t)(stored.last - udpSequenceRtc.last) > 0) haveRtc = false;
+  if (!haveRtc && !haveStored) return;
+  udpControl.sequence.accept(haveRtc ? udpSequenceRtc.last : stored.last);
+  Serial.printf("UDP control: sequence %u restored\n", udpControl.sequence.last());
+}
+
+void acceptUdpSequence(uint16_t seq, bool command) {
+  udpControl.sequence.accept(seq);
+  udpSequenceRtc.set(udpKeyCrc(config.udp.key), seq);
+  if (command) udpSequenceDirty = true;
+}
+
+void flushUdpSequence() {
+  if (!udpSequenceDirty || millis() - udpSequenceSavedAt < UDP_SEQUENCE_SAVE_SPACING_MS) return;
+  udpSequenceDirty = false;
+  udpSequenceSavedAt = millis();
+  if (!saveUdpSequenceMark(udpSequenceRtc)) Serial.println("❌ UDP control: sequence not saved");
+}
+
+void udpTag(const uint8_t* data, size_t len, uint8_t* tag) {
+  uint8_t digest[32];
+  mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t*)config.udp.key,
+                  strlen(config.udp.key), data, len, digest);
+  memcpy(tag, digest, UDP_TAG_LEN);
+}
+
+void udpSend(const struct sockaddr_in& peer, uint8_t* frame, size_t len) {
+  if (config.udp.key[0] != '\0') {
+    udpTag(frame, len, frame + len);
+    len += UDP_TAG_LEN;
+  }
+  sendto(udpControl.fd, frame, len, 0, (const struct sockaddr*)&peer, sizeof(peer));
+}
+
+void udpSendAck(const struct sockaddr_in& peer, uint16_t seq, UdpAckCode code) {
+  uint8_t frame[UDP_FRAME_MAX];
+  udpSend(peer, frame, encodeUdpAck(frame, seq, code));
+}
+
+void udpSendStatus(UdpStream& stream, UdpPhase phase, uint8_t switched, uint8_t failed) {
+  if (phase == stream.sentPhase && switched == stream.sentSwitched && failed == stream.sentFailed) return;
+  stream.sentPhase = phase;
+  stream.sentSwitched = switched;
+  stream.sentFailed = failed;
+  uint8_t frame[UDP_FRAME_MAX];
+  udpSend(stream.peer, frame,
+          encodeUdpStatus(frame, stream.seq, phase, stream.targets, switched, failed, millis() - stream.receivedAt));
+}
+
+void closeUdpControl() {
+  if (udpControl.fd < 0) return;
+  close(udpControl.fd);
+  udpControl.fd = -1;
+  for (UdpStream& stream : udpControl.streams) stream.active = false;
+}
+
+void openUdpControl() {
+  int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) return;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.udp.port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    Serial.printf("❌ UDP control port %u unavailable\n", config.udp.port);
+    close(fd);
+    return;
+  }
+  udpControl.fd = fd;
+  udpControl.boundPort = config.udp.port;
+  Serial.printf("UDP control listening on port %u%s\n", config.udp.port,
+                config.udp.key[0] != '\0' ? " (authenticated)" : "");
+}
+
+bool samePeer(const struct sockaddr_in& a, const struct sockaddr_in& b) {
+  return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+void startUdpStream(const struct sockaddr_in& peer, const UdpRequest& request, const BatchPlan& plan) {
+  UdpStream* slot = &udpControl.streams[0];
+  for (UdpStream& stream : udpControl.streams) {
+    if (!stream.active) {
+      slot = &stream;
+      break;
+    }
+    if ((long)(stream.receivedAt - slot->receivedAt) < 0) slot = &stream;  // Older
+  }
+  *slot = UdpStream{};
+  slot->active = true;
+  slot->peer = peer;
+  slot->seq = request.seq;
+  slot->firstCycle = engine.cycles + 1;
+  slot->receivedAt = millis();
+  for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+    if (plan.actions[i] != ACTION_NONE) slot->targets |= 1u << i;
+  }
+}
+
+void handleUdpDatagram(const uint8_t* frame, size_t len, const struct sockaddr_in& peer) {
+  beginCommandTrace();
+  bool keyed = config.udp.key[0] != '\0';
+  UdpRequest request;
+  UdpAckCode code = decodeUdpRequest(frame, len, keyed, request);
+  if (code == UDP_ACK_BAD_FRAME) {
+    udpControl.rejected++;
+    // With a key, nothing goes back to a sender that could not even frame a request
+    if (!keyed && len >= 6) udpSendAck(peer, (uint16_t)(frame[4] << 8 | frame[5]), code);
+    return;
+  }
+  if (keyed) {
+    uint8_t tag[UDP_TAG_LEN];
+    udpTag(frame, UDP_REQUEST_LEN, tag);
+    if (!udpTagsEqual(tag, frame + UDP_REQUEST_LEN)) {
+      udpControl.rejected++;
+      udpSendAck(peer, request.seq, UDP_ACK_BAD_TAG);
+      return;
+    }
+  }
+
+  // First authenticated request since boot or a key change
+  if (keyed && !udpControl.sequence.valid()) restoreUdpSequence();
+
+  bool repeat = udpControl.lastValid && request.seq == udpControl.lastSeq && samePeer(peer, udpControl.lastPeer);
+  if (keyed && !repeat && udpControl.sequence.check(request.seq) != UDP_SEQ_NEW) {
+    udpControl.rejected++;
+    udpSendAck(peer, request.seq, UDP_ACK_REPLAY);
+    return;
+  }
+  if (repeat) {
+    // The ack was lost, the sender tries again: answer, but run nothing
+    udpControl.repeats++;
+    udpSendAck(peer, request.seq, (UdpAckCode)udpControl.lastAck);
+    return;
+  }
+
+  BatchPlan plan;
+  if (request.type == UDP_PING) {
+    code = UDP_ACK_PONG;
+    udpControl.pings++;
+  } else if (!udpRequestPlan(request, config.stationCount, plan)) {
+    code = UDP_ACK_BAD_TARGET;
+    udpControl.rejected++;
+  } else {
+    udpControl.commands++;
+    uint8_t command = request.action == ACTION_ON ? TURN_ON_PERM : request.action == ACTION_OFF ? TURN_OFF : TURN_STANDBY;
+    startUdpStream(peer, request, plan);
+    code = submitCommand(command, plan, SOURCE_UDP) ? UDP_ACK_STARTED : UDP_ACK_QUEUED;
+  }
+  if (keyed) acceptUdpSequence(request.seq, request.type == UDP_COMMAND);
+  udpControl.lastPeer = peer;
+  udpControl.lastSeq = request.seq;
+  udpControl.lastAck = code;
+  udpControl.lastValid = true;
+  udpSendAck(peer, request.seq, code);
+}
+
+// Outcomes of the running cycle so far, on top of what earlier cycles decided
+void udpStreamMasks(const UdpStream& stream, const CycleReport& report, uint8_t& switched, uint8_t& failed) {
+  switched = stream.switched;
+  failed = stream.failed;
+  for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+    uint8_t bit = 1u << i;
+    if (!(stream.targets & bit) || report.stations[i].outcome == OUTCOME_PENDING) continue;
+    bool ok = report.stations[i].outcome == OUTCOME_OK;
+    switched = ok ? switched | bit : switched & ~bit;
+    failed = ok ? failed & ~bit : failed | bit;
+  }
+}
+
+// From completeCommand(): fold the finished cycle into the streams it served
+// and close those whose command is complete
+void udpCycleDone(const CycleReport& report) {
+  if (udpControl.fd < 0) return;
+  for (UdpStream& stream : udpControl.streams) {
+    if (!stream.active || report.cycle < stream.firstCycle) continue;
+    udpStreamMasks(stream, report, stream.switched, stream.failed);
+    if (report.preempted) continue;  // The rest is carried over to the next cycle
+    udpSendStatus(stream, UDP_PHASE_DONE, stream.switched, stream.failed);
+    stream.active = false;
+  }
+}
+
+void serviceUdpControl() {
+  if (!config.udp.enabled || WiFi.status() != WL_CONNECTED) {
+    closeUdpControl();
+    return;
+  }
+  if (udpControl.fd >= 0 && udpControl.boundPort != config.udp.port) closeUdpControl();
+  if (udpControl.fd < 0) {
+    openUdpControl();
+    if (udpControl.fd < 0) return;
+  }
+
+  int handled = 0;
+  for (; handled < UDP_RECEIVE_BURST; handled++) {
+    uint8_t frame[UDP_FRAME_MAX + 1];  // One spare byte shows oversized datagrams
+    struct sockaddr_in peer;
+    socklen_t peerLen = sizeof(peer);
+    int len = recvfrom(udpControl.fd, frame, sizeof(frame), 0, (struct sockaddr*)&peer, &peerLen);
+    if (len < 0) break;
+    udpControl.received++;
+    handleUdpDatagram(frame, len, peer);
+  }
+  if (handled == 0) flushUdpSequence();
+
+  // Progress of the running cycle
+  bool running = currentCommand != NOTHING && currentCommand != CAPTURE_TRACE;
+  for (UdpStream& stream : udpControl.streams) {
+    if (!stream.active) continue;
+    if (!running || engine.cycles < stream.firstCycle) {
+      udpSendStatus(stream, UDP_PHASE_QUEUED, stream.switched, stream.failed);
+      continue;
+    }
+    uint8_t switched, failed;
+    udpStreamMasks(stream, cycleReport, switched, failed);
+    udpSendStatus(stream, engine.phase == PHASE_SCAN ? UDP_PHASE_SCANNING : UDP_PHASE_SWITCHING, switched, failed);
+  }
+}
+
+#endif  // LH_WITH_UDP
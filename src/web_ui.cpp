@@ -0,0 +1,1288 @@
+/** Web interface and JSON API component (LH_WITH_WEB), see controller.h.
+ */
+#include "controller.h"
+
+#if LH_WITH_WEB
+
+#include <WebServer.h>
+#include <LittleFS.h>
+#include <esp_timer.h>
+
+#include "chunked_writer.h"
+#include "lighthouse_protocol.h"
+
+#define LH_RENAME_MAX_LEN 20
+
+WebServer server(80);
+bool webServerStarted = false;
+
+// Pages are streamed in chunks through a small stack buffer instead of being
+// concatenated into one String, so rendering does not fragment the heap.
+typedef ChunkedWriter<WebServer> PageWriter;
+
+void beginChunkedResponse(int code, const char* contentType) {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(code, contentType, "");
+}
+
+// Short fixed responses ("Turning ON...", errors) are formatted on the stack
+void sendMessagePage(int code, const char* format, ...) {
+  char body[192];
+  int len = snprintf(body, sizeof(body), "<html><body><h1>");
+  va_list args;
+  va_start(args, format);
+  len += vsnprintf(body + len, sizeof(body) - len, format, args);
+  va_end(args);
+  if (len < sizeof(body)) {
+    snprintf(body + len, sizeof(body) - len, "</h1><p><a href='/'>Back</a></p></body></html>");
+  }
+  server.send_P(code, "text/html", body);
+}
+
+// Heavy pages are refused while the heap is low (see updateHeapStats)
+bool rejectWhileShedding() {
+  if (!heapStats.shedding) return false;
+  server.send_P(503, "text/plain", "Low memory, try again shortly");
+  return true;
+}
+
+// Static UI assets. The sources live in web/; tools/gzip_assets.py compresses
+// them into data/ at build time and `pio run -t uploadfs` puts them on the
+// LittleFS partition. Pages link them as /app.css?v=<etag>, so browsers cache
+// them for good and only the small dynamic HTML is sent on each visit.
+struct StaticAsset {
+  const char* path;         // URL
+  const char* file;         // Compressed file on LittleFS
+  const char* contentType;
+  uint32_t crc;             // CRC-32 of the compressed file, the strong ETag
+  char etag[11];            // Quoted ETag header value
+  bool present;
+};
+
+StaticAsset staticAssets[] = {
+  {"/app.css", "/app.css.gz", "text/css"},
+  {"/app.js", "/app.js.gz", "application/javascript"},
+  {"/mqtt.css", "/mqtt.css.gz", "text/css"},
+};
+
+enum { ASSET_APP_CSS, ASSET_APP_JS, ASSET_MQTT_CSS };
+
+bool littleFsMounted = false;
+
+// Fingerprint every asset once at boot; the files only change with uploadfs
+void loadStaticAssets() {
+  littleFsMounted = LittleFS.begin(false);
+  if (!littleFsMounted) {
+    Serial.println("❌ LittleFS mount failed - upload the UI with 'pio run -t uploadfs'");
+    return;
+  }
+  uint8_t buffer[256];
+  for (int i = 0; i < sizeof(staticAssets) / sizeof(staticAssets[0]); i++) {
+    StaticAsset& asset = staticAssets[i];
+    File file = LittleFS.open(asset.file, "r");
+    if (!file) {
+      Serial.printf("❌ Missing UI asset %s\n", asset.file);
+      continue;
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    int len;
+    while ((len = file.read(buffer, sizeof(buffer))) > 0) {
+      crc = crc32Update(crc, buffer, len);
+    }
+    file.close();
+    asset.crc = ~crc;
+    snprintf(asset.etag, sizeof(asset.etag), "\"%08x\"", (unsigned)asset.crc);
+    asset.present = true;
+  }
+}
+
+void serveStaticAsset(const StaticAsset& asset) {
+  if (!asset.present) {
+    server.send_P(404, "text/plain", "UI asset missing, upload the filesystem image");
+    return;
+  }
+  server.sendHeader("ETag", asset.etag);
+  // Fingerprinted URLs never change content; bare URLs revalidate each time
+  server.sendHeader("Cache-Control", server.hasArg("v") ? "public, max-age=31536000, immutable" : "no-cache");
+  if (server.header("If-None-Match") == asset.etag) {
+    server.send(304);
+    return;
+  }
+  File file = LittleFS.open(asset.file, "r");
+  if (!file) {
+    server.send_P(500, "text/plain", "UI asset unreadable");
+    return;
+  }
+  // streamFile() adds Content-Encoding: gzip for .gz files
+  server.streamFile(file, asset.contentType);
+  file.close();
+}
+
+void printAssetLink(PageWriter& html, int index) {
+  const StaticAsset& asset = staticAssets[index];
+  if (strcmp(asset.contentType, "text/css") == 0) {
+    html.printf("<link rel='stylesheet' href='%s?v=%08x'>", asset.path, (unsigned)asset.crc);
+  } else {
+    html.printf("<script src='%s?v=%08x'></script>", asset.path, (unsigned)asset.crc);
+  }
+}
+
+static const char ROOT_PAGE_HEAD[] PROGMEM =
+  "<html><head><title>Lighthouse Controller</title>"
+  "<meta name='viewport' content='width=device-width, initial-scale=1'>"
+  "<meta charset='UTF-8'>";
+
+static const char ROOT_PAGE_BODY[] PROGMEM =
+  "</head><body>"
+  "<div class='container'>"
+  "<h1>SteamVR Lighthouse Controller</h1>";
+
+void handleRoot() {
+  if (rejectWhileShedding()) return;
+
+  beginChunkedResponse(200, "text/html");
+  PageWriter html(server);
+  html.write(ROOT_PAGE_HEAD, sizeof(ROOT_PAGE_HEAD) - 1);
+  printAssetLink(html, ASSET_APP_CSS);
+  printAssetLink(html, ASSET_APP_JS);
+  html.write(ROOT_PAGE_BODY, sizeof(ROOT_PAGE_BODY) - 1);
+  
+  // Status section
+  html.print("<div class='status'>Status: ");
+  if (currentCommand == NOTHING) {
+    html.print("Ready");
+  } else if (currentCommand == TURN_ON_PERM) {
+    html.print("Turning ON...");
+  } else if (currentCommand == TURN_OFF) {
+    html.print("Turning OFF...");
+  } else if (currentCommand == TURN_STANDBY) {
+    html.print("Switching to standby...");
+  } else if (currentCommand == RUN_BATCH) {
+    html.print("Running batch...");
+  } else if (currentCommand == CAPTURE_TRACE) {
+    html.print("Capturing advertisement trace...");
+  }
+  if (commandPending) {
+    html.print(" (next command queued)");
+  }
+  html.print("</div>");
+  
+  // All lighthouses control
+  html.print("<div class='lighthouse'>");
+  html.print("<h3>All Lighthouses</h3>");
+  html.print("<div class='controls'>");
+  html.print("<a href='/on'><button class='button on-btn'>Turn All ON</button></a>");
+  html.print("<a href='/off'><button class='button off-btn'>Turn All OFF</button></a>");
+  html.print("<a href='/standby'><button class='button standby-btn'>All Standby</button></a>");
+  html.print("</div>");
+  if (config.parkWindowS > 0) {
+    html.printf("<div class='lighthouse-id'>V2 stations wait %u s in standby before sleeping</div>",
+                (unsigned)config.parkWindowS);
+  }
+  html.print("</div>");
+
+  // Scenes run as one batch
+  if (config.sceneCount > 0) {
+    html.print("<div class='lighthouse'>");
+    html.print("<h3>Scenes</h3>");
+    html.print("<div class='controls'>");
+    for (int i = 0; i < config.sceneCount; i++) {
+      html.print("<a href='/scene?name=");
+      html.printUrlEncoded(config.scenes[i].name);
+      html.print("'><button class='button edit-btn'>");
+      html.printHtmlEscaped(config.scenes[i].name);
+      html.print("</button></a>");
+    }
+    html.print("</div>");
+    html.print("</div>");
+  }
+  
+  // Individual lighthouse controls
+  for (int i = 0; i < config.stationCount; i++) {
+    const StationConfig& station = config.stations[i];
+    html.print("<div class='lighthouse'>");
+    html.print("<h3>");
+    html.printHtmlEscaped(station.name);
+    html.print("</h3>");
+    if (station.version == 1) {
+      html.print("<div class='lighthouse-id'>ID: ");
+      html.printHtmlEscaped(station.advertisedId);
+      html.print("</div>");
+    } else {
+      html.printf("<div class='lighthouse-id'>MAC: %02X:%02X:%02X:%02X:%02X:%02X</div>", station.mac[0],
+                  station.mac[1], station.mac[2], station.mac[3], station.mac[4], station.mac[5]);
+    }
+    
+    html.print("<div class='controls'>");
+    html.printf("<a href='/on?id=%d'><button class='button on-btn'>Turn ON</button></a>", i);
+    html.printf("<a href='/off?id=%d'><button class='button off-btn'>Turn OFF</button></a>", i);
+    if (station.version == 2) {
+      html.printf("<a href='/standby?id=%d'><button class='button standby-btn'>Standby</button></a>", i);
+    }
+    html.printf("<button class='button edit-btn' onclick='editName(%d)'>Rename</button>", i);
+    html.print("</div>");
+    
+    // Hidden rename form
+    html.printf("<div id='rename-%d' style='display:none; margin-top:10px;'>", i);
+    html.printf("<input type='text' id='name-%d' class='name-input' value='", i);
+    html.printHtmlEscaped(station.name);
+    html.printf("' maxlength='%d' placeholder='Enter new name'>", LH_RENAME_MAX_LEN);
+    html.printf("<button class='button save-btn' onclick='saveName(%d)'>Save</button>", i);
+    html.printf("<button class='button off-btn' onclick='cancelEdit(%d)'>Cancel</button>", i);
+    html.print("</div>");
+    
+    html.print("</div>");
+  }
+  
+  html.printf("<div class='discovery-info'>Discovered Lighthouses: %u</div>", (unsigned)discoveryTable.size());
+  
+#if LH_WITH_MQTT
+  // MQTT status and configuration link
+  html.print("<div style='text-align: center; margin: 20px 0;'>");
+  html.print("<strong>MQTT Status:</strong> ");
+  if (config.mqtt.enabled) {
+    html.print(mqttClient.connected() ? "<span style='color: green'>Connected</span>"
+                                      : "<span style='color: red'>Disconnected</span>");
+  } else {
+    html.print("<span style='color: gray'>Disabled</span>");
+  }
+  html.print(" | <a href='/mqtt' class='button edit-btn'>Configure MQTT</a>");
+  html.print("</div>");
+#endif
+
+  // Heap watermarks
+  html.printf("<div style='text-align: center; color: #666; font-size: 12px;'>Heap: %u free, %u min, %u largest block</div>",
+              (unsigned)heapStats.freeBytes, (unsigned)heapStats.minFreeBytes, (unsigned)heapStats.largestBlock);
+  
+  html.print("</div></body></html>");
+  html.end();
+}
+
+// Parse the optional ?id= argument. Returns -1 for "all", -2 if invalid.
+int parseLighthouseIndexArg() {
+  if (!server.hasArg("id")) return -1;
+  char idArg[8];
+  strlcpy(idArg, server.arg("id").c_str(), sizeof(idArg));
+  if (idArg[0] == '\0') return -1;
+  char* end = nullptr;
+  long index = strtol(idArg, &end, 10);
+  if (*end != '\0' || index < 0 || index >= config.stationCount) {
+    return -2;
+  }
+  return index;
+}
+
+// /on, /off and /standby, for one station (?id=N) or all of them
+void handlePowerRequest(uint8_t command, StationAction action, const char* verb) {
+  beginCommandTrace();
+  int lighthouseIndex = parseLighthouseIndexArg();
+  bool started;
+  if (lighthouseIndex >= 0) {
+    // Individual lighthouse control
+    started = submitCommand(command, BatchPlan::single(lighthouseIndex, action), SOURCE_WEB);
+  } else if (lighthouseIndex == -1) {
+    // All lighthouses control
+    started = submitCommand(command, BatchPlan::all(action, config.stationCount), SOURCE_WEB);
+  } else {
+    sendMessagePage(400, "Invalid lighthouse index");
+    return;
+  }
+  const char* target = lighthouseIndex >= 0 ? config.stations[lighthouseIndex].name : "All Lighthouses";
+  if (started) {
+    sendMessagePage(200, "Turning %s %s...", verb, target);
+  } else {
+    sendMessagePage(200, "Queued: %s %s after the current command", verb, target);
+  }
+}
+
+void handleOn() { handlePowerRequest(TURN_ON_PERM, ACTION_ON, "ON"); }
+
+void handleOff() { handlePowerRequest(TURN_OFF, ACTION_OFF, "OFF"); }
+
+// V2 stations keep spinning with the lasers off; V1 stations go to sleep
+void handleStandby() { handlePowerRequest(TURN_STANDBY, ACTION_STANDBY, "standby"); }
+
+void handleScene() {
+  beginCommandTrace();
+  char name[CONFIG_SCENE_NAME_LEN];
+  strlcpy(name, server.arg("name").c_str(), sizeof(name));
+  bool idle = currentCommand == NOTHING;
+  if (!runScene(name, SOURCE_WEB)) {
+    sendMessagePage(404, "Unknown scene");
+  } else if (idle) {
+    sendMessagePage(200, "Running scene %s...", name);
+  } else {
+    sendMessagePage(200, "Queued: scene %s after the current command", name);
+  }
+}
+
+void handleRename() {
+  int lighthouseIndex = parseLighthouseIndexArg();
+  
+  if (lighthouseIndex != -1 && server.hasArg("name") && server.arg("name").length() > 0) {
+    if (lighthouseIndex >= 0) {
+      // Limit name length (LH_RENAME_MAX_LEN characters)
+      char newName[LH_RENAME_MAX_LEN + 1];
+      strlcpy(newName, server.arg("name").c_str(), sizeof(newName));
+      StationConfig& station = config.stations[lighthouseIndex];
+      if (strcmp(station.name, newName) != 0) {
+        strlcpy(station.name, newName, sizeof(station.name));
+        configMarkDirty();
+        publishMqttNames();
+      }
+      
+      // Redirect back to main page
+      server.sendHeader("Location", "/");
+      server.send(302, "text/plain", "");
+    } else {
+      sendMessagePage(400, "Invalid lighthouse index");
+    }
+  } else {
+    sendMessagePage(400, "Missing parameters");
+  }
+}
+
+#if LH_WITH_MQTT
+static const char MQTT_PAGE_HEAD[] PROGMEM =
+  "<html><head><title>MQTT Configuration</title>"
+  "<meta name='viewport' content='width=device-width, initial-scale=1'>";
+
+static const char MQTT_PAGE_BODY[] PROGMEM =
+  "</head><body>"
+  "<div class='container'>"
+  "<h1>MQTT Configuration</h1>";
+
+// One labelled text input, value escaped
+void printMqttField(PageWriter& html, const char* type, const char* name, const char* label, const char* value,
+                    const char* placeholder) {
+  html.print("<div class='form-group'>");
+  html.printf("<label for='%s'>%s</label>", name, label);
+  html.printf("<input type='%s' id='%s' name='%s' value='", type, name, name);
+  html.printHtmlEscaped(value);
+  html.printf("' placeholder='%s'>", placeholder);
+  html.print("</div>");
+}
+
+void handleMqttConfig() {
+  if (rejectWhileShedding()) return;
+
+  beginChunkedResponse(200, "text/html");
+  PageWriter html(server);
+  html.write(MQTT_PAGE_HEAD, sizeof(MQTT_PAGE_HEAD) - 1);
+  printAssetLink(html, ASSET_MQTT_CSS);
+  html.write(MQTT_PAGE_BODY, sizeof(MQTT_PAGE_BODY) - 1);
+  
+  // Show current MQTT status
+  html.print("<div class='status'>");
+  html.print("<strong>Current Status:</strong> ");
+  if (config.mqtt.enabled) {
+    html.print(mqttClient.connected() ? "Connected" : "Enabled but not connected");
+  } else {
+    html.print("Disabled");
+  }
+  html.print("</div>");
+  
+  html.print("<form method='POST' action='/mqtt-save'>");
+  
+  html.print("<div class='form-group'>");
+  html.printf("<label><input type='checkbox' name='enabled' %s> Enable MQTT</label>", config.mqtt.enabled ? "checked" : "");
+  html.print("</div>");
+  
+  char portValue[8];
+  snprintf(portValue, sizeof(portValue), "%d", config.mqtt.port);
+  printMqttField(html, "text", "server", "MQTT Server:", config.mqtt.server, "192.168.1.100");
+  printMqttField(html, "number", "port", "Port:", portValue, "1883");
+  printMqttField(html, "text", "username", "Username:", config.mqtt.username, "Optional");
+  printMqttField(html, "password", "password", "Password:", config.mqtt.password, "Optional");
+  printMqttField(html, "text", "topic", "Base Topic:", config.mqtt.topic, "lighthouse");
+  html.print("<div class='form-group'>");
+  html.printf("<label><input type='checkbox' name='tls' %s> Use TLS (usually port 8883)</label>",
+              config.mqttTls ? "checked" : "");
+  html.printf("<p>Broker certificate: %s</p>", mqttTransport.verifying() ? "verified against the uploaded CA"
+                                                                        : "not verified, upload a CA to /api/v1/mqtt/ca");
+  html.print("</div>");
+  
+  html.print("<div style='margin-top: 20px;'>");
+  html.print("<p><strong>MQTT Topics that will be used:</strong></p>");
+  html.print("<ul>");
+  html.print("<li><code>");
+  html.printHtmlEscaped(mqttTopics.command);
+  html.print("</code> - Send 'on' or 'off' to control all lighthouses</li>");
+  for (int i = 0; i < config.stationCount; i++) {
+    html.print("<li><code>");
+    html.printHtmlEscaped(mqttTopics.lighthouseCommand[i]);
+    html.print("</code> - Control individual lighthouse</li>");
+  }
+  html.print("<li><code>");
+  html.printHtmlEscaped(mqttTopics.lighthouseStatus[0]);
+  html.print("</code> - Lighthouse status (published)</li>");
+  html.print("<li><code>");
+  html.printHtmlEscaped(mqttTopics.lighthouseName[0]);
+  html.print("</code> - Lighthouse name (published)</li>");
+  html.print("</ul>");
+  html.print("</div>");
+  
+  html.print("<button type='submit' class='button'>Save Configuration</button>");
+  html.print("<a href='/' class='button back-btn'>Back to Main</a>");
+  html.print("</form>");
+  
+  html.print("</div></body></html>");
+  html.end();
+}
+
+void handleMqttSave() {
+  config.mqtt.enabled = server.hasArg("enabled");
+  strlcpy(config.mqtt.server, server.arg("server").c_str(), sizeof(config.mqtt.server));
+  long port = server.arg("port").toInt();
+  config.mqtt.port = (port <= 0 || port > 65535) ? 1883 : port;
+  strlcpy(config.mqtt.username, server.arg("username").c_str(), sizeof(config.mqtt.username));
+  strlcpy(config.mqtt.password, server.arg("password").c_str(), sizeof(config.mqtt.password));
+  strlcpy(config.mqtt.topic, server.arg("topic").c_str(), sizeof(config.mqtt.topic));
+  if (config.mqtt.topic[0] == '\0') strlcpy(config.mqtt.topic, "lighthouse", sizeof(config.mqtt.topic));
+  config.mqttTls = server.hasArg("tls");
+  
+  configMarkDirty();
+  
+  // Reconnect with the new settings
+  mqttSettingsChanged();
+  
+  // Redirect back to MQTT config page
+  server.sendHeader("Location", "/mqtt");
+  server.send(302, "text/plain", "");
+}
+#endif  // LH_WITH_MQTT
+
+void printPowerJson(PageWriter& json) {
+  int64_t now = esp_timer_get_time();
+  int64_t elapsed = max((int64_t)1, now - powerStats.since);
+  int64_t bleOnUs = powerStats.bleOnUs + (bleStarted ? now - powerStats.bleStartedAt : 0);
+  json.printf("\"power\":{\"low_power\":%s,\"max_latency_ms\":%u,\"light_sleep\":%s,\"cpu_mhz\":%u,",
+              config.tuning.lowPower ? "true" : "false", (unsigned)config.tuning.maxCommandLatencyMs, powerStats.lightSleep ? "true" : "false",
+              (unsigned)getCpuFrequencyMhz());
+  json.printf("\"adaptive_tx\":%s,", config.adaptiveTxPower ? "true" : "false");
+  json.printf("\"idle_pct\":%u,\"ble_on_pct\":%u,\"ble_on\":%s,\"ble_starts\":%u,",
+              (unsigned)(powerStats.idleUs * 100 / elapsed), (unsigned)(bleOnUs * 100 / elapsed),
+              bleStarted ? "true" : "false", powerStats.bleStarts);
+  json.printf("\"loop\":{\"wakes\":%u,\"event_wakes\":%u,\"button_edges\":%u},", loopStats.wakes,
+              loopStats.eventWakes, buttonEdges());
+  json.printf("\"input_latency_us\":{\"samples\":%u,\"last\":%u,\"max\":%u,\"mean\":%u}}", loopStats.inputs,
+              loopStats.lastInputUs, loopStats.maxInputUs,
+              loopStats.inputs ? (unsigned)(loopStats.totalInputUs / loopStats.inputs) : 0);
+}
+
+void printEngineJson(PageWriter& json) {
+  json.printf("\"engine\":{\"deadline_ms\":%u,\"last_ms\":%u,\"max_ms\":%u,\"timeouts\":%u,\"preemptions\":%u,"
+              "\"gatt_aborts\":%u,",
+              (unsigned)config.commandDeadlineMs, engine.lastMs, engine.maxMs, engine.timeouts, engine.preemptions,
+              engine.gattAborts);
+#if LH_WITH_MQTT
+  json.printf("\"cycles\":%u,\"tracked\":%u,", engine.cycles, (unsigned)commandTracker.waiting());
+#else
+  json.printf("\"cycles\":%u,\"tracked\":0,", engine.cycles);
+#endif
+  json.printf("\"writes_skipped\":%u,\"pending\":%s}", engine.writesSkipped, commandPending ? "true" : "false");
+}
+
+// GET /api/v1/engine[?deadline_ms=N]
+void handleEngineApi() {
+  if (server.hasArg("deadline_ms")) {
+    config.commandDeadlineMs =
+        constrain(server.arg("deadline_ms").toInt(), COMMAND_DEADLINE_MIN_MS, COMMAND_DEADLINE_MAX_MS);
+    configMarkDirty();
+  }
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{");
+  printEngineJson(json);
+  json.print("}");
+  json.end();
+}
+
+void printParkingJson(PageWriter& json) {
+  uint32_t now = millis();
+  json.printf("\"parking\":{\"window_s\":%u,\"parked\":[", (unsigned)config.parkWindowS);
+  bool first = true;
+  for (int i = 0; i < config.stationCount; i++) {
+    if (!(parking.parkedMask() & (1u << i))) continue;
+    json.printf("%s{\"id\":%d,\"sleep_in_s\":%u}", first ? "" : ",", i, parking.remainingS(i, now));
+    first = false;
+  }
+  json.print("]}");
+}
+
+// GET /api/v1/parking[?window_s=N], 0 turns parking off
+void handleParkingApi() {
+  if (server.hasArg("window_s")) {
+    config.parkWindowS = constrain(server.arg("window_s").toInt(), 0, PARK_WINDOW_MAX_S);
+    configMarkDirty();
+  }
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{");
+  printParkingJson(json);
+  json.print("}");
+  json.end();
+}
+
+void printReconcileJson(PageWriter& json) {
+  uint32_t now = millis();
+  json.printf("\"reconcile\":{\"enabled\":%s,\"diverged\":[", config.reconcile ? "true" : "false");
+  bool first = true;
+  for (int i = 0; i < config.stationCount; i++) {
+    if (reconciler.converged(i)) continue;
+    const StationReconcile& station = reconciler.station(i);
+    json.printf("%s{\"id\":%d,\"desired\":\"%s\",\"observed\":\"%s\",\"failures\":%u,\"retry_in_s\":%u}",
+                first ? "" : ",", i, stationActionName(station.desired),
+                station.observed == ACTION_NONE ? "unknown" : stationActionName(station.observed), station.failures,
+                reconciler.retryInS(i, now));
+    first = false;
+  }
+  json.print("]}");
+}
+
+// GET /api/v1/reconcile[?enabled=0|1]
+void handleReconcileApi() {
+  if (server.hasArg("enabled")) {
+    config.reconcile = server.arg("enabled").toInt() != 0;
+    configMarkDirty();
+  }
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{");
+  printReconcileJson(json);
+  json.print("}");
+  json.end();
+}
+
+#if LH_WITH_JOURNAL
+#define EVENTS_DEFAULT_LIMIT 256
+
+void printJournalJson(PageWriter& json) {
+  json.printf("\"journal\":{\"mounted\":%s,\"boot\":%u,\"next_seq\":%u,\"unflushed\":%u,",
+              journalState.mounted ? "true" : "false", eventTail.boot, (unsigned)eventTail.nextSeq,
+              (unsigned)eventTail.unflushed());
+  json.printf("\"flushes\":%u,\"write_errors\":%u,\"dropped\":%u}", journalState.flushes, journalState.writeErrors,
+              eventTail.dropped);
+}
+
+void printEventJson(PageWriter& json, const EventRecord& event) {
+  json.printf("{\"seq\":%u,\"boot\":%u,\"uptime_ms\":%u,\"type\":\"%s\"", (unsigned)event.seq, event.boot,
+              (unsigned)event.uptimeMs, eventTypeName(event.type));
+  uint32_t value = event.value;
+  switch (event.type) {
+    case EVENT_BOOT:
+      json.printf(",\"reset_reason\":%u,\"recovered\":%u", event.arg, (unsigned)value);
+      break;
+    case EVENT_COMMAND: {
+      // Actions in the batch format, e.g. "0:on,1:off"
+      json.printf(",\"source\":\"%s\",\"command\":%u,\"actions\":\"", eventSourceName(event.arg),
+                  (unsigned)(value >> 24));
+      bool first = true;
+      for (int i = 0; i < CONFIG_MAX_STATIONS; i++) {
+        uint8_t action = commandStationAction(value, i);
+        if (action == ACTION_NONE) continue;
+        json.printf("%s%d:%s", first ? "" : ",", i, stationActionName(action));
+        first = false;
+      }
+      json.printf("\",\"unmapped\":\"%s\"", stationActionName((value >> 16) & 3));
+      break;
+    }
+    case EVENT_STATION:
+      json.printf(",\"station\":%u,\"outcome\":\"%s\",\"action\":\"%s\",\"attempts\":%u,\"ms\":%u", event.arg,
+                  stationOutcomeName(value & 0x0F), stationActionName((value >> 4) & 0x0F), (unsigned)((value >> 8) & 0xFF),
+                  (unsigned)(value >> 16));
+      break;
+    case EVENT_CYCLE:
+      json.printf(",\"success\":%s,\"preempted\":%s,\"ms\":%u,\"unmapped_ok\":%u,\"unmapped_failed\":%u",
+                  event.arg & CYCLE_SUCCESS ? "true" : "false", event.arg & CYCLE_PREEMPTED ? "true" : "false",
+                  (unsigned)(value & 0xFFFF), (unsigned)((value >> 16) & 0xFF), (unsigned)(value >> 24));
+      break;
+    case EVENT_WIFI_RECONNECT:
+      json.printf(",\"reconnects\":%u", (unsigned)value);
+      break;
+    case EVENT_MQTT_CONNECT:
+      json.printf(",\"session_present\":%s", event.arg ? "true" : "false");
+      break;
+    case EVENT_HEAP_LOW:
+      json.printf(",\"free\":%u,\"shedding\":%s", (unsigned)value, event.arg ? "true" : "false");
+      break;
+  }
+  json.print("}");
+}
+
+// GET /api/v1/events[?since=SEQ][&limit=N]: events after SEQ, oldest first,
+// streamed from flash. Pass the returned last_seq as `since` to page on.
+void handleEventsApi() {
+  uint32_t from = server.hasArg("since") ? strtoul(server.arg("since").c_str(), nullptr, 10) + 1 : 0;
+  long limit = server.hasArg("limit") ? server.arg("limit").toInt() : EVENTS_DEFAULT_LIMIT;
+  limit = constrain(limit, 1, JOURNAL_SEGMENTS * JOURNAL_SEGMENT_RECORDS + EVENT_TAIL_RECORDS);
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.printf("{\"boot\":%u,\"next_seq\":%u,\"events\":[", eventTail.boot, (unsigned)eventTail.nextSeq);
+  JournalCursor cursor(from);
+  EventRecord event;
+  long count = 0;
+  uint32_t lastSeq = from > 0 ? from - 1 : 0;
+  bool more = false;
+  while (cursor.next(event)) {
+    if (count == limit) {
+      more = true;
+      break;
+    }
+    if (count++ > 0) json.print(",");
+    printEventJson(json, event);
+    lastSeq = event.seq;
+  }
+  json.printf("],\"last_seq\":%u,\"more\":%s}", (unsigned)lastSeq, more ? "true" : "false");
+  json.end();
+}
+#endif  // LH_WITH_JOURNAL
+
+#if LH_WITH_MQTT
+void printMqttJson(PageWriter& json) {
+  const OutboxStats& stats = mqttOutbox.stats;
+  json.printf("\"mqtt\":{\"enabled\":%s,\"connected\":%s,\"state\":%d,", config.mqtt.enabled ? "true" : "false",
+              mqttClient.connected() ? "true" : "false", mqttClient.state());
+  json.printf("\"inbox\":{\"pending\":%u,\"dropped\":%u},", (unsigned)mqttClient.inboxPending(),
+              mqttClient.inboxDropped());
+  json.printf("\"outbox\":{\"messages\":%u,\"inflight\":%u,\"queued\":%u,\"delivered\":%u,",
+              (unsigned)mqttOutbox.size(), (unsigned)mqttOutbox.inflight(), stats.queued, stats.delivered);
+  json.printf("\"replaced\":%u,\"dropped\":%u,\"resent\":%u},", stats.replaced, stats.dropped, stats.resent);
+  const TlsStats& tls = mqttTransport.stats();
+  json.printf("\"tls\":{\"enabled\":%s,\"verified\":%s,\"resumption\":%s,\"session\":%s,",
+              config.mqttTls ? "true" : "false", mqttTransport.verifying() ? "true" : "false",
+              mqttTransport.resumption() ? "true" : "false", mqttTransport.haveSession() ? "true" : "false");
+  json.printf("\"handshakes\":%u,\"resumed\":%u,\"failures\":%u,\"last_error\":%d},", tls.handshakes, tls.resumed,
+              tls.failures, tls.lastError);
+  const MqttConnectStats& connect = mqttConnectStats;
+  json.printf("\"connect\":{\"attempts\":%u,\"connects\":%u,\"sessions_present\":%u,\"resubscribes_skipped\":%u,",
+              connect.attempts, connect.connects, connect.sessionsPresent, connect.resubscribesSkipped);
+  json.printf("\"last_transport_ms\":%u,\"last_connack_ms\":%u,\"last_resumed\":%s,", connect.lastTransportMs,
+              connect.lastConnackMs, connect.lastResumed ? "true" : "false");
+  json.printf("\"full\":{\"count\":%u,\"mean_ms\":%u},\"resumed\":{\"count\":%u,\"mean_ms\":%u}}}",
+              connect.fullCount, connect.fullCount ? connect.fullTotalMs / connect.fullCount : 0,
+              connect.resumedCount, connect.resumedCount ? connect.resumedTotalMs / connect.resumedCount : 0);
+}
+
+// ?tls=0|1 switches TLS (stored), ?resume=0|1 TLS session resumption (until
+// reboot, for comparing reconnect times), ?reconnect=1 drops the connection
+// and connects again right away
+void handleMqttApi() {
+  if (server.hasArg("tls")) {
+    config.mqttTls = server.arg("tls") == "1";
+    configMarkDirty();
+    mqttSettingsChanged();
+  }
+  if (server.hasArg("resume")) {
+    mqttTransport.setResumption(server.arg("resume") == "1");
+    if (!mqttTransport.resumption()) mqttTransport.forgetSession();
+  }
+  if (server.arg("reconnect") == "1") mqttReconnectNow();
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{");
+  printMqttJson(json);
+  json.print("}");
+  json.end();
+}
+
+// POST the broker's CA certificate (PEM) as the body; ?clear=1 removes it.
+// Used from the next connect on.
+void handleMqttCaApi() {
+  bool clear = server.arg("clear") == "1";
+  if (!clear && !server.hasArg("plain")) {
+    sendMessagePage(400, "POST the CA certificate (PEM) as the request body");
+    return;
+  }
+  if (!setMqttCaCert(clear ? nullptr : server.arg("plain").c_str())) {
+    sendMessagePage(400, clear ? "Could not remove the CA certificate" : "Not a PEM certificate, or too big to store");
+    return;
+  }
+  sendMessagePage(200, clear ? "CA certificate removed" : "CA certificate stored, used from the next connect");
+}
+#endif
+
+#if LH_WITH_PRESENCE
+void printPresenceJson(PageWriter& json) {
+  const PresenceStats& stats = presence.stats();
+  json.printf("\"presence\":{\"enabled\":%s,\"host\":", config.presence.enabled ? "true" : "false");
+  json.printJsonString(config.presence.host);
+  json.printf(",\"port\":%u,\"port_only\":%s,\"grace_s\":%u,", config.presence.port,
+              config.presence.portOnly ? "true" : "false", config.presence.graceS);
+  json.printf("\"present\":%s,\"probe_up\":%s,\"mqtt_up\":%s,\"awake\":%s,\"sleep_in_s\":%u,",
+              presence.present() ? "true" : "false", presence.probeUp() ? "true" : "false",
+              presence.mqttUp() ? "true" : "false", presence.awake() ? "true" : "false",
+              (unsigned)(presence.sleepInMs(millis(), (uint32_t)config.presence.graceS * 1000) / 1000));
+  json.printf("\"probes\":%u,\"wakes\":%u,\"sleeps\":%u,\"false_wakes\":%u,", presenceProbe.probes, stats.wakes,
+              stats.sleeps, stats.falseWakes);
+  json.printf("\"last_wake_latency_ms\":%u,\"max_wake_latency_ms\":%u}", stats.lastWakeLatencyMs,
+              stats.maxWakeLatencyMs);
+}
+
+// GET /api/v1/presence[?enabled=0|1&host=IP&port=N&port_only=0|1&grace_s=N]
+void handlePresenceApi() {
+  bool changed = false;
+  if (server.hasArg("host")) {
+    IPAddress ip;
+    String host = server.arg("host");
+    if (host.length() > 0 && !ip.fromString(host.c_str())) {
+      sendMessagePage(400, "Invalid host, expected an IPv4 address");
+      return;
+    }
+    strlcpy(config.presence.host, host.c_str(), sizeof(config.presence.host));
+    changed = true;
+  }
+  if (server.hasArg("port")) {
+    long port = server.arg("port").toInt();
+    if (port <= 0 || port > 65535) {
+      sendMessagePage(400, "Invalid port");
+      return;
+    }
+    config.presence.port = port;
+    changed = true;
+  }
+  if (server.hasArg("port_only")) {
+    config.presence.portOnly = server.arg("port_only") == "1";
+    changed = true;
+  }
+  if (server.hasArg("grace_s")) {
+    config.presence.graceS = constrain(server.arg("grace_s").toInt(), 0, PRESENCE_GRACE_MAX_S);
+    changed = true;
+  }
+  if (server.hasArg("enabled")) {
+    config.presence.enabled = server.arg("enabled") == "1";
+    changed = true;
+  }
+  if (changed) {
+    // Start over with the new settings rather than acting on stale state
+    presence.reset();
+    configMarkDirty();
+  }
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{");
+  printPresenceJson(json);
+  json.print("}");
+  json.end();
+}
+#endif  // LH_WITH_PRESENCE
+
+#if LH_WITH_UDP
+void printUdpJson(PageWriter& json) {
+  size_t streams = 0;
+  for (const UdpStream& stream : udpControl.streams) streams += stream.active;
+  json.printf("\"udp\":{\"enabled\":%s,\"port\":%u,\"authenticated\":%s,\"listening\":%s,\"streams\":%u,",
+              config.udp.enabled ? "true" : "false", config.udp.port, config.udp.key[0] != '\0' ? "true" : "false",
+              udpControl.fd >= 0 ? "true" : "false", (unsigned)streams);
+  json.printf("\"received\":%u,\"commands\":%u,\"pings\":%u,\"repeats\":%u,\"rejected\":%u}", udpControl.received,
+              udpControl.commands, udpControl.pings, udpControl.repeats, udpControl.rejected);
+}
+
+// GET /api/v1/udp[?enabled=0|1&port=N&key=SECRET]. The key is never shown,
+// an empty one turns authentication off.
+void handleUdpApi() {
+  bool changed = false;
+  if (server.hasArg("port")) {
+    long port = server.arg("port").toInt();
+    if (port <= 0 || port > 65535) {
+      sendMessagePage(400, "Invalid port");
+      return;
+    }
+    config.udp.port = port;
+    changed = true;
+  }
+  if (server.hasArg("key")) {
+    String key = server.arg("key");
+    if (key.length() >= sizeof(config.udp.key)) {
+      sendMessagePage(400, "Key too long, at most %u characters", (unsigned)sizeof(config.udp.key) - 1);
+      return;
+    }
+    strlcpy(config.udp.key, key.c_str(), sizeof(config.udp.key));
+    udpControl.sequence.reset();
+    udpControl.lastValid = false;
+    changed = true;
+  }
+  if (server.hasArg("enabled")) {
+    config.udp.enabled = server.arg("enabled") == "1";
+    changed = true;
+  }
+  if (changed) configMarkDirty();
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{");
+  printUdpJson(json);
+  json.print("}");
+  json.end();
+}
+#endif  // LH_WITH_UDP
+
+void handleStatusApi() {
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{\"heap\":{");
+  json.printf("\"free\":%u,\"min_free\":%u,\"largest_block\":%u,\"min_largest_block\":%u,", (unsigned)heapStats.freeBytes,
+              (unsigned)heapStats.minFreeBytes, (unsigned)heapStats.largestBlock, (unsigned)heapStats.minLargestBlock);
+  json.printf("\"shedding\":%s,\"shed_events\":%u}", heapStats.shedding ? "true" : "false", (unsigned)heapStats.shedEvents);
+  json.printf(",\"boot\":{\"ble_ready_ms\":%u,\"wifi_connected_ms\":%u,\"web_ready_ms\":%u,", bootTimeline.bleReadyMs,
+              bootTimeline.wifiConnectedMs, bootTimeline.webReadyMs);
+  json.printf("\"mqtt_connected_ms\":%u,\"first_command_ms\":%u,\"first_command_done_ms\":%u,\"wifi_reconnects\":%u}",
+              bootTimeline.mqttConnectedMs, bootTimeline.firstCommandMs, bootTimeline.firstCommandDoneMs, wifiReconnects);
+  json.print(",");
+  printPowerJson(json);
+  json.print(",");
+  printEngineJson(json);
+  json.print(",");
+  printParkingJson(json);
+  json.print(",");
+  printReconcileJson(json);
+#if LH_WITH_PRESENCE
+  json.print(",");
+  printPresenceJson(json);
+#endif
+#if LH_WITH_UDP
+  json.print(",");
+  printUdpJson(json);
+#endif
+#if LH_WITH_MQTT
+  json.print(",");
+  printMqttJson(json);
+#endif
+#if LH_WITH_JOURNAL
+  json.print(",");
+  printJournalJson(json);
+#endif
+  json.printf(",\"config\":{\"stations\":%u,\"dirty\":%s,\"writes\":%u,\"migrated\":%s,\"bytes\":%u}",
+              config.stationCount, configStore.dirty ? "true" : "false", configStore.writes,
+              configStore.migrated ? "true" : "false", (unsigned)sizeof(ControllerConfig));
+  json.printf(",\"uptime_ms\":%lu}", millis());
+  json.end();
+}
+
+// GET /api/v1/power[?enabled=0|1][&latency_ms=N][&adaptive_tx=0|1]
+void handlePowerApi() {
+  bool changed = false;
+  if (server.hasArg("enabled")) {
+    config.tuning.lowPower = server.arg("enabled").toInt() != 0;
+    changed = true;
+  }
+  if (server.hasArg("adaptive_tx")) {
+    config.adaptiveTxPower = server.arg("adaptive_tx").toInt() != 0;
+    changed = true;
+  }
+  if (server.hasArg("latency_ms")) {
+    config.tuning.maxCommandLatencyMs = constrain(server.arg("latency_ms").toInt(), LOW_POWER_MIN_LATENCY_MS, LOW_POWER_MAX_LATENCY_MS);
+    changed = true;
+  }
+  if (changed) {
+    applyPowerMode();
+    configMarkDirty();
+  }
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{");
+  printPowerJson(json);
+  json.print("}");
+  json.end();
+}
+
+void printStationJson(PageWriter& json, int index) {
+  const StationConfig& station = config.stations[index];
+  json.printf("{\"id\":%d,\"version\":%u,\"name\":", index, station.version);
+  json.printJsonString(station.name);
+  if (station.version == 1) {
+    json.print(",\"advertised\":");
+    json.printJsonString(station.advertisedId);
+    json.printf(",\"unique\":\"%08X\"", (unsigned)station.uniqueId);
+  } else {
+    json.printf(",\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\"", station.mac[0], station.mac[1], station.mac[2],
+                station.mac[3], station.mac[4], station.mac[5]);
+  }
+  // Radio figures once the station has been connected to since boot
+  const StationRadio& radio = txPower.radio(index);
+  if (radio.connects == 0) {
+    json.print(",\"radio\":null}");
+  } else {
+    json.printf(",\"radio\":{\"tx_dbm\":%d,\"rssi\":%d,\"connects\":%u,\"connect_pct\":%u}}",
+                kTxPowerDbm[radio.level], radio.rssi, radio.connects, txPower.successPct(index));
+  }
+}
+
+void handleStationsApi() {
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.printf("{\"max\":%d,\"stations\":[", CONFIG_MAX_STATIONS);
+  for (int i = 0; i < config.stationCount; i++) {
+    if (i > 0) json.print(",");
+    printStationJson(json, i);
+  }
+  json.print("]}");
+  json.end();
+}
+
+// Frames and MQTT topics are derived from the station list
+void stationsChanged() {
+  precomputeLighthouseFrames();
+  mqttStationsChanged();
+  configMarkDirty();
+}
+
+// GET /api/v1/station?id=N|new[&version=1|2][&advertised=C21347&unique=3BBF1347][&mac=D3:EA:..][&name=..]
+// GET /api/v1/station?id=N&delete=1
+void handleStationApi() {
+  // Running and queued plans are indexed by station
+  if (currentCommand != NOTHING || commandPending) {
+    sendMessagePage(409, "Command in progress");
+    return;
+  }
+
+  int index;
+  bool adding = server.arg("id") == "new";
+  if (adding) {
+    if (config.stationCount >= CONFIG_MAX_STATIONS) {
+      sendMessagePage(400, "Station table full (%d)", CONFIG_MAX_STATIONS);
+      return;
+    }
+    index = config.stationCount;
+  } else {
+    index = parseLighthouseIndexArg();
+    if (index < 0) {
+      sendMessagePage(400, "Invalid lighthouse index");
+      return;
+    }
+  }
+
+  if (!adding && server.arg("delete") == "1") {
+    for (int i = index; i + 1 < config.stationCount; i++) {
+      config.stations[i] = config.stations[i + 1];
+    }
+    config.stationCount--;
+    memset(&config.stations[config.stationCount], 0, sizeof(StationConfig));
+    removeStationFromScenes(config, index);
+    parking.removeStation(index);
+    txPower.removeStation(index);
+    reconciler.removeStation(index);
+    for (int i = index; i + 1 < CONFIG_MAX_STATIONS; i++) {
+      stationPower[i] = stationPower[i + 1];
+    }
+    stationPower[CONFIG_MAX_STATIONS - 1] = ACTION_NONE;
+    abandonCommandResults();
+    stationsChanged();
+    server.send(204);
+    return;
+  }
+
+  // Validate into a copy so a bad request leaves the station untouched
+  StationConfig station = {};
+  if (!adding) station = config.stations[index];
+  if (server.hasArg("version")) station.version = server.arg("version").toInt();
+  if (station.version != 1 && station.version != 2) {
+    sendMessagePage(400, "version must be 1 or 2");
+    return;
+  }
+  if (server.hasArg("advertised")) {
+    strlcpy(station.advertisedId, server.arg("advertised").c_str(), sizeof(station.advertisedId));
+  }
+  if (server.hasArg("unique")) {
+    uint32_t uniqueId = 0;
+    if (!lighthouse::v1::parseUniqueId(server.arg("unique").c_str(), uniqueId)) {
+      sendMessagePage(400, "Invalid unique ID");
+      return;
+    }
+    station.uniqueId = uniqueId;
+  }
+  if (server.hasArg("mac") && !parseMacAddress(server.arg("mac").c_str(), station.mac)) {
+    sendMessagePage(400, "Invalid MAC address");
+    return;
+  }
+  if (server.hasArg("name")) {
+    strlcpy(station.name, server.arg("name").c_str(), min(sizeof(station.name), (size_t)LH_RENAME_MAX_LEN + 1));
+  }
+  if (station.version == 1 && (station.advertisedId[0] == '\0' || station.uniqueId == 0)) {
+    sendMessagePage(400, "V1 stations need advertised and unique IDs");
+    return;
+  }
+  if (station.name[0] == '\0') {
+    snprintf(station.name, sizeof(station.name), "Lighthouse %d", index + 1);
+  }
+
+  const StationConfig& previous = config.stations[index];
+  if (adding || station.version != previous.version || station.uniqueId != previous.uniqueId ||
+      memcmp(station.mac, previous.mac, sizeof(station.mac)) != 0) {
+    txPower.resetStation(index);  // Different hardware, the radio history does not apply
+    reconciler.resetStation(index);
+    stationPower[index] = ACTION_NONE;
+  }
+  config.stations[index] = station;
+  if (adding) config.stationCount++;
+  stationsChanged();
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  printStationJson(json, index);
+  json.end();
+}
+
+void printPlanJson(PageWriter& json, const BatchPlan& plan) {
+  json.print("\"actions\":[");
+  for (int i = 0; i < config.stationCount; i++) {
+    json.printf("%s\"%s\"", i > 0 ? "," : "", stationActionName(plan.actions[i]));
+  }
+  json.printf("],\"unmapped\":\"%s\"", stationActionName(plan.unmappedAction));
+}
+
+// GET /api/v1/batch?actions=0:on,1:off,all:standby
+void handleBatchApi() {
+  beginCommandTrace();
+  BatchPlan plan;
+  if (!parseBatchPlan(server.arg("actions").c_str(), config.stationCount, plan)) {
+    sendMessagePage(400, "Invalid batch, expected e.g. actions=0:on,1:off");
+    return;
+  }
+  bool started = submitCommand(RUN_BATCH, plan, SOURCE_WEB);
+
+  beginChunkedResponse(started ? 200 : 202, "application/json");
+  PageWriter json(server);
+  json.printf("{\"queued\":%s,", started ? "false" : "true");
+  printPlanJson(json, plan);
+  json.print("}");
+  json.end();
+}
+
+void handleScenesApi() {
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.printf("{\"max\":%d,\"scenes\":[", CONFIG_MAX_SCENES);
+  for (int i = 0; i < config.sceneCount; i++) {
+    json.print(i > 0 ? ",{\"name\":" : "{\"name\":");
+    json.printJsonString(config.scenes[i].name);
+    json.print(",");
+    printPlanJson(json, planFromScene(config.scenes[i]));
+    json.print("}");
+  }
+  json.print("]}");
+  json.end();
+}
+
+// GET /api/v1/scene?name=movie                     run the scene
+// GET /api/v1/scene?name=movie&actions=0:on,1:off  create or replace it
+// GET /api/v1/scene?name=movie&delete=1            delete it
+void handleSceneApi() {
+  beginCommandTrace();
+  char name[CONFIG_SCENE_NAME_LEN];
+  strlcpy(name, server.arg("name").c_str(), sizeof(name));
+  if (name[0] == '\0') {
+    sendMessagePage(400, "Missing scene name");
+    return;
+  }
+  int index = findScene(config, name);
+
+  if (server.arg("delete") == "1") {
+    if (index < 0) {
+      sendMessagePage(404, "Unknown scene");
+      return;
+    }
+    for (int i = index; i + 1 < config.sceneCount; i++) {
+      config.scenes[i] = config.scenes[i + 1];
+    }
+    config.sceneCount--;
+    memset(&config.scenes[config.sceneCount], 0, sizeof(SceneConfig));
+    configMarkDirty();
+    server.send(204);
+    return;
+  }
+
+  if (server.hasArg("actions")) {
+    BatchPlan plan;
+    if (!parseBatchPlan(server.arg("actions").c_str(), config.stationCount, plan)) {
+      sendMessagePage(400, "Invalid batch, expected e.g. actions=0:on,1:off");
+      return;
+    }
+    if (index < 0) {
+      if (config.sceneCount >= CONFIG_MAX_SCENES) {
+        sendMessagePage(400, "Scene table full (%d)", CONFIG_MAX_SCENES);
+        return;
+      }
+      index = config.sceneCount++;
+      strlcpy(config.scenes[index].name, name, sizeof(config.scenes[index].name));
+    }
+    storePlanInScene(plan, config.scenes[index]);
+    configMarkDirty();
+  } else if (index < 0 || !runScene(name, SOURCE_WEB)) {
+    sendMessagePage(404, "Unknown scene");
+    return;
+  }
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{\"name\":");
+  json.printJsonString(config.scenes[index].name);
+  json.print(",");
+  printPlanJson(json, planFromScene(config.scenes[index]));
+  json.print("}");
+  json.end();
+}
+
+// GET /api/v1/trace?start=1[&seconds=N]  capture raw adverts for N seconds
+// GET /api/v1/trace                      download the trace (see advert_trace.h)
+// GET /api/v1/trace?clear=1              free the trace buffer
+void handleTraceApi() {
+  if (server.arg("clear") == "1") {
+    if (traceCapture.active) {
+      sendMessagePage(409, "Capture in progress");
+      return;
+    }
+    free(traceCapture.buffer);
+    traceCapture.buffer = nullptr;
+    traceCapture.writer.reset(nullptr, 0);
+    server.send(204);
+    return;
+  }
+
+  if (server.arg("start") == "1") {
+    if (currentCommand != NOTHING) {
+      sendMessagePage(409, "Command in progress");
+      return;
+    }
+    if (rejectWhileShedding()) return;
+    long seconds = server.hasArg("seconds") ? server.arg("seconds").toInt() : 10;
+    seconds = constrain(seconds, 1, TRACE_MAX_SECONDS);
+    if (traceCapture.buffer == nullptr) {
+      traceCapture.buffer = (uint8_t*)malloc(TRACE_BUFFER_BYTES);
+      if (traceCapture.buffer == nullptr) {
+        sendMessagePage(503, "Not enough memory for a %d byte trace", TRACE_BUFFER_BYTES);
+        return;
+      }
+    }
+    startTraceCapture(seconds);
+
+    beginChunkedResponse(202, "application/json");
+    PageWriter json(server);
+    json.printf("{\"capturing\":true,\"seconds\":%ld,\"buffer_bytes\":%d}", seconds, TRACE_BUFFER_BYTES);
+    json.end();
+    return;
+  }
+
+  if (traceCapture.active) {
+    sendMessagePage(409, "Capture in progress");
+    return;
+  }
+  if (traceCapture.writer.records() == 0) {
+    sendMessagePage(404, "No trace captured, start one with ?start=1");
+    return;
+  }
+  server.sendHeader("Content-Disposition", "attachment; filename=adverts.lhat");
+  server.setContentLength(traceCapture.writer.size());
+  server.send(200, "application/octet-stream", "");
+  server.sendContent((const char*)traceCapture.writer.data(), traceCapture.writer.size());
+}
+
+void printSpanJson(PageWriter& json, const Span& span, const CommandTrace& trace) {
+  json.printf("{\"phase\":\"%s\",", spanPhaseName(span.phase));
+  if (span.phase != SPAN_ENTRY && span.phase != SPAN_QUEUED) json.printf("\"cycle\":%u,", (unsigned)span.key);
+  if (span.station >= 0) json.printf("\"station\":%d,", span.station);
+  if (span.attempt > 0) json.printf("\"attempt\":%u,", span.attempt);
+  if (span.phase == SPAN_CYCLE) {
+    json.printf("\"outcome\":\"%s\",", span.outcome & CYCLE_PREEMPTED ? "preempted"
+                                           : span.outcome & CYCLE_SUCCESS ? "success" : "failed");
+  } else if (span.phase != SPAN_ENTRY && span.phase != SPAN_QUEUED && span.phase != SPAN_BACKOFF) {
+    json.printf("\"outcome\":\"%s\",", stationOutcomeName(span.outcome));
+  }
+  // Relative to the trace, so a waterfall needs no clock
+  json.printf("\"start_us\":%ld,\"end_us\":%ld}", (long)(int32_t)(span.startUs - trace.receivedUs),
+              (long)(int32_t)(span.endUs - trace.receivedUs));
+}
+
+// GET /api/v1/traces[?id=N]              recent command traces with their spans
+void handleTracesApi() {
+  uint32_t only = server.hasArg("id") ? strtoul(server.arg("id").c_str(), nullptr, 10) : 0;
+
+  beginChunkedResponse(200, "application/json");
+  PageWriter json(server);
+  json.print("{\"traces\":[");
+  int count = 0;
+  for (uint32_t i = 0; i < spans.traceCount(); i++) {
+    const CommandTrace& trace = spans.traceAt(i);
+    if (only != 0 && trace.id != only) continue;
+    if (count++ > 0) json.print(",");
+    json.printf("{\"id\":%u,\"source\":\"%s\",\"command\":%u,\"queued\":%s,", (unsigned)trace.id,
+                eventSourceName(trace.source), trace.command, trace.queued ? "true" : "false");
+    json.printf("\"first_cycle\":%u,\"last_cycle\":%u,\"done\":%s,\"complete\":%s,\"spans\":[",
+                (unsigned)trace.firstCycle, (unsigned)trace.lastCycle, trace.lastCycle != 0 ? "true" : "false",
+                trace.firstSpan >= spans.oldestSpan() ? "true" : "false");
+    int spanCount = 0;
+    for (uint32_t seq = spans.oldestSpan(); seq < spans.spanEnd(); seq++) {
+      const Span& span = spans.spanAt(seq);
+      if (!SpanRecorder::belongsTo(span, trace)) continue;
+      if (spanCount++ > 0) json.print(",");
+      printSpanJson(json, span, trace);
+    }
+    json.print("]}");
+  }
+  json.print("]}");
+  json.end();
+}
+
+// Mount LittleFS, fingerprint the UI assets and register the routes. The
+// server itself is started once WiFi is up.
+void setupWebServer() {
+  loadStaticAssets();
+
+  server.on("/", handleRoot);
+  server.on("/on", handleOn);
+  server.on("/off", handleOff);
+  server.on("/standby", handleStandby);
+  server.on("/scene", handleScene);
+  server.on("/rename", handleRename);
+#if LH_WITH_MQTT
+  server.on("/mqtt", handleMqttConfig);
+  server.on("/mqtt-save", HTTP_POST, handleMqttSave);
+  server.on("/api/v1/mqtt", handleMqttApi);
+  server.on("/api/v1/mqtt/ca", HTTP_POST, handleMqttCaApi);
+#endif
+  server.on("/api/v1/status", handleStatusApi);
+  server.on("/api/v1/power", handlePowerApi);
+  server.on("/api/v1/engine", handleEngineApi);
+  server.on("/api/v1/parking", handleParkingApi);
+  server.on("/api/v1/reconcile", handleReconcileApi);
+#if LH_WITH_PRESENCE
+  server.on("/api/v1/presence", handlePresenceApi);
+#endif
+#if LH_WITH_UDP
+  server.on("/api/v1/udp", handleUdpApi);
+#endif
+  server.on("/api/v1/stations", handleStationsApi);
+  server.on("/api/v1/station", handleStationApi);
+  server.on("/api/v1/batch", handleBatchApi);
+  server.on("/api/v1/scenes", handleScenesApi);
+  server.on("/api/v1/scene", handleSceneApi);
+  server.on("/api/v1/trace", handleTraceApi);
+  server.on("/api/v1/traces", handleTracesApi);
+#if LH_WITH_JOURNAL
+  server.on("/api/v1/events", handleEventsApi);
+#endif
+  for (int i = 0; i < sizeof(staticAssets) / sizeof(staticAssets[0]); i++) {
+    server.on(staticAssets[i].path, HTTP_GET, [i]() { serveStaticAsset(staticAssets[i]); });
+  }
+  const char* collectedHeaders[] = {"If-None-Match"};
+  server.collectHeaders(collectedHeaders, sizeof(collectedHeaders) / sizeof(collectedHeaders[0]));
+}
+
+void startWebServer() {
+  if (webServerStarted) return;
+  server.begin();
+  webServerStarted = true;
+  markBootPhase(bootTimeline.webReadyMs, "Web server started");
+  Serial.printf("Web interface available at: http://%s\n", WiFi.localIP().toString().c_str());
+}
+
+void serviceWebServer() { server.handleClient(); }
+
+#endif  // LH_WITH_WEB
@@ -0,0 +1,38 @@
+# PlatformIO pre-build script: compresses the web UI sources in web/ into the
+# LittleFS image directory data/ as .gz files. The firmware serves them with
+# Content-Encoding: gzip, so the browser does the decompression.
+#
+# Output is deterministic (no timestamp or file name in the gzip header), so
+# the content ETags the firmware computes at boot only change when an asset
+# really changes.
+import gzip
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE_DIR = os.path.join(PROJECT_DIR, "web")
+DATA_DIR = os.path.join(PROJECT_DIR, "data")
+
+
+def compress_assets():
+    os.makedirs(DATA_DIR, exist_ok=True)
+    for name in sorted(os.listdir(SOURCE_DIR)):
+        source = os.path.join(SOURCE_DIR, name)
+        target = os.path.join(DATA_DIR, name + ".gz")
+        if not os.path.isfile(source):
+            continue
+        if os.path.exists(target) and os.path.getmtime(target) >= os.path.getmtime(source):
+            continue
+        with open(source, "rb") as f:
+            raw = f.read()
+        with open(target, "wb") as out:
+            with gzip.GzipFile(filename="", mode="wb", fileobj=out, compresslevel=9, mtime=0) as gz:
+                gz.write(raw)
+        print("gzip_assets: %s %d -> %d bytes" % (name, len(raw), os.path.getsize(target)))
+
+
+compress_assets()
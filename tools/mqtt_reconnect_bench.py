@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Compare MQTT reconnect times with and without TLS session resumption.
+
+Needs a broker with a TLS listener, e.g. a local mosquitto:
+
+    listener 8883
+    cafile /etc/mosquitto/certs/ca.crt
+    certfile /etc/mosquitto/certs/server.crt
+    keyfile /etc/mosquitto/certs/server.key
+
+Point the controller at it on port 8883 with "Use TLS" ticked on /mqtt, and
+optionally upload the CA so the broker is verified (the server certificate
+must then name the host configured on the controller):
+
+    curl --data-binary @ca.crt http://192.168.1.50/api/v1/mqtt/ca
+
+Then run:
+
+    python tools/mqtt_reconnect_bench.py --controller 192.168.1.50 --count 20
+
+For each mode the script switches resumption (/api/v1/mqtt?resume=0|1),
+forces reconnects (?reconnect=1) and waits for each CONNACK. It prints the
+transport time (TCP connect plus TLS handshake) and the time to CONNACK, and
+how many handshakes the broker actually resumed. Resumption only pays off if
+the broker keeps sessions; a broker that forgets them shows up as a resumed
+count of 0.
+"""
+
+import argparse
+import json
+import statistics
+import sys
+import time
+import urllib.request
+
+
+def fetch_mqtt(controller, query=""):
+    with urllib.request.urlopen(f"http://{controller}/api/v1/mqtt{query}", timeout=15) as response:
+        return json.load(response)["mqtt"]
+
+
+def wait_for_connack(controller, connects, timeout_s):
+    deadline = time.monotonic() + timeout_s
+    while time.monotonic() < deadline:
+        mqtt = fetch_mqtt(controller)
+        if mqtt["connected"] and mqtt["connect"]["connects"] > connects:
+            return mqtt
+        time.sleep(0.1)
+    return None
+
+
+def run(controller, resume, count, pause_s):
+    mqtt = fetch_mqtt(controller, f"?resume={1 if resume else 0}")
+    if not mqtt["tls"]["enabled"]:
+        print("warning: TLS is off on the controller, measuring plain TCP", file=sys.stderr)
+    transport_ms, connack_ms, resumed = [], [], 0
+    for _ in range(count):
+        before = mqtt["connect"]["connects"]
+        fetch_mqtt(controller, "?reconnect=1")
+        mqtt = wait_for_connack(controller, before, 15)
+        if mqtt is None:
+            print("  no CONNACK within 15 s, last TLS error "
+                  f"{fetch_mqtt(controller)['tls']['last_error']}", file=sys.stderr)
+            mqtt = fetch_mqtt(controller)
+            continue
+        connect = mqtt["connect"]
+        transport_ms.append(connect["last_transport_ms"])
+        connack_ms.append(connect["last_connack_ms"])
+        resumed += connect["last_resumed"]
+        time.sleep(pause_s)
+    return transport_ms, connack_ms, resumed
+
+
+def summary(values):
+    if not values:
+        return "-"
+    return f"median {statistics.median(values):6.0f} ms, min {min(values):5d}, max {max(values):5d}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--controller", required=True, help="controller address")
+    parser.add_argument("--count", type=int, default=10, help="reconnects per mode (default 10)")
+    parser.add_argument("--pause", type=float, default=1.0, help="seconds between reconnects (default 1)")
+    args = parser.parse_args()
+
+    results = {}
+    try:
+        for resume in (False, True):
+            label = "resumption on" if resume else "resumption off"
+            print(f"{label}: {args.count} reconnects", flush=True)
+            results[label] = run(args.controller, resume, args.count, args.pause)
+    finally:
+        fetch_mqtt(args.controller, "?resume=1")
+
+    for label, (transport_ms, connack_ms, resumed) in results.items():
+        print(f"\n{label} ({len(connack_ms)} connects, {resumed} resumed)")
+        print(f"  transport: {summary(transport_ms)}")
+        print(f"  CONNACK:   {summary(connack_ms)}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,167 @@
+/** Host-side check of the MQTT outbox ring.
+ *
+ * Drives MqttOutbox through a long pseudo-random sequence of pushes, sends,
+ * PUBACKs and reconnects, and after every step checks that restore() on a
+ * copy keeps the contents: every state the ring can reach must pass the
+ * check it runs on the RTC copy after a reset. Also checks that no more
+ * than MQTT_OUTBOX_WINDOW messages are in flight, that head always points at
+ * a record (never at a wrap marker or the end of the arena) and that wrapped
+ * states were actually reached.
+ *
+ * Before the random run, a fixed case: the only record left is a wrapped one
+ * at the start of the arena, with the wrap marker behind it. A push that fits
+ * after that record must not drop it.
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O2 -Ilib/lighthouse_core/src tools/outbox_check/outbox_check.cpp -o outbox_check
+ *
+ * Usage:
+ *   outbox_check [--steps N] [--seed S]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "mqtt_outbox.h"
+
+static uint32_t rngState = 1;
+
+// Stands in for the client's packet ID allocator
+static uint16_t nextPacketId() {
+  static uint16_t id = 0;
+  if (++id == 0) id = 1;
+  return id;
+}
+
+static uint32_t nextRandom() {
+  rngState = rngState * 1103515245u + 12345u;
+  return rngState >> 8;
+}
+
+// One byte topic, so `size` is the whole record
+static bool pushSized(MqttOutbox& box, size_t size) {
+  static uint8_t payload[MQTT_OUTBOX_BYTES];
+  return box.push("t", payload, size - sizeof(MqttOutbox::RecordHeader) - 1, 0);
+}
+
+static bool checkWrapCase() {
+  static MqttOutbox box;
+  box.clear();
+  std::vector<uint16_t> sent;
+  auto send = [&](const char*, const uint8_t*, size_t, bool, uint16_t packetId, bool) {
+    sent.push_back(packetId);
+    return true;
+  };
+  pushSized(box, 1000);  // [0, 1000)
+  pushSized(box, 950);   // [1000, 1950)
+  box.flush(nextPacketId, send);
+  box.ack(sent[0]);
+  pushSized(box, 990);  // Wraps: marker at 1950, record at [0, 990)
+  box.ack(sent[1]);     // Only the wrapped, unsent record is left
+  if (box.size() != 1 || box.tail != 990) {
+    fprintf(stderr, "wrap case: unexpected setup (%u records, head %u, tail %u)\n", (unsigned)box.size(), box.head,
+            box.tail);
+    return false;
+  }
+  pushSized(box, 1021);  // Fits in [990, 2048)
+  if (box.stats.dropped != 0 || box.size() != 2) {
+    fprintf(stderr, "wrap case: %u dropped, %u records left (head %u, tail %u)\n", box.stats.dropped,
+            (unsigned)box.size(), box.head, box.tail);
+    return false;
+  }
+  return true;
+}
+
+// head must be on a record whenever there is one
+static bool headOnRecord(const MqttOutbox& box) {
+  if (box.size() == 0) return true;
+  if (box.head + sizeof(MqttOutbox::RecordHeader) > MQTT_OUTBOX_BYTES) return false;
+  uint16_t size;
+  memcpy(&size, box.data + box.head, sizeof(size));
+  return size != 0;
+}
+
+static const char* const topics[] = {"lighthouse/0/state", "lighthouse/1/state", "lighthouse/event",
+                                     "lighthouse/result", "t"};
+
+int main(int argc, char** argv) {
+  long steps = 200000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+      steps = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      rngState = (uint32_t)strtoul(argv[++i], nullptr, 0);
+    } else {
+      fprintf(stderr, "usage: outbox_check [--steps N] [--seed S]\n");
+      return 2;
+    }
+  }
+
+  if (!checkWrapCase()) return 1;
+  printf("wrap case: ok\n");
+
+  static MqttOutbox box;
+  static MqttOutbox copy;
+  box.clear();
+  std::vector<uint16_t> sent;
+  uint8_t payload[MQTT_OUTBOX_BYTES / 2];
+  memset(payload, 'x', sizeof(payload));
+  long wrapped = 0;
+
+  for (long step = 0; step < steps; step++) {
+    uint32_t op = nextRandom() % 8;
+    if (op < 4) {
+      const char* topic = topics[nextRandom() % (sizeof(topics) / sizeof(topics[0]))];
+      // Mostly small messages, sometimes ones that fill a good part of the arena
+      size_t len = nextRandom() % 4 == 0 ? nextRandom() % (MQTT_OUTBOX_BYTES / 3) : nextRandom() % 48;
+      uint8_t flags = strstr(topic, "state") ? (OUTBOX_STATE | OUTBOX_RETAIN) : 0;
+      box.push(topic, payload, len, flags);
+    } else if (op < 6) {
+      uint32_t failAt = nextRandom() % 6;
+      uint32_t calls = 0;
+      box.flush(nextPacketId, [&](const char*, const uint8_t*, size_t, bool, uint16_t packetId, bool) {
+        if (++calls == failAt) return false;
+        sent.push_back(packetId);
+        return true;
+      });
+    } else if (op == 6) {
+      if (!sent.empty()) {
+        size_t i = nextRandom() % sent.size();
+        box.ack(sent[i]);
+        sent.erase(sent.begin() + i);
+      }
+    } else {
+      box.requeueInflight();
+      sent.clear();
+    }
+
+    if (box.size() > 0 && box.tail <= box.head) wrapped++;
+    if (!headOnRecord(box)) {
+      fprintf(stderr, "step %ld: head %u is not on a record (tail %u)\n", step, box.head, box.tail);
+      return 1;
+    }
+    if (box.inflight() > MQTT_OUTBOX_WINDOW) {
+      fprintf(stderr, "step %ld: %u messages in flight\n", step, (unsigned)box.inflight());
+      return 1;
+    }
+    memcpy(&copy, &box, sizeof(box));
+    size_t kept = copy.restore();
+    if (kept != box.size()) {
+      fprintf(stderr, "step %ld: restore() kept %u of %u messages (head %u, tail %u)\n", step, (unsigned)kept,
+              (unsigned)box.size(), box.head, box.tail);
+      return 1;
+    }
+  }
+
+  printf("%ld steps: %u queued, %u delivered, %u replaced, %u dropped, %u resent\n", steps, box.stats.queued,
+         box.stats.delivered, box.stats.replaced, box.stats.dropped, box.stats.resent);
+  printf("wrapped states: %ld\n", wrapped);
+  if (wrapped == 0) {
+    fprintf(stderr, "no wrapped state reached, try more steps or another seed\n");
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Stand-in for the VR PC when testing presence pre-wake.
+
+Listens on the TCP port the controller probes (27036 by default) and can
+come and go on a schedule, so the pre-wake, grace period and false-wake
+counting can be exercised from any machine on the LAN:
+
+    python tools/presence_standin.py --controller 192.168.1.50 --cycle 180 120
+
+Point the controller at this machine first. While "absent" this machine is
+still up and refuses the probe, so the controller must only count an open
+port (port_only=1):
+
+    curl 'http://192.168.1.50/api/v1/presence?enabled=1&host=192.168.1.20&port_only=1&grace_s=60'
+
+With --controller the script polls /api/v1/presence and prints each change
+of the controller's view, including the trigger-to-wake latency. Without
+--cycle the stand-in stays present until interrupted.
+
+MQTT presence can be tested without this script:
+
+    mosquitto_pub -t lighthouse/presence -m home
+"""
+
+import argparse
+import json
+import socket
+import sys
+import time
+import urllib.request
+
+STATE_KEYS = ("present", "awake", "wakes", "sleeps", "false_wakes", "last_wake_latency_ms")
+
+
+def log(message):
+    print(f"{time.strftime('%H:%M:%S')} {message}", flush=True)
+
+
+class Listener:
+    """A TCP listener that accepts and immediately drops connections."""
+
+    def __init__(self, port):
+        self.port = port
+        self.sock = None
+
+    def up(self):
+        if self.sock:
+            return
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(("0.0.0.0", self.port))
+        self.sock.listen(4)
+        self.sock.setblocking(False)
+        log(f"present: listening on port {self.port}")
+
+    def down(self):
+        if not self.sock:
+            return
+        self.sock.close()
+        self.sock = None
+        log("absent: listener closed")
+
+    def service(self):
+        if not self.sock:
+            return
+        try:
+            conn, addr = self.sock.accept()
+            conn.close()
+            log(f"probed by {addr[0]}")
+        except BlockingIOError:
+            pass
+
+
+def fetch_presence(controller):
+    with urllib.request.urlopen(f"http://{controller}/api/v1/presence", timeout=2) as response:
+        return json.load(response)["presence"]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=27036, help="TCP port to listen on (default 27036)")
+    parser.add_argument("--cycle", type=float, nargs=2, metavar=("PRESENT_S", "ABSENT_S"),
+                        help="alternate between present and absent for these durations")
+    parser.add_argument("--controller", help="controller address, to print its presence state")
+    args = parser.parse_args()
+
+    listener = Listener(args.port)
+    listener.up()
+    phase_started = time.monotonic()
+    last_state = None
+    next_poll = 0.0
+
+    try:
+        while True:
+            now = time.monotonic()
+            if args.cycle:
+                present_s, absent_s = args.cycle
+                elapsed = now - phase_started
+                if listener.sock and elapsed >= present_s:
+                    listener.down()
+                    phase_started = now
+                elif not listener.sock and elapsed >= absent_s:
+                    listener.up()
+                    phase_started = now
+            listener.service()
+
+            if args.controller and now >= next_poll:
+                next_poll = now + 1.0
+                try:
+                    presence = fetch_presence(args.controller)
+                except OSError as error:
+                    log(f"controller unreachable: {error}")
+                else:
+                    state = {key: presence.get(key) for key in STATE_KEYS}
+                    if state != last_state:
+                        log("controller: " + ", ".join(f"{key}={value}" for key, value in state.items()))
+                        last_state = state
+            time.sleep(0.05)
+    except KeyboardInterrupt:
+        listener.down()
+        return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,185 @@
+/** Host-side check of the station frames against reference frames.
+ *
+ * Encodes every V1 command (with the timeout the firmware sends it with) and
+ * every V2 power value through StationTraits, the firmware's send path, and
+ * compares the bytes with frames taken from outside this codec. Each
+ * reference names where it came from:
+ *
+ *   capture   sniffed from a real station or the vendor software
+ *   firmware  what the firmware in this repository's first commit wrote to
+ *             stations: nullstalgia's main.cpp, makeLighthouseCommand() in
+ *             src/main.cpp and lighthouse_controller.ino
+ *   layout    built by hand from the documented frame layout only, no
+ *             independent source yet
+ *
+ * No captures ship with the repository yet. More references, e.g. from an
+ * nRF Connect log or a btsnoop capture of SteamVR, can be passed in a file:
+ *
+ *   v1 <unique id> <on|off|standby> <40 hex digits, no spaces> [source...]
+ *   v2 <on|off|standby> <2 hex digits> [source...]
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O2 -Ilib/lighthouse_core/src tools/protocol_check/protocol_check.cpp -o protocol_check
+ *
+ * Usage:
+ *   protocol_check [captures.txt]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch_plan.h"
+#include "lighthouse_protocol.h"
+#include "station_transport.h"
+
+using lighthouse::StationTraits;
+
+struct Reference {
+  uint8_t version;
+  const char* uniqueId;  // V1 only
+  uint8_t action;        // ACTION_*; 0 with a V1 command below
+  uint8_t v1Command;     // Used when action is 0
+  uint16_t v1Timeout;
+  const char* hex;
+  const char* source;
+};
+
+static const Reference kReferences[] = {
+    {1, "3BBF1347", ACTION_ON, 0, 0, "12 00 00 00 47 13 BF 3B 00 00 00 00 00 00 00 00 00 00 00 00",
+     "firmware: makeLighthouseCommand(buf, 0x00, 0, id) in src/main.cpp, first commit"},
+    {1, "3BBF1347", ACTION_OFF, 0, 0, "12 02 00 01 47 13 BF 3B 00 00 00 00 00 00 00 00 00 00 00 00",
+     "firmware: makeLighthouseCommand(buf, 0x02, 1, id) in src/main.cpp and the TURN_OFF frame in "
+     "nullstalgia's main.cpp, first commit"},
+    {1, "3BBF1347", ACTION_STANDBY, 0, 0, "12 02 00 01 47 13 BF 3B 00 00 00 00 00 00 00 00 00 00 00 00",
+     "firmware: V1 has no standby, the sleep frame above goes out instead"},
+    {1, "6BC162BD", ACTION_OFF, 0, 0, "12 02 00 01 BD 62 C1 6B 00 00 00 00 00 00 00 00 00 00 00 00",
+     "firmware: as above, second ID to catch byte order mistakes"},
+    {1, "6BC162BD", 0, lighthouse::v1::WAKE_TIMEOUT, 60,
+     "12 01 00 3C BD 62 C1 6B 00 00 00 00 00 00 00 00 00 00 00 00",
+     "layout: README V1 command structure; command 0x01 has no independent reference"},
+    {2, nullptr, ACTION_ON, 0, 0, "01", "firmware: TURN_ON_PERM write in lighthouse_controller.ino, first commit"},
+    {2, nullptr, ACTION_OFF, 0, 0, "00", "firmware: TURN_OFF write in lighthouse_controller.ino, first commit"},
+    {2, nullptr, ACTION_STANDBY, 0, 0, "02", "layout: power value 0x02, no independent reference"},
+};
+
+static size_t parseHex(const char* hex, uint8_t* out, size_t max) {
+  size_t n = 0;
+  while (*hex != '\0' && n < max) {
+    if (*hex == ' ') {
+      hex++;
+      continue;
+    }
+    int hi = lighthouse::v1::hexNibble(hex[0]);
+    int lo = hex[1] != '\0' ? lighthouse::v1::hexNibble(hex[1]) : -1;
+    if (hi < 0 || lo < 0) return 0;
+    out[n++] = (uint8_t)(hi << 4 | lo);
+    hex += 2;
+  }
+  return n;
+}
+
+static void printBytes(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) printf(" %02X", data[i]);
+  printf("\n");
+}
+
+// Encodes `ref` through the firmware's path; false if it has no frame
+static bool encode(const Reference& ref, uint8_t* out, size_t& len) {
+  if (ref.version == 1) {
+    uint32_t id = 0;
+    if (!lighthouse::v1::parseUniqueId(ref.uniqueId, id)) return false;
+    StationTraits<1>::Frame frame{};
+    if (ref.action == 0) {
+      frame = lighthouse::v1::makeFrame((lighthouse::v1::Command)ref.v1Command, ref.v1Timeout, id);
+    } else if (!StationTraits<1>::encode(ref.action, lighthouse::v1::makeStationFrames(id), frame)) {
+      return false;
+    }
+    memcpy(out, frame.data(), frame.size());
+    len = frame.size();
+    return true;
+  }
+  StationTraits<2>::Frame frame{};
+  if (!StationTraits<2>::encode(ref.action, {}, frame)) return false;
+  memcpy(out, frame.data(), frame.size());
+  len = frame.size();
+  return true;
+}
+
+static bool check(const Reference& ref) {
+  uint8_t expected[lighthouse::v1::kFrameSize];
+  size_t expectedLen = parseHex(ref.hex, expected, sizeof(expected));
+  uint8_t actual[lighthouse::v1::kFrameSize];
+  size_t actualLen = 0;
+  const char* what = ref.action != 0 ? stationActionName(ref.action) : "timed wake";
+  bool ok = expectedLen > 0 && encode(ref, actual, actualLen) && actualLen == expectedLen &&
+            memcmp(actual, expected, expectedLen) == 0;
+  printf("%s V%u %s%s%s\n    %s\n", ok ? "ok  " : "FAIL", ref.version, what, ref.uniqueId ? " " : "",
+         ref.uniqueId ? ref.uniqueId : "", ref.source);
+  if (!ok) {
+    printf("    expected:");
+    printBytes(expected, expectedLen);
+    printf("    encoded: ");
+    printBytes(actual, actualLen);
+  }
+  return ok;
+}
+
+static uint8_t parseAction(const char* name) {
+  if (strcmp(name, "on") == 0) return ACTION_ON;
+  if (strcmp(name, "off") == 0) return ACTION_OFF;
+  if (strcmp(name, "standby") == 0) return ACTION_STANDBY;  // Sleep frame on V1
+  return 0;
+}
+
+// One reference per line, see the top of the file; # starts a comment
+static int checkFile(const char* path, int& failures) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return -1;
+  }
+  char line[512];
+  int checked = 0;
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    line[strcspn(line, "\r\n#")] = '\0';
+    char kind[4] = {}, id[16] = {}, action[16] = {}, hex[41] = {};
+    int used = 0;
+    Reference ref = {};
+    if (sscanf(line, " v1 %15s %15s %40[0-9A-Fa-f]%n", id, action, hex, &used) >= 3) {
+      ref.version = 1;
+      ref.uniqueId = id;
+    } else if (sscanf(line, " v2 %15s %2[0-9A-Fa-f]%n", action, hex, &used) >= 2) {
+      ref.version = 2;
+    } else {
+      if (sscanf(line, " %3s", kind) == 1) fprintf(stderr, "Ignoring line: %s\n", line);
+      continue;
+    }
+    ref.action = parseAction(action);
+    ref.hex = hex;
+    const char* source = line + used;
+    while (*source == ' ' || *source == '\t') source++;
+    ref.source = used > 0 && *source != '\0' ? source : path;
+    if (ref.action == 0 || !check(ref)) failures++;
+    checked++;
+  }
+  fclose(file);
+  return checked;
+}
+
+int main(int argc, char** argv) {
+  int failures = 0;
+  int layoutOnly = 0;
+  for (const Reference& ref : kReferences) {
+    if (!check(ref)) failures++;
+    if (strncmp(ref.source, "layout", 6) == 0) layoutOnly++;
+  }
+  int checked = sizeof(kReferences) / sizeof(kReferences[0]);
+  for (int i = 1; i < argc; i++) {
+    int n = checkFile(argv[i], failures);
+    if (n < 0) return 2;
+    checked += n;
+  }
+  printf("%d frames checked, %d failed, %d built-in ones backed by the frame layout only\n", checked, failures,
+         layoutOnly);
+  return failures == 0 ? 0 : 1;
+}
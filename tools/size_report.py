@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Build every PlatformIO environment and compare flash and RAM use.
+
+The environments in platformio.ini differ in which firmware components they
+include (see src/controller.h). Run from the repository root:
+
+    python tools/size_report.py                      # all environments
+    python tools/size_report.py esp32dev esp32dev-buttons
+
+Prints a Markdown table with the static RAM and flash figures PlatformIO
+reports after linking, and the difference to the first environment.
+"""
+
+import argparse
+import configparser
+import os
+import re
+import subprocess
+import sys
+
+PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+USAGE = re.compile(r"^(RAM|Flash):.*\(used (\d+) bytes from (\d+) bytes\)", re.MULTILINE)
+
+
+def environments():
+    config = configparser.ConfigParser(interpolation=None)
+    config.read(os.path.join(PROJECT_DIR, "platformio.ini"))
+    return [section[4:] for section in config.sections() if section.startswith("env:")]
+
+
+def build(env):
+    """Returns {"RAM": (used, total), "Flash": (used, total)}."""
+    result = subprocess.run(["pio", "run", "-e", env], cwd=PROJECT_DIR, capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stdout[-2000:] + result.stderr[-2000:])
+        raise SystemExit(f"build of {env} failed")
+    usage = {kind: (int(used), int(total)) for kind, used, total in USAGE.findall(result.stdout)}
+    if len(usage) != 2:
+        raise SystemExit(f"no size summary in the output for {env}")
+    return usage
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("envs", nargs="*", help="environments to build (default: all in platformio.ini)")
+    args = parser.parse_args()
+
+    envs = args.envs or environments()
+    sizes = {}
+    for env in envs:
+        print(f"building {env}...", file=sys.stderr)
+        sizes[env] = build(env)
+
+    base = sizes[envs[0]]
+    print(f"| environment | flash | RAM | flash vs {envs[0]} | RAM vs {envs[0]} |")
+    print("|---|---:|---:|---:|---:|")
+    for env in envs:
+        flash, ram = sizes[env]["Flash"][0], sizes[env]["RAM"][0]
+        print(f"| {env} | {flash} | {ram} | {flash - base['Flash'][0]:+d} | {ram - base['RAM'][0]:+d} |")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
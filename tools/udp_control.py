@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""Client for the controller's binary UDP control port, with latency stats.
+
+Sends pings or commands (see lib/lighthouse_core/src/udp_control.h for the
+framing) and measures the round trip to the ack and, for commands, the time
+until the final status datagram. Enable the port first:
+
+    curl 'http://192.168.1.50/api/v1/udp?enabled=1&key=s3cret'
+
+Transport round trip, no BLE involved:
+
+    python tools/udp_control.py 192.168.1.50 --key s3cret ping --count 200
+
+Switch stations 0 and 1 on (or all configured stations plus unconfigured V2
+ones with --targets all), printing each status update:
+
+    python tools/udp_control.py 192.168.1.50 --key s3cret on --targets 0,1
+
+Lost datagrams are retransmitted with the same sequence number; the
+controller acks a repeat again without running the command twice.
+"""
+
+import argparse
+import hashlib
+import hmac
+import random
+import socket
+import statistics
+import struct
+import sys
+import time
+
+VERSION = 1
+TAG_LEN = 16
+PING, COMMAND, ACK, STATUS = 0x01, 0x02, 0x81, 0x82
+FLAG_UNMAPPED, FLAG_ALL = 0x01, 0x02
+ACTIONS = {"on": 1, "off": 2, "standby": 3}
+ACK_CODES = {0x00: "started", 0x01: "queued", 0x02: "pong", 0x10: "bad frame", 0x11: "bad tag",
+             0x12: "replay", 0x13: "bad target"}
+PHASES = {0: "queued", 1: "scanning", 2: "switching", 3: "done"}
+
+
+class Controller:
+    def __init__(self, host, port, key, timeout):
+        self.address = (host, port)
+        self.key = key.encode() if key else None
+        self.timeout = timeout
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        # Keyed controllers reject old sequence numbers, so never start low
+        self.seq = random.randrange(0x10000)
+
+    def tag(self, data):
+        return hmac.new(self.key, data, hashlib.sha256).digest()[:TAG_LEN]
+
+    def send(self, kind, action=0, targets=0, flags=0):
+        frame = struct.pack(">2sBBHBBBB", b"LH", VERSION, kind, self.seq, action, targets, flags, 0)
+        if self.key:
+            frame += self.tag(frame)
+        self.sock.sendto(frame, self.address)
+        return frame
+
+    def receive(self, deadline):
+        """Next valid datagram for the current sequence number, or None."""
+        while True:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                return None
+            self.sock.settimeout(left)
+            try:
+                data, _ = self.sock.recvfrom(64)
+            except socket.timeout:
+                return None
+            if self.key:
+                data, tag = data[:-TAG_LEN], data[-TAG_LEN:]
+                if not hmac.compare_digest(tag, self.tag(data)):
+                    print("ignoring datagram with a bad tag", file=sys.stderr)
+                    continue
+            if len(data) < 8 or data[:2] != b"LH" or struct.unpack(">H", data[4:6])[0] != self.seq:
+                continue
+            return data
+
+    def request(self, kind, action=0, targets=0, flags=0, retries=3):
+        """Send until acked. Returns (ack code, round trip in ms, send time)."""
+        self.seq = (self.seq + 1) & 0xFFFF
+        frame = None
+        for _ in range(retries + 1):
+            started = time.monotonic()
+            if frame is None:
+                frame = self.send(kind, action, targets, flags)
+            else:
+                self.sock.sendto(frame, self.address)
+            data = self.receive(started + self.timeout)
+            while data is not None and data[3] != ACK:
+                data = self.receive(started + self.timeout)
+            if data is not None:
+                return data[6], (time.monotonic() - started) * 1000, started
+        return None, None, None
+
+    def follow(self, sent_at, limit_s):
+        """Print status datagrams until the final one. Returns ms to done."""
+        deadline = time.monotonic() + limit_s
+        while True:
+            data = self.receive(deadline)
+            if data is None:
+                return None
+            if data[3] != STATUS:
+                continue
+            phase, targets, switched, failed = data[6], data[7], data[8], data[9]
+            elapsed = struct.unpack(">I", data[10:14])[0]
+            print(f"  {PHASES.get(phase, phase):9} targets {targets:08b} switched {switched:08b} "
+                  f"failed {failed:08b} at {elapsed} ms")
+            if phase == 3:
+                return (time.monotonic() - sent_at) * 1000
+
+
+def parse_targets(text):
+    if text == "all":
+        return 0, FLAG_ALL | FLAG_UNMAPPED
+    mask = 0
+    for index in text.split(","):
+        mask |= 1 << int(index)
+    return mask, 0
+
+
+def summary(label, values):
+    if not values:
+        return
+    values = sorted(values)
+    p95 = values[min(len(values) - 1, int(len(values) * 0.95))]
+    print(f"{label}: n={len(values)} min={values[0]:.1f} median={statistics.median(values):.1f} "
+          f"p95={p95:.1f} max={values[-1]:.1f} ms")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("controller", help="controller address")
+    parser.add_argument("command", choices=["ping"] + list(ACTIONS))
+    parser.add_argument("--port", type=int, default=47800, help="UDP control port (default 47800)")
+    parser.add_argument("--key", help="HMAC key set with /api/v1/udp?key=...")
+    parser.add_argument("--targets", default="all", help="station indices, e.g. 0,1, or 'all' (default)")
+    parser.add_argument("--count", type=int, default=1, help="number of requests")
+    parser.add_argument("--interval", type=float, default=0.05, help="seconds between requests")
+    parser.add_argument("--timeout", type=float, default=0.5, help="seconds to wait for an ack before resending")
+    args = parser.parse_args()
+
+    controller = Controller(args.controller, args.port, args.key, args.timeout)
+    acks, done, lost = [], [], 0
+    for i in range(args.count):
+        if args.command == "ping":
+            code, rtt, _ = controller.request(PING)
+        else:
+            targets, flags = parse_targets(args.targets)
+            code, rtt, sent_at = controller.request(COMMAND, ACTIONS[args.command], targets, flags)
+        if code is None:
+            lost += 1
+            print(f"#{i}: no ack")
+            continue
+        acks.append(rtt)
+        print(f"#{i}: {ACK_CODES.get(code, hex(code))} in {rtt:.1f} ms")
+        if args.command != "ping" and code in (0x00, 0x01):
+            total = controller.follow(sent_at, 90)
+            if total is not None:
+                done.append(total)
+        time.sleep(args.interval)
+
+    summary("ack round trip", acks)
+    summary("request to done", done)
+    if lost:
+        print(f"{lost} of {args.count} requests unacknowledged")
+    return 1 if lost == args.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
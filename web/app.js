@@ -0,0 +1,12 @@
+function editName(id) {
+  document.getElementById('rename-' + id).style.display = 'block';
+}
+function cancelEdit(id) {
+  document.getElementById('rename-' + id).style.display = 'none';
+}
+function saveName(id) {
+  var newName = document.getElementById('name-' + id).value;
+  if (newName.trim() !== '') {
+    window.location.href = '/rename?id=' + id + '&name=' + encodeURIComponent(newName);
+  }
+}